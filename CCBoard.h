@@ -0,0 +1,34 @@
+
+#ifndef CCBOARD_H
+#define CCBOARD_H
+
+/*
+ * Fixed wirings with transfer kernels of their own (make BOARD=...) :
+ * the pins are constants, the GPIO registers are written directly through
+ * a mapping, and the 8 bits of a byte are unrolled. cc_init() uses them
+ * when the gpiochip and the pins asked for are the ones of the board;
+ * anything else goes through libgpiod as before.
+ */
+
+#if defined(CC_BOARD_RPI)
+
+// Raspberry Pi 1 to 4 (BCM2835 to BCM2711), wiring of the README
+#define BOARD_NAME      "Raspberry Pi"
+#define BOARD_CHIP      "gpiochip0"
+#define BOARD_RST       19
+#define BOARD_DC        16
+#define BOARD_DD        20
+
+// GPIO registers, mapped from offset 0 of /dev/gpiomem (no root needed)
+#define BOARD_GPIOMEM   "/dev/gpiomem"
+#define BOARD_MAPSIZE   0xB4
+#define GP_FSEL(pin)    ((pin) / 10)       // function select : 3 bits a pin
+#define GP_FSEL_SHIFT(pin) (((pin) % 10) * 3)
+#define GP_FSEL_OUTPUT  1
+#define GP_SET0         (0x1C / 4)
+#define GP_CLR0         (0x28 / 4)
+#define GP_LEV0         (0x34 / 4)
+
+#endif
+
+#endif
@@ -0,0 +1,124 @@
+/***********************************************************************
+    Cache of flash dumps, one per dongle.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+#include "CCCache.h"
+#include "CCImage.h"
+#include "CCLog.h"
+
+/**
+ * mkdir -p
+ */
+static int makeDirs(char *dir)
+{
+  for(char *s=dir+1 ; ; s++)
+  {
+    if(*s && *s!='/') continue;
+    char c=*s;
+    *s=0;
+    int res=mkdir(dir,0755);
+    *s=c;
+    if(res && errno!=EEXIST) return -1;
+    if(!c) return 0;
+  }
+}
+
+char *cache_path(const char *dir,uint16_t chipId,const uint8_t ieee[8])
+{
+  char base[1024];
+  if(!dir) dir=getenv("CC_CACHE");
+  if(dir)
+    snprintf(base,sizeof(base),"%s",dir);
+  else if(getenv("XDG_CACHE_HOME"))
+    snprintf(base,sizeof(base),"%s/cc_flash",getenv("XDG_CACHE_HOME"));
+  else if(getenv("HOME"))
+    snprintf(base,sizeof(base),"%s/.cache/cc_flash",getenv("HOME"));
+  else
+  {
+    LOG_ERR("no cache directory : set CC_CACHE");
+    return NULL;
+  }
+  if(makeDirs(base))
+  {
+    LOG_ERR("%s : %s",base,strerror(errno));
+    return NULL;
+  }
+  // IEEE address most significant byte first, as printed on labels
+  char *path=malloc(strlen(base)+32);
+  if(!path) return NULL;
+  sprintf(path,"%s/%04x-%02x%02x%02x%02x%02x%02x%02x%02x.ccimg",base,chipId,
+	ieee[7],ieee[6],ieee[5],ieee[4],ieee[3],ieee[2],ieee[1],ieee[0]);
+  return path;
+}
+
+int cache_load(const char *path,struct image *img)
+{
+  if(access(path,R_OK))
+  {
+    LOG_INFO("no cached dump for this dongle yet.");
+    return -1;
+  }
+  if(image_loadSparse(path,img))
+  {
+    LOG_WARN("%s : unusable, reading everything.",path);
+    imageFree(img);
+    return -1;
+  }
+  LOG_DEBUG("cached dump %s",path);
+  return 0;
+}
+
+int cache_store(const char *path,struct image *img)
+{
+  char tmp[strlen(path)+8];
+  sprintf(tmp,"%s.new",path);
+  if(image_save(tmp,img,IMAGE_SPARSE))
+  {
+    unlink(tmp);
+    return -1;
+  }
+  if(rename(tmp,path))
+  {
+    LOG_ERR("%s : %s",path,strerror(errno));
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+uint16_t cache_pageCRC(struct image *img,int page)
+{
+  static uint16_t blank;
+  static int blankKnown=0;
+  struct page *p=img->pages[page];
+  if(p) return cc_crc16(0xFFFF,p->datas,FLASH_PAGE_SIZE);
+  if(!blankKnown)
+  {
+    uint8_t ff[FLASH_PAGE_SIZE];
+    memset(ff,0xff,sizeof(ff));
+    blank=cc_crc16(0xFFFF,ff,sizeof(ff));
+    blankKnown=1;
+  }
+  return blank;
+}
@@ -0,0 +1,39 @@
+
+#ifndef CCCACHE_H
+#define CCCACHE_H
+
+#include <stdint.h>
+#include "CCFlash.h"
+
+/*
+ * Cache of the last dump of each dongle : a sparse image (see CCImage.h)
+ * named after the chip ID and the IEEE address, <dir>/<id>-<ieee>.ccimg.
+ * A page whose CRC computed by the target matches the cached page need
+ * not be read again.
+ */
+
+  /**
+   * Path of the cache file of a dongle, allocated. <dir> may be NULL :
+   * $CC_CACHE, else $XDG_CACHE_HOME/cc_flash, else ~/.cache/cc_flash.
+   * The directory is created if needed. NULL after logging on failure.
+   */
+  char *cache_path( const char *dir, uint16_t chipId, const uint8_t ieee[8] );
+
+  /**
+   * Load the cached dump into <img>, 0 if found and valid
+   */
+  int cache_load( const char *path, struct image *img );
+
+  /**
+   * Replace the cached dump (written aside, then renamed).
+   * Returns 0, or -1 after logging.
+   */
+  int cache_store( const char *path, struct image *img );
+
+  /**
+   * CRC16 of a whole page of <img>, as flashCRC() computes it
+   * (a page missing from the image is blank)
+   */
+  uint16_t cache_pageCRC( struct image *img, int page );
+
+#endif
@@ -21,9 +21,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <time.h>
 
 #include "CCDebugger.h"
+#include "CCSim.h"
+#include "CCTrace.h"
+#include "CCRecord.h"
+#include "CCRealtime.h"
+#include "CCLog.h"
+#include "CCRegs.h"
 
 #define INPUT   0
 #define OUTPUT  1
@@ -37,35 +44,16 @@
    */
   void cc_setDDDirection( uint8_t direction );
 
-  /**
-   * Software-overridable instruction table that can be used
-   * for supporting other CCDebug-Compatible chips purely by software
-   */
-  uint8_t      instr[16];
-
-  /**
-   * Local properties
-   */
-  int       pinRST= PIN_RST;
-  int       pinDC= PIN_DC;
-  int       pinDD= PIN_DD;
-  uint8_t      errorFlag=0;
-  uint8_t      ddIsOutput=false;
-  uint8_t      inDebugMode=false;
-  uint8_t   cc_active=false;
-
   /**
    * GPIO consumer 
    */
     const char *consumer = "cc-debugger";
 
   /**
-   * libgpiod chip and lines
+   * Target of the last cc_init(), and target selected in each thread
    */
-    struct gpiod_chip *chip;
-    struct gpiod_line *rst_line;
-    struct gpiod_line *dc_line;
-    struct gpiod_line *dd_line;
+  static struct ccTarget defaultTarget = { .pinRST=PIN_RST, .pinDC=PIN_DC, .pinDD=PIN_DD };
+  static __thread struct ccTarget *T = &defaultTarget;
 
   /**
  * Instruction table indices
@@ -90,102 +78,298 @@
 
 void cc_delay_calibrate();
 
-int cc_init(const char *name, int pRST, int pDC, int pDD )
+/**
+ * Clock control : CLKCONCMD.OSC (bit 6) selects the 16 MHz RC oscillator,
+ * CLKSPD (bits 2:0) divides the system clock. CLKCONSTA follows once the
+ * oscillator is stable.
+ */
+#define CLK_XOSC_32MHZ  0x80    // 32 kHz RCOSC, 32 MHz XOSC, tick and clock undivided
+#define XOSC_POLLS      100
+
+/**
+ * Line accessors : every pin access of the transport goes through these,
+ * so the GPIO backend can be swapped for the simulated target.
+ */
+static inline int cc_lineSet( uint8_t line, int value )
+{
+  if (T->traced && cc_tracing) cc_traceEvent(line, value);
+  if (T->sim) {
+    ccsim_pinWrite(line, value);
+    return 0;
+  }
+  switch (line) {
+    case CC_LINE_RST: return gpiod_line_set_value(T->rst_line, value);
+    case CC_LINE_DC:  return gpiod_line_set_value(T->dc_line, value);
+    case CC_LINE_DD:  return gpiod_line_set_value(T->dd_line, value);
+  }
+  return -1;
+}
+
+static inline int cc_lineGetDD()
+{
+  int value;
+  if (T->sim)
+    value = ccsim_pinRead();
+  else
+    value = gpiod_line_get_value(T->dd_line);
+  if (T->traced && cc_tracing) cc_traceEvent(CC_TRACE_DD_IN, value);
+  return value;
+}
+
+#ifdef CC_BOARD_RPI
+/**
+ * Transfer kernels of a fixed wiring (CCBoard.h) : constant masks on the
+ * set, clear and level registers, one unrolled byte a call. Same bus
+ * timing as the generic loops, without a libgpiod call a line edge.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "CCBoard.h"
+
+#define DC_MASK   (1u << BOARD_DC)
+#define DD_MASK   (1u << BOARD_DD)
+
+static volatile uint32_t *gpio;   // GPIO registers, mapped once per process
+
+/**
+ * Use the kernels if the target is wired as the board, and the registers
+ * can be mapped
+ */
+static uint8_t boardOpen( const char *name )
+{
+  if (!name || strcmp(name, BOARD_CHIP) || T->pinRST != BOARD_RST
+      || T->pinDC != BOARD_DC || T->pinDD != BOARD_DD)
+    return 0;
+  if (!gpio) {
+    int fd = open(BOARD_GPIOMEM, O_RDWR | O_SYNC);
+    if (fd < 0) {
+      LOG_DEBUG("%s : %s, generic line access", BOARD_GPIOMEM, strerror(errno));
+      return 0;
+    }
+    void *map = mmap(NULL, BOARD_MAPSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      LOG_DEBUG("%s : %s, generic line access", BOARD_GPIOMEM, strerror(errno));
+      return 0;
+    }
+    gpio = map;
+  }
+  LOG_INFO("%s wiring : fixed pin transfer kernels", BOARD_NAME);
+  return 1;
+}
+
+static inline void boardDDDirection( uint8_t output )
+{
+  uint32_t fsel = gpio[GP_FSEL(BOARD_DD)] & ~(7u << GP_FSEL_SHIFT(BOARD_DD));
+  // DD is left low, as libgpiod does
+  gpio[GP_CLR0] = DD_MASK;
+  if (output) fsel |= GP_FSEL_OUTPUT << GP_FSEL_SHIFT(BOARD_DD);
+  gpio[GP_FSEL(BOARD_DD)] = fsel;
+}
+
+// data bit on DD (SET or CLR register picked without a branch), then a DC pulse
+#define BOARD_WRITE_BIT(mask) \
+  gpio[(data & (mask)) ? GP_SET0 : GP_CLR0] = DD_MASK; \
+  gpio[GP_SET0] = DC_MASK; \
+  cc_delay(20); \
+  gpio[GP_CLR0] = DC_MASK; \
+  cc_delay(20);
+
+static inline void boardWrite( uint8_t data )
+{
+  BOARD_WRITE_BIT(0x80) BOARD_WRITE_BIT(0x40) BOARD_WRITE_BIT(0x20) BOARD_WRITE_BIT(0x10)
+  BOARD_WRITE_BIT(0x08) BOARD_WRITE_BIT(0x04) BOARD_WRITE_BIT(0x02) BOARD_WRITE_BIT(0x01)
+}
+
+// DC high, DD sampled into bit <n>, DC low
+#define BOARD_READ_BIT(n) \
+  gpio[GP_SET0] = DC_MASK; \
+  cc_delay(32); \
+  data |= ((gpio[GP_LEV0] >> BOARD_DD) & 1) << (n); \
+  gpio[GP_CLR0] = DC_MASK; \
+  cc_delay(32);
+
+static inline uint8_t boardRead()
 {
+  uint8_t data = 0;
+  BOARD_READ_BIT(7) BOARD_READ_BIT(6) BOARD_READ_BIT(5) BOARD_READ_BIT(4)
+  BOARD_READ_BIT(3) BOARD_READ_BIT(2) BOARD_READ_BIT(1) BOARD_READ_BIT(0)
+  return data;
+}
+#endif
 
-  if(pRST>=0) pinRST=pRST;
-  if(pDC>=0) pinDC=pDC;
-  if(pDD>=0) pinDD=pDD;
+/**
+ * Claim the lines of the selected target
+ */
+static int targetInit(const char *name, int pRST, int pDC, int pDD )
+{
 
-  chip = gpiod_chip_open_by_name(name);
+  if(pRST>=0) T->pinRST=pRST;
+  if(pDC>=0) T->pinDC=pDC;
+  if(pDD>=0) T->pinDD=pDD;
+
+  cc_logInit();
+
+  // record a waveform of the debug bus if asked for (first target only :
+  // the trace buffer is not shared between threads)
+  const char *trace = getenv("CC_TRACE");
+  if (trace && *trace && !cc_tracing && !cc_traceOpen(trace))
+    T->traced = 1;
+  // and the debug commands of this target
+  const char *record = getenv("CC_RECORD");
+  if (record && *record && !cc_recording && !cc_recordOpen(record))
+    T->recorded = 1;
+
+  if (name && !strcmp(name, "sim")) {
+    T->sim = ccsim_new();
+    if (!T->sim) {
+      LOG_ERR("out of memory");
+      return -1;
+    }
+    LOG_INFO("Use simulated target");
+  } else {
+
+  T->chip = gpiod_chip_open_by_name(name);
   
-  if (!chip) {
-    printf("chip with name %s not found\n", name);
+  if (!T->chip) {
+    LOG_ERR("chip with name %s not found", name);
     return -1;
   }
 
-  printf("Use chip %s/%s\n", gpiod_chip_name(chip), gpiod_chip_label(chip));
+  LOG_INFO("Use chip %s/%s", gpiod_chip_name(T->chip), gpiod_chip_label(T->chip));
   
   //cc_delay_calibrate();
 
   // Prepare CC Pins
   
-  rst_line = gpiod_chip_get_line(chip, pinRST);
-    if (rst_line) {
-        if(gpiod_line_request_output(rst_line, consumer, LOW) == 0)
-            printf("Success switch rst line %d to output\n", pinRST);
+  // RST released : cc_enter() pulses it, and cc_attach() joins a session
+  // that a reset would end
+  T->rst_line = gpiod_chip_get_line(T->chip, T->pinRST);
+    if (T->rst_line) {
+        if(gpiod_line_request_output(T->rst_line, consumer, HIGH) == 0)
+            LOG_DEBUG("Success switch rst line %d to output", T->pinRST);
         else
-            printf("Switch rst line %d to output failed\n", pinRST);
+            LOG_ERR("Switch rst line %d to output failed", T->pinRST);
     }
 
-  dc_line = gpiod_chip_get_line(chip, pinDC);
-  if (dc_line) {
-        if(gpiod_line_request_output(dc_line, consumer, LOW) == 0)
-            printf("Success switch dc line %d to output\n", pinDC);
+  T->dc_line = gpiod_chip_get_line(T->chip, T->pinDC);
+  if (T->dc_line) {
+        if(gpiod_line_request_output(T->dc_line, consumer, LOW) == 0)
+            LOG_DEBUG("Success switch dc line %d to output", T->pinDC);
         else
-            printf("Switch dc line %d to output failed\n", pinDC);
+            LOG_ERR("Switch dc line %d to output failed", T->pinDC);
   }
 
-  dd_line = gpiod_chip_get_line(chip, pinDD);
-  if (dd_line) {
-        if(gpiod_line_request_output(dd_line, consumer, LOW) == 0)
-            printf("Success switch dd line %d to output\n", pinDD);
+  T->dd_line = gpiod_chip_get_line(T->chip, T->pinDD);
+  if (T->dd_line) {
+        if(gpiod_line_request_output(T->dd_line, consumer, LOW) == 0)
+            LOG_DEBUG("Success switch dd line %d to output", T->pinDD);
         else
-            printf("Switch dd line %d to output failed\n", pinDD);
+            LOG_ERR("Switch dd line %d to output failed", T->pinDD);
+  }
+
+#ifdef CC_BOARD_RPI
+  T->board = boardOpen(name);
+#endif
   }
 
   // Default CCDebug instruction set for CC254x
-  instr[INSTR_VERSION]    = 1;
-  instr[I_HALT]           = 0x40;
-  instr[I_RESUME]         = 0x48;
-  instr[I_RD_CONFIG]      = 0x20;
-  instr[I_WR_CONFIG]      = 0x18;
-  instr[I_DEBUG_INSTR_1]  = 0x51;
-  instr[I_DEBUG_INSTR_2]  = 0x52;
-  instr[I_DEBUG_INSTR_3]  = 0x53;
-  instr[I_GET_CHIP_ID]    = 0x68;
-  instr[I_GET_PC]         = 0x28;
-  instr[I_READ_STATUS]    = 0x30;
-  instr[I_STEP_INSTR]     = 0x58;
-  instr[I_CHIP_ERASE]     = 0x10;
+  T->instr[INSTR_VERSION]    = 1;
+  T->instr[I_HALT]           = 0x40;
+  T->instr[I_RESUME]         = 0x48;
+  T->instr[I_RD_CONFIG]      = 0x20;
+  T->instr[I_WR_CONFIG]      = 0x18;
+  T->instr[I_DEBUG_INSTR_1]  = 0x51;
+  T->instr[I_DEBUG_INSTR_2]  = 0x52;
+  T->instr[I_DEBUG_INSTR_3]  = 0x53;
+  T->instr[I_GET_CHIP_ID]    = 0x68;
+  T->instr[I_GET_PC]         = 0x28;
+  T->instr[I_READ_STATUS]    = 0x30;
+  T->instr[I_STEP_INSTR]     = 0x58;
+  T->instr[I_CHIP_ERASE]     = 0x10;
+  T->instr[I_SET_HW_BRKPNT]  = 0x38;
+
+  T->config = -1;
 
   // We are active by default
-  cc_active = true;
-//  gpiod_chip_close(chip);
+  T->active = true;
+//  gpiod_chip_close(T->chip);
 
   return 1;
 };
 
+int cc_init(const char *name, int pRST, int pDC, int pDD )
+{
+  cc_select(&defaultTarget);
+  return targetInit(name, pRST, pDC, pDD);
+}
+
+struct ccTarget *cc_open(const char *name, int pRST, int pDC, int pDD )
+{
+  struct ccTarget *prev = T;
+  struct ccTarget *t = calloc(1, sizeof(*t));
+  if (!t) return NULL;
+  t->pinRST = PIN_RST;
+  t->pinDC = PIN_DC;
+  t->pinDD = PIN_DD;
+  cc_select(t);
+  if (targetInit(name, pRST, pDC, pDD) < 0) {
+    free(t);
+    cc_select(prev);
+    return NULL;
+  }
+  return t;
+}
+
+void cc_select( struct ccTarget *t )
+{
+  T = t;
+  if (t->sim) ccsim_select(t->sim);
+}
+
+struct ccTarget *cc_current()
+{
+  return T;
+}
+
 /**
  * Activate/Deactivate debugger
  */
 void cc_setActive( uint8_t on )
 {
   // Reset error flag
-  errorFlag = CC_ERROR_NONE;
+  T->errorFlag = CC_ERROR_NONE;
 
   // Continue only if active
-  if (on == cc_active) return;
-  cc_active = on;
+  if (on == T->active) return;
+  T->active = on;
+
+  if (!on && T->traced) cc_traceClose();
+  if (!on && T->recorded) cc_recordClose();
+
+  // The simulated target has no lines to release
+  if (T->sim) return;
 
   if (on) {
     // Prepare CC pins
-    gpiod_line_request_output(dc_line, consumer, LOW);
-    gpiod_line_request_output(dd_line, consumer, LOW);
-    gpiod_line_request_output(rst_line, consumer, LOW);
+    gpiod_line_request_output(T->dc_line, consumer, LOW);
+    gpiod_line_request_output(T->dd_line, consumer, LOW);
+    gpiod_line_request_output(T->rst_line, consumer, HIGH);
 
   } else {
       
     // Before deactivating, exit debug mode
-    if (inDebugMode)
+    if (T->inDebugMode)
       cc_exit();
 
-    gpiod_line_request_input(dc_line, consumer);
-    gpiod_line_request_input(dd_line, consumer);
-    gpiod_line_request_input(rst_line, consumer);
+    gpiod_line_request_input(T->dc_line, consumer);
+    gpiod_line_request_input(T->dd_line, consumer);
+    gpiod_line_request_input(T->rst_line, consumer);
   }
   
-  gpiod_chip_close(chip);
+  gpiod_chip_close(T->chip);
 }
 
 /**
@@ -193,7 +377,7 @@ void cc_setActive( uint8_t on )
  */
 uint8_t cc_error()
 {
-  return errorFlag;
+  return T->errorFlag;
 }
 
 /////////////////////////////////////////////////////////////////////
@@ -207,48 +391,202 @@ uint8_t cc_error()
  */
 void cc_delay( uint8_t d )
 {
+    // the target samples twice faster on the crystal
+    if (T->clockMHz == 32) d >>= 1;
+    if (cc_rtActive) {
+      cc_rtDelay(d);
+      return;
+    }
     struct timespec tp = {0, d};
     nanosleep(&tp, NULL);
 
 }
 
+void cc_useXOSC( uint8_t on )
+{
+  T->useXOSC = on;
+}
+
+int cc_clockMHz()
+{
+  return T->clockMHz ? T->clockMHz : 16;
+}
+
+/**
+ * Switch to the 32 MHz crystal and wait until it drives the system clock.
+ * A crystal that doesn't start leaves the former clock in place.
+ * (MOV A,direct / MOV direct,#data : the register shadow forgets A and
+ * SFRs on the epoch change of cc_enter())
+ */
+static void clockUp()
+{
+  uint8_t clkcon = cc_exec2(0xE5, SFR_CLKCONCMD);
+  if (clkcon == CLK_XOSC_32MHZ) {
+    T->clockMHz = 32;
+    return;
+  }
+  cc_exec3(0x75, SFR_CLKCONCMD, CLK_XOSC_32MHZ);
+  for (int i = 0; i < XOSC_POLLS && !T->errorFlag; i++) {
+    if (cc_exec2(0xE5, SFR_CLKCONSTA) == CLK_XOSC_32MHZ) {
+      T->savedClock = clkcon;
+      T->clockMHz = 32;
+      LOG_DEBUG("32 MHz XOSC after %d polls", i);
+      return;
+    }
+  }
+  LOG_WARN("32 MHz crystal not stable, staying on the RC oscillator");
+  cc_exec3(0x75, SFR_CLKCONCMD, clkcon);
+}
+
+/**
+ * Give back the clock found at cc_enter()
+ */
+static void clockDown()
+{
+  if (!T->savedClock) return;
+  cc_exec3(0x75, SFR_CLKCONCMD, T->savedClock);
+  T->savedClock = 0;
+  T->clockMHz = 16;
+}
+
+/**
+ * Registers saved by cc_saveContext(), the only ones the tools change
+ * besides the DMA and flash controller : MOVX/MOV DPTR use A and
+ * DPTR0 (DPS cleared), flash reads select the bank in MEMCTR.
+ */
+static const uint8_t contextSfrs[4] = { SFR_DPS, SFR_DPL, SFR_DPH, SFR_MEMCTR };
+
+uint8_t cc_saveContext()
+{
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
+    return 0;
+  }
+  if (!T->inDebugMode) {
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
+    return 0;
+  }
+  // NOP returns A, then MOV A,direct for the SFRs
+  T->contextRegs[CC_CTX_A] = cc_exec(0x00);
+  for (int i = 0; i < 4; i++)
+    T->contextRegs[1+i] = cc_exec2(0xE5, contextSfrs[i]);
+  if (T->contextRegs[CC_CTX_DPS] & 0x01)
+    cc_exec3(0x75, SFR_DPS, 0x00);
+  T->contextSaved = 1;
+  return T->contextRegs[CC_CTX_A];
+}
+
+uint8_t *cc_context()
+{
+  return T->contextSaved ? T->contextRegs : NULL;
+}
+
+int cc_attach()
+{
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
+    return -1;
+  }
+  T->errorFlag = CC_ERROR_NONE;
+
+  // a chip in debug mode answers with its ID, else DD stays idle
+  T->inDebugMode = 1;
+  uint16_t id = cc_getChipID();
+  if (T->errorFlag || id == 0 || id == 0xFFFF) {
+    LOG_DEBUG("no debug session (ID %04x)", id);
+    T->inDebugMode = 0;
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
+    return -1;
+  }
+  T->attachStatus = cc_getStatus();
+  T->config = -1;
+  T->attachConfig = cc_getConfig();
+  if (!(T->attachStatus & 0x20))              // CPU_HALTED
+    cc_halt();
+  T->cpuEpoch++;
+
+  cc_saveContext();
+  // run on the clock found, the program relies on it
+  T->clockMHz = (cc_exec2(0xE5, SFR_CLKCONSTA) & 0x40) ? 16 : 32;
+  T->savedClock = 0;
+  T->attached = 1;
+  LOG_DEBUG("attached, status %02x config %02x", T->attachStatus, T->attachConfig);
+  return T->errorFlag ? -1 : 0;
+}
+
+/**
+ * Give back the registers saved by cc_saveContext(), A last
+ */
+static void giveBack()
+{
+  if (!T->contextSaved) return;
+  for (int i = 3; i >= 0; i--)
+    cc_exec3(0x75, contextSfrs[i], T->contextRegs[1+i]);
+  cc_exec2(0x74, T->contextRegs[CC_CTX_A]);   // MOV A,#data
+  T->contextSaved = 0;
+}
+
+/**
+ * Give back the state found by cc_attach()
+ */
+static void detach()
+{
+  giveBack();
+  if (T->config != T->attachConfig)
+    cc_setConfig(T->attachConfig);
+  if (!(T->attachStatus & 0x20))
+    cc_resume();
+  T->attached = 0;
+  T->inDebugMode = 0;
+  T->cpuEpoch++;
+}
+
 /**
  * Enter debug mode
  */
 uint8_t cc_enter()
 {
-  if (!cc_active) {
-    errorFlag = CC_ERROR_NOT_ACTIVE;
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
     return 0;
   }
   // =============
 
   // Reset error flag
-  errorFlag = CC_ERROR_NONE;
+  T->errorFlag = CC_ERROR_NONE;
+  if (cc_recording && T->recorded) cc_recordEnter();
 
   // Enter debug mode
   int status;
-  status = gpiod_line_set_value(rst_line, LOW);
-  printf("Set rst low line status %d\n", status);
-  status = gpiod_line_set_value(dc_line, HIGH);
-  printf("Set rst high line status %d\n", status);
+  status = cc_lineSet(CC_LINE_RST, LOW);
+  LOG_TRACE("Set rst low line status %d", status);
+  status = cc_lineSet(CC_LINE_DC, HIGH);
+  LOG_TRACE("Set dc high line status %d", status);
   cc_delay(200);
-  status = gpiod_line_set_value(dc_line, LOW);
-  printf("Set dc low line status %d\n", status);
+  status = cc_lineSet(CC_LINE_DC, LOW);
+  LOG_TRACE("Set dc low line status %d", status);
   cc_delay(40);
-  status = gpiod_line_set_value(dc_line, HIGH);
-  printf("Set dc high line status %d\n", status);
+  status = cc_lineSet(CC_LINE_DC, HIGH);
+  LOG_TRACE("Set dc high line status %d", status);
   cc_delay(40);
-  status = gpiod_line_set_value(dc_line, LOW);
-  printf("Set dc low line status %d\n", status);
+  status = cc_lineSet(CC_LINE_DC, LOW);
+  LOG_TRACE("Set dc low line status %d", status);
   cc_delay(85);
-  status = gpiod_line_set_value(rst_line, HIGH);
-  printf("Set rst high line status %d\n", status);
+  status = cc_lineSet(CC_LINE_RST, HIGH);
+  LOG_TRACE("Set rst high line status %d", status);
   cc_delay(85);
-  printf("In debug mode\n");
+  LOG_DEBUG("In debug mode");
 
   // We are now in debug mode
-  inDebugMode = 1;
+  T->inDebugMode = 1;
+  T->cpuEpoch++;
+  // the reset brought the chip back on its RC oscillator
+  T->attached = 0;
+  T->contextSaved = 0;
+  T->config = -1;
+  T->clockMHz = 16;
+  T->savedClock = 0;
+  if (T->useXOSC) clockUp();
 
   // =============
 
@@ -262,39 +600,48 @@ uint8_t cc_enter()
  */
 uint8_t cc_write( uint8_t data )
 {
-   if (!cc_active) {
-     errorFlag = CC_ERROR_NOT_ACTIVE;
+   if (!T->active) {
+     T->errorFlag = CC_ERROR_NOT_ACTIVE;
      return 0;
    };
-   if (!inDebugMode) {
-     errorFlag = CC_ERROR_NOT_DEBUGGING;
+   if (!T->inDebugMode) {
+     T->errorFlag = CC_ERROR_NOT_DEBUGGING;
      return 0;
    }
    // =============
  
    uint8_t cnt;
 
+   if (cc_recording && T->recorded) cc_recordOut(data);
    // Make sure dd is on output
    cc_setDDDirection(OUTPUT);
+   if (cc_rtActive) cc_rtMark();
+#ifdef CC_BOARD_RPI
+   // the waveform trace wants every edge : generic loop then
+   if (T->board && !(T->traced && cc_tracing)) {
+     boardWrite(data);
+     return 0;
+   }
+#endif
  
    // Sent uint8_ts
    for (cnt = 8; cnt; cnt--) {
  
      // First put data bit on bus
      if (data & 0x80)
-        gpiod_line_set_value(dd_line, HIGH);
+        cc_lineSet(CC_LINE_DD, HIGH);
      else
-        gpiod_line_set_value(dd_line, LOW);
+        cc_lineSet(CC_LINE_DD, LOW);
      
      // Place clock on high (other end reads data)
-     gpiod_line_set_value(dc_line, HIGH);
+     cc_lineSet(CC_LINE_DC, HIGH);
   
      // Shift & Delay
      data <<= 1;
      cc_delay(20);
 
      // Place clock down
-     gpiod_line_set_value(dc_line, LOW);
+     cc_lineSet(CC_LINE_DC, LOW);
      cc_delay(20);
  
    }
@@ -308,17 +655,16 @@ uint8_t cc_write( uint8_t data )
  */
 uint8_t cc_switchRead(uint8_t maxWaitCycles)
 {
-   if (!cc_active) {
-     errorFlag = CC_ERROR_NOT_ACTIVE;
+   if (!T->active) {
+     T->errorFlag = CC_ERROR_NOT_ACTIVE;
      return 0;
    }
-   if (!inDebugMode) {
-     errorFlag = CC_ERROR_NOT_DEBUGGING;
+   if (!T->inDebugMode) {
+     T->errorFlag = CC_ERROR_NOT_DEBUGGING;
      return 0;
    }
    // =============
  
-   uint8_t cnt;
    uint8_t didWait = 0;
  
    // Switch to input
@@ -328,25 +674,20 @@ uint8_t cc_switchRead(uint8_t maxWaitCycles)
    cc_delay(32);
  
    // Wait for DD to go LOW (Chip is READY)
-   
-   struct timespec timeout = { 0, 200 };
-//   struct gpiod_line_event event = { &timeout, GPIOD_LINE_EVENT_FALLING_EDGE };
-   if (gpiod_line_event_wait(dd_line, &timeout)){
-    // Do 8 clock cycles
-    for (cnt = 8; cnt; cnt--) {
-        didWait = 1;
-        gpiod_line_set_value(dc_line, HIGH);
-        cc_delay(32);
-        gpiod_line_set_value(dc_line, LOW);
-        cc_delay(32);
-    }
-       
-   }
-   else {
-       errorFlag = CC_ERROR_NOT_WIRED;
-       inDebugMode = 0;
+   if (T->traced && cc_tracing) cc_traceEvent(CC_TRACE_WAIT, 1);
+   while (cc_lineGetDD() == HIGH) {
+     // Do 8 clock cycles
+     cc_clock(8);
+     didWait = 1;
+     // Check if we ran out if wait cycles
+     if (!--maxWaitCycles) {
+       if (T->traced && cc_tracing) cc_traceEvent(CC_TRACE_WAIT, 0);
+       T->errorFlag = CC_ERROR_NOT_WIRED;
+       T->inDebugMode = 0;
        return 0;
+     }
    }
+   if (T->traced && cc_tracing) cc_traceEvent(CC_TRACE_WAIT, 0);
  
   // Wait t(sample_wait)
   if (didWait) cc_delay(32);
@@ -355,6 +696,20 @@ uint8_t cc_switchRead(uint8_t maxWaitCycles)
   return 0;
 }
 
+/**
+ * Send clock pulses on DC without touching DD
+ */
+uint8_t cc_clock( uint8_t cycles )
+{
+  for (; cycles; cycles--) {
+    cc_lineSet(CC_LINE_DC, HIGH);
+    cc_delay(32);
+    cc_lineSet(CC_LINE_DC, LOW);
+    cc_delay(32);
+  }
+  return 0;
+}
+
 /**
  * Switch to output
  */
@@ -369,8 +724,8 @@ uint8_t cc_switchWrite()
  */
 uint8_t cc_read()
 {
-   if (!cc_active) {
-     errorFlag = CC_ERROR_NOT_ACTIVE;
+   if (!T->active) {
+     T->errorFlag = CC_ERROR_NOT_ACTIVE;
      return 0;
    }
    // =============
@@ -380,19 +735,28 @@ uint8_t cc_read()
  
    // Switch to input
    cc_setDDDirection(INPUT);
+   if (cc_rtActive) cc_rtMark();
+#ifdef CC_BOARD_RPI
+   if (T->board && !(T->traced && cc_tracing)) {
+     data = boardRead();
+     if (cc_recording && T->recorded) cc_recordIn(data);
+     return data;
+   }
+#endif
  
    // Send 8 clock pulses if we are HIGH
    for (cnt = 8; cnt; cnt--) {
-     gpiod_line_set_value(dc_line, HIGH);
+     cc_lineSet(CC_LINE_DC, HIGH);
      cc_delay(32);
      // Shift and read
      data <<= 1;
-     if (gpiod_line_get_value(dd_line) == HIGH)
+     if (cc_lineGetDD() == HIGH)
        data |= 0x01;
  
-     gpiod_line_set_value(dc_line, LOW);
+     cc_lineSet(CC_LINE_DC, LOW);
      cc_delay(32);
    }
+   if (cc_recording && T->recorded) cc_recordIn(data);
  
    // =============
    return data;
@@ -405,18 +769,30 @@ void cc_setDDDirection( uint8_t direction )
 {
 
   // Switch direction if changed
-  if (direction == ddIsOutput) return;
-  ddIsOutput = direction;
+  if (direction == T->ddIsOutput) return;
+  T->ddIsOutput = direction;
+  if (T->traced && cc_tracing) cc_traceEvent(CC_TRACE_DD_DIR, direction);
+
+  if (T->sim) {
+    ccsim_ddDirection(T->ddIsOutput);
+    return;
+  }
+#ifdef CC_BOARD_RPI
+  if (T->board) {
+    boardDDDirection(T->ddIsOutput);
+    return;
+  }
+#endif
 
   // Handle new direction
-  if (ddIsOutput) {
-    gpiod_line_set_value(dd_line, 0);
-    gpiod_line_request_output(dd_line, consumer, 0);
-    gpiod_line_set_value(dd_line, 0);
+  if (T->ddIsOutput) {
+    gpiod_line_set_value(T->dd_line, 0);
+    gpiod_line_request_output(T->dd_line, consumer, 0);
+    gpiod_line_set_value(T->dd_line, 0);
   } else {
-    gpiod_line_set_value(dd_line, 0);
-    gpiod_line_request_input(dd_line, consumer);
-    gpiod_line_set_value(dd_line, 0);
+    gpiod_line_set_value(T->dd_line, 0);
+    gpiod_line_request_input(T->dd_line, consumer);
+    gpiod_line_set_value(T->dd_line, 0);
   }
 
 }
@@ -433,23 +809,30 @@ void cc_setDDDirection( uint8_t direction )
  */
 uint8_t cc_exit()
 {
-  if (!cc_active) {
-    errorFlag = CC_ERROR_NOT_ACTIVE;
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
     return 0;
   }
-  if (!inDebugMode) {
-    errorFlag = CC_ERROR_NOT_DEBUGGING;
+  if (!T->inDebugMode) {
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
     return 0;
   }
 
   uint8_t bAns;
 
-  cc_write( instr[I_RESUME] ); // RESUME
+  if (T->attached) {
+    detach();
+    return 0;
+  }
+  giveBack();
+  clockDown();
+  cc_write( T->instr[I_RESUME] ); // RESUME
   cc_switchRead(250);
   bAns = cc_read(); // debug status
   cc_switchWrite();
 
-  inDebugMode = 0;
+  T->inDebugMode = 0;
+  T->cpuEpoch++;
 
   return 0;
 }
@@ -457,21 +840,25 @@ uint8_t cc_exit()
  * Get debug configuration
  */
 uint8_t cc_getConfig() {
-  if (!cc_active) {
-    errorFlag = CC_ERROR_NOT_ACTIVE;
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
     return 0;
   }
-  if (!inDebugMode) {
-    errorFlag = CC_ERROR_NOT_DEBUGGING;
+  if (!T->inDebugMode) {
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
     return 0;
   }
 
   uint8_t bAns;
 
-  cc_write( instr[I_RD_CONFIG] ); // RD_CONFIG
+  // only the debugger writes the configuration
+  if (T->config >= 0) return T->config;
+
+  cc_write( T->instr[I_RD_CONFIG] ); // RD_CONFIG
   cc_switchRead(250);
   bAns = cc_read(); // Config
   cc_switchWrite();
+  if (!T->errorFlag) T->config = bAns;
 
   return bAns;
 }
@@ -480,22 +867,23 @@ uint8_t cc_getConfig() {
  * Set debug configuration
  */
 uint8_t cc_setConfig( uint8_t config ) {
-  if (!cc_active) {
-    errorFlag = CC_ERROR_NOT_ACTIVE;
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
     return 0;
   }
-  if (!inDebugMode) {
-    errorFlag = CC_ERROR_NOT_DEBUGGING;
+  if (!T->inDebugMode) {
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
     return 0;
   }
 
   uint8_t bAns;
 
-  cc_write( instr[I_WR_CONFIG] ); // WR_CONFIG
+  cc_write( T->instr[I_WR_CONFIG] ); // WR_CONFIG
   cc_write( config );
   cc_switchRead(250);
   bAns = cc_read(); // Config
   cc_switchWrite();
+  T->config = T->errorFlag ? -1 : config;
 
   return bAns;
 }
@@ -505,18 +893,18 @@ uint8_t cc_setConfig( uint8_t config ) {
  */
 uint8_t cc_exec( uint8_t oc0 )
 {
-  if (!cc_active) {
-    errorFlag = CC_ERROR_NOT_ACTIVE;
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
     return 0;
   }
-  if (!inDebugMode) {
-    errorFlag = CC_ERROR_NOT_DEBUGGING;
+  if (!T->inDebugMode) {
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
     return 0;
   }
 
   uint8_t bAns;
 
-  cc_write( instr[I_DEBUG_INSTR_1] ); // DEBUG_INSTR + 1b
+  cc_write( T->instr[I_DEBUG_INSTR_1] ); // DEBUG_INSTR + 1b
   cc_write( oc0 );
   cc_switchRead(250);
   bAns = cc_read(); // Accumulator
@@ -530,18 +918,18 @@ uint8_t cc_exec( uint8_t oc0 )
  */
 uint8_t cc_exec2( uint8_t oc0, uint8_t oc1 )
 {
-  if (!cc_active) {
-    errorFlag = CC_ERROR_NOT_ACTIVE;
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
     return 0;
   }
-  if (!inDebugMode) {
-    errorFlag = CC_ERROR_NOT_DEBUGGING;
+  if (!T->inDebugMode) {
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
     return 0;
   }
 
   uint8_t bAns;
 
-  cc_write( instr[I_DEBUG_INSTR_2] ); // DEBUG_INSTR + 2b
+  cc_write( T->instr[I_DEBUG_INSTR_2] ); // DEBUG_INSTR + 2b
   cc_write( oc0 );
   cc_write( oc1 );
   cc_switchRead(250);
@@ -556,18 +944,18 @@ uint8_t cc_exec2( uint8_t oc0, uint8_t oc1 )
  */
 uint8_t cc_exec3( uint8_t oc0, uint8_t oc1, uint8_t oc2 )
 {
-  if (!cc_active) {
-    errorFlag = CC_ERROR_NOT_ACTIVE;
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
     return 0;
   }
-  if (!inDebugMode) {
-    errorFlag = CC_ERROR_NOT_DEBUGGING;
+  if (!T->inDebugMode) {
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
     return 0;
   }
 
   uint8_t bAns;
 
-  cc_write( instr[I_DEBUG_INSTR_3] ); // DEBUG_INSTR + 3b
+  cc_write( T->instr[I_DEBUG_INSTR_3] ); // DEBUG_INSTR + 3b
   cc_write( oc0 );
   cc_write( oc1 );
   cc_write( oc2 );
@@ -583,18 +971,18 @@ uint8_t cc_exec3( uint8_t oc0, uint8_t oc1, uint8_t oc2 )
  */
 uint8_t cc_execi( uint8_t oc0, unsigned short c0 )
 {
-  if (!cc_active) {
-    errorFlag = CC_ERROR_NOT_ACTIVE;
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
     return 0;
   }
-  if (!inDebugMode) {
-    errorFlag = CC_ERROR_NOT_DEBUGGING;
+  if (!T->inDebugMode) {
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
     return 0;
   }
 
   uint8_t bAns;
 
-  cc_write( instr[I_DEBUG_INSTR_3] ); // DEBUG_INSTR + 3b
+  cc_write( T->instr[I_DEBUG_INSTR_3] ); // DEBUG_INSTR + 3b
   cc_write( oc0 );
   cc_write( (c0 >> 8) & 0xFF );
   cc_write(  c0 & 0xFF );
@@ -609,20 +997,20 @@ uint8_t cc_execi( uint8_t oc0, unsigned short c0 )
  * Return chip ID
  */
 unsigned short cc_getChipID() {
-  if (!cc_active) {
-    errorFlag = CC_ERROR_NOT_ACTIVE;
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
     return 0;
   }
-  if (!inDebugMode) {
-    errorFlag = CC_ERROR_NOT_DEBUGGING;
+  if (!T->inDebugMode) {
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
     return 0;
   }
 
   unsigned short bAns;
   uint8_t bRes;
 
-  printf("send chip id\n");
-  cc_write( instr[I_GET_CHIP_ID] ); // GET_CHIP_ID
+  LOG_TRACE("send chip id");
+  cc_write( T->instr[I_GET_CHIP_ID] ); // GET_CHIP_ID
   cc_switchRead(250);
 
   bRes = cc_read(); // High order
@@ -630,7 +1018,7 @@ unsigned short cc_getChipID() {
   bRes = cc_read(); // Low order
   bAns |= bRes;
   cc_switchWrite();
-  printf("got chip id\n");
+  LOG_TRACE("got chip id");
   return bAns;
 }
 
@@ -638,19 +1026,19 @@ unsigned short cc_getChipID() {
  * Return PC
  */
 unsigned short cc_getPC() {
-  if (!cc_active) {
-    errorFlag = CC_ERROR_NOT_ACTIVE;
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
     return 0;
   }
-  if (!inDebugMode) {
-    errorFlag = CC_ERROR_NOT_DEBUGGING;
+  if (!T->inDebugMode) {
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
     return 0;
   }
 
   unsigned short bAns;
   uint8_t bRes;
 
-  cc_write( instr[I_GET_PC] ); // GET_PC
+  cc_write( T->instr[I_GET_PC] ); // GET_PC
   cc_switchRead(250);
   bRes = cc_read(); // High order
   bAns = bRes << 8;
@@ -665,18 +1053,18 @@ unsigned short cc_getPC() {
  * Return debug status
  */
 uint8_t cc_getStatus() {
-  if (!cc_active) {
-    errorFlag = CC_ERROR_NOT_ACTIVE;
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
     return 0;
   }
-  if (!inDebugMode) {
-    errorFlag = CC_ERROR_NOT_DEBUGGING;
+  if (!T->inDebugMode) {
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
     return 0;
   }
 
   uint8_t bAns;
 
-  cc_write( instr[I_READ_STATUS] ); // READ_STATUS
+  cc_write( T->instr[I_READ_STATUS] ); // READ_STATUS
   cc_switchRead(250);
   bAns = cc_read(); // debug status
   cc_switchWrite();
@@ -688,18 +1076,20 @@ uint8_t cc_getStatus() {
  * Step instruction
  */
 uint8_t cc_step() {
-  if (!cc_active) {
-    errorFlag = CC_ERROR_NOT_ACTIVE;
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
     return 0;
   }
-  if (!inDebugMode) {
-    errorFlag = CC_ERROR_NOT_DEBUGGING;
+  if (!T->inDebugMode) {
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
     return 0;
   }
 
   uint8_t bAns;
 
-  cc_write( instr[I_STEP_INSTR] ); // STEP_INSTR
+  giveBack();
+  T->cpuEpoch++;
+  cc_write( T->instr[I_STEP_INSTR] ); // STEP_INSTR
   cc_switchRead(250);
   bAns = cc_read(); // Accumulator
   cc_switchWrite();
@@ -711,18 +1101,20 @@ uint8_t cc_step() {
  * resume instruction
  */
 uint8_t cc_resume() {
-  if (!cc_active) {
-    errorFlag = CC_ERROR_NOT_ACTIVE;
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
     return 0;
   }
-  if (!inDebugMode) {
-    errorFlag = CC_ERROR_NOT_DEBUGGING;
+  if (!T->inDebugMode) {
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
     return 0;
   }
 
   uint8_t bAns;
 
-  cc_write( instr[I_RESUME] ); //RESUME
+  giveBack();
+  T->cpuEpoch++;
+  cc_write( T->instr[I_RESUME] ); //RESUME
   cc_switchRead(250);
   bAns = cc_read(); // Accumulator
   cc_switchWrite();
@@ -734,18 +1126,19 @@ uint8_t cc_resume() {
  * halt instruction
  */
 uint8_t cc_halt() {
-  if (!cc_active) {
-    errorFlag = CC_ERROR_NOT_ACTIVE;
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
     return 0;
   }
-  if (!inDebugMode) {
-    errorFlag = CC_ERROR_NOT_DEBUGGING;
+  if (!T->inDebugMode) {
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
     return 0;
   }
 
   uint8_t bAns;
 
-  cc_write( instr[I_HALT] ); //HALT
+  T->cpuEpoch++;
+  cc_write( T->instr[I_HALT] ); //HALT
   cc_switchRead(250);
   bAns = cc_read(); // Accumulator
   cc_switchWrite();
@@ -753,23 +1146,76 @@ uint8_t cc_halt() {
   return bAns;
 }
 
+/**
+ * SET_HW_BRKPNT : breakpoint number (bits 4:3), enable (bit 2),
+ * address bits 17:16, then address bits 15:8 and 7:0
+ */
+static uint8_t setHwBreak( uint8_t n, uint8_t enable, uint32_t addr )
+{
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
+    return 0;
+  }
+  if (!T->inDebugMode) {
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
+    return 0;
+  }
+
+  uint8_t bAns;
+
+  cc_write( T->instr[I_SET_HW_BRKPNT] ); // SET_HW_BRKPNT
+  cc_write( ((n & 3) << 3) | (enable ? 0x04 : 0) | ((addr >> 16) & 3) );
+  cc_write( (addr >> 8) & 0xFF );
+  cc_write( addr & 0xFF );
+  cc_switchRead(250);
+  bAns = cc_read(); // debug status
+  cc_switchWrite();
+
+  return bAns;
+}
+
+uint8_t cc_setBreakpoint( uint8_t n, uint32_t addr )
+{
+  return setHwBreak(n, 1, addr);
+}
+
+uint8_t cc_clearBreakpoint( uint8_t n )
+{
+  return setHwBreak(n, 0, 0);
+}
+
+int cc_runToBreak( unsigned timeoutMs )
+{
+  struct timespec t0, t;
+  cc_resume();
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (;;) {
+    if (cc_getStatus() & 0x20)                // CPU_HALTED
+      return 0;
+    if (T->errorFlag) return -1;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    if ((t.tv_sec - t0.tv_sec) * 1000 + (t.tv_nsec - t0.tv_nsec) / 1000000 >= timeoutMs)
+      return -1;
+  }
+}
+
 /**
  * Mass-erase all chip configuration & Lock Bits
  */
 uint8_t cc_chipErase()
 {
-  if (!cc_active) {
-    errorFlag = CC_ERROR_NOT_ACTIVE;
+  if (!T->active) {
+    T->errorFlag = CC_ERROR_NOT_ACTIVE;
     return 0;
   };
-  if (!inDebugMode) {
-    errorFlag = CC_ERROR_NOT_DEBUGGING;
+  if (!T->inDebugMode) {
+    T->errorFlag = CC_ERROR_NOT_DEBUGGING;
     return 0;
   }
 
   uint8_t bAns;
 
-  cc_write( instr[I_CHIP_ERASE] ); // CHIP_ERASE
+  cc_write( T->instr[I_CHIP_ERASE] ); // CHIP_ERASE
   cc_switchRead(250);
   bAns = cc_read(); // Debug status
   cc_switchWrite();
@@ -777,6 +1223,14 @@ uint8_t cc_chipErase()
   return bAns;
 }
 
+/**
+ * Current CPU epoch
+ */
+uint32_t cc_getEpoch()
+{
+  return T->cpuEpoch;
+}
+
 /**
  * Update the debug instruction table
  */
@@ -784,9 +1238,9 @@ uint8_t cc_updateInstructionTable( uint8_t newTable[16] )
 {
   // Copy table entries
   for (uint8_t i=0; i<16; i++)
-    instr[i] = newTable[i];
+    T->instr[i] = newTable[i];
   // Return the new version
-  return instr[INSTR_VERSION];
+  return T->instr[INSTR_VERSION];
 }
 
 /**
@@ -795,5 +1249,5 @@ uint8_t cc_updateInstructionTable( uint8_t newTable[16] )
 uint8_t cc_getInstructionTableVersion()
 {
   // Return version of instruction table
-  return instr[INSTR_VERSION];
+  return T->instr[INSTR_VERSION];
 }
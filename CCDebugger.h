@@ -2,11 +2,27 @@
 #ifndef CCDEBUGGER_H
 #define CCDEBUGGER_H
 
+#include <stdint.h>
+
 #define CC_ERROR_NONE           0
 #define CC_ERROR_NOT_ACTIVE     1
 #define CC_ERROR_NOT_DEBUGGING  2
 #define CC_ERROR_NOT_WIRED      3
 
+// Debug port lines
+#define CC_LINE_RST             0
+#define CC_LINE_DC              1
+#define CC_LINE_DD              2
+
+// Default gpiochip
+#define GPIOCHIP "gpiochip0"
+
+#if defined(CC_BOARD_RPI)
+// Pins of the board build (BCM numbers, see CCBoard.h)
+#define PIN_RST 19
+#define PIN_DC  16
+#define PIN_DD  20
+#else
 // Default pins for Rasberry Pi
 //#define PIN_RST 24
 //#define PIN_DC  27
@@ -16,15 +32,84 @@
 #define PIN_RST 98
 #define PIN_DD  99
 #define PIN_DC  100
+#endif
 
 // Alternative default pins for Rasberry Pi
 //#define PIN_RST 8
 //#define PIN_DC  0
 //#define PIN_DD 2
 
+// Default pin as a string, for help texts
+#define PIN_STR(pin)  PIN_STR_(pin)
+#define PIN_STR_(pin) #pin
+
+struct gpiod_chip;
+struct gpiod_line;
+struct ccsim;
+struct ccRegs;
+
+  /**
+   * A debugged chip : its lines and the state of its debug session.
+   * Every cc_* function works on the target selected in the calling
+   * thread (cc_select), the one of cc_init() by default.
+   */
+  struct ccTarget
+  {
+    int pinRST, pinDC, pinDD;
+    uint8_t errorFlag;
+    uint8_t ddIsOutput;
+    uint8_t inDebugMode;
+    uint8_t active;
+    uint32_t cpuEpoch;      // see cc_getEpoch()
+    uint8_t useXOSC;        // run the debug session on the 32 MHz crystal
+    uint8_t clockMHz;       // current system clock, 16 or 32
+    uint8_t savedClock;     // CLKCONCMD to restore on cc_exit(), 0 if none
+    int16_t config;         // debug configuration, -1 if unknown
+    uint8_t attached;       // session joined by cc_attach()
+    uint8_t attachConfig;   // found by cc_attach(), given back on exit
+    uint8_t attachStatus;
+    uint8_t contextRegs[5]; // A, DPS, DPL, DPH, MEMCTR of the halted program
+    uint8_t contextSaved;   // contextRegs still to give back
+    uint8_t instr[16];      // debug instruction table
+    struct gpiod_chip *chip;
+    struct gpiod_line *rst_line, *dc_line, *dd_line;
+    struct ccsim *sim;      // simulated chip in place of the lines
+    struct ccRegs *regs;    // register shadow (CCRegs.c)
+    uint8_t recorded;       // debug commands go to the CC_RECORD recording
+    uint8_t traced;         // bus transitions go to the CC_TRACE trace
+    uint8_t board;          // wired as the board of the build : CCBoard.h kernels
+  };
+
+  /**
+   * Open gpiochip <name> and claim the debug lines.
+   * The name "sim" selects the simulated target (see CCSim.h).
+   */
   int cc_init( const char *name, int pinRST, int pinDC, int pinDD );
+
+  /**
+   * Same, for one more target : returns it selected, or NULL after logging
+   */
+  struct ccTarget *cc_open( const char *name, int pinRST, int pinDC, int pinDD );
+
+  /**
+   * Target of the following cc_* calls in this thread
+   */
+  void cc_select( struct ccTarget *t );
+  struct ccTarget *cc_current();
   void cc_delay( uint8_t d );
 
+  /**
+   * Switch the target to the 32 MHz crystal oscillator on each cc_enter(),
+   * and back to its former clock on cc_exit(). Bus delays and target
+   * routine timings are rescaled to the system clock.
+   */
+  void cc_useXOSC( uint8_t on );
+
+  /**
+   * System clock of the selected target, in MHz
+   */
+  int cc_clockMHz();
+
   uint8_t cc_error();
 
   ////////////////////////////
@@ -42,6 +127,31 @@
    */
   uint8_t cc_exit();
 
+  /**
+   * Join the debug session of a chip without resetting it : the debug
+   * interface stays enabled after cc_exit() until the next reset or power
+   * cycle. A running CPU is halted, and the registers the tools use are
+   * saved. cc_exit() gives them back, with the debug configuration found,
+   * and resumes the CPU if it was running. cc_resume() gives them back too,
+   * and the program owns them from then on.
+   * Returns 0, or -1 if the chip is not in debug mode (cc_enter() needed).
+   */
+  int cc_attach();
+
+  /**
+   * Save the registers the tools use (see cc_context()) on the halted CPU,
+   * for a debugger looking at the program between two runs : cc_resume()
+   * and cc_step() give them back first. Clears DPS. Returns A.
+   */
+  uint8_t cc_saveContext();
+
+  /**
+   * The registers saved by cc_saveContext(), indexed by CC_CTX_*, or NULL.
+   * Changing them changes what the program gets back.
+   */
+  enum { CC_CTX_A, CC_CTX_DPS, CC_CTX_DPL, CC_CTX_DPH, CC_CTX_MEMCTR };
+  uint8_t *cc_context();
+
   /**
    * Execute a CPU instructuion
    */
@@ -81,7 +191,23 @@
   uint8_t cc_step();
 
   /**
-   * Get debug configuration
+   * Hardware breakpoints : <n> from 0 to CC_BREAKPOINTS-1, on the flash
+   * address <addr> (bank * 32 kB + offset in the bank, as seen in code
+   * space 0x8000-0xFFFF; 0x0000-0x7FFF is bank 0)
+   */
+  #define CC_BREAKPOINTS  4
+  uint8_t cc_setBreakpoint( uint8_t n, uint32_t addr );
+  uint8_t cc_clearBreakpoint( uint8_t n );
+
+  /**
+   * Resume the CPU and wait until a breakpoint halts it, for at most
+   * <timeoutMs>. Returns 0 once halted (PC on the breakpoint), -1 after
+   * the timeout with the CPU still running.
+   */
+  int cc_runToBreak( unsigned timeoutMs );
+
+  /**
+   * Get debug configuration (known once read or written in the session)
    */
   uint8_t cc_getConfig();
 
@@ -95,6 +221,12 @@
    */
   uint8_t cc_chipErase();
 
+  /**
+   * Changes each time the CPU may have modified its registers by itself
+   * (debug entry, step, resume, halt, exit)
+   */
+  uint32_t cc_getEpoch();
+
   ////////////////////////////
   // Low-level interaction
   ////////////////////////////
@@ -109,6 +241,11 @@
    */
   uint8_t cc_switchRead( uint8_t maxWaitCycles );
 
+  /**
+   * Send clock pulses on DC without data
+   */
+  uint8_t cc_clock( uint8_t cycles );
+
   /**
    * Switch to write mode
    */
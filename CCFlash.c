@@ -0,0 +1,534 @@
+/***********************************************************************
+  Copyright © 2019 Jean Michault.
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "CCDebugger.h"
+#include "CCFlash.h"
+#include "CCRegs.h"
+#include "CCImage.h"
+#include "CCRealtime.h"
+#include "CCLog.h"
+
+void imageInit(struct image *img)
+{
+  memset(img,0,sizeof(*img));
+  img->maxpage=-1;
+}
+
+struct page *imagePage(struct image *img,int page)
+{
+  struct page *p=img->pages[page];
+  if(p) return p;
+  // descriptor and data in one block
+  p=malloc(sizeof(struct page)+FLASH_PAGE_SIZE);
+  if(!p) { LOG_ERR("out of memory"); exit(1); }
+  p->datas=(uint8_t *)(p+1);
+  memset(p->datas,0xff,FLASH_PAGE_SIZE);
+  p->minoffset=0xffff;
+  p->maxoffset=0;
+  p->hasCrc=0;
+  img->pages[page]=p;
+  if(page>img->maxpage) img->maxpage=page;
+  return p;
+}
+
+void imageFree(struct image *img)
+{
+  for(int page=0 ; page<FLASH_PAGES ; page++)
+    free(img->pages[page]);
+  imageInit(img);
+}
+
+void read1k(int bank,uint16_t offset,uint8_t * buf)
+{
+    // select bank
+    cc_sfrUpdate(SFR_MEMCTR, 0x07, bank);
+    cc_readBlock(0x8000+offset, buf, 1024);
+}
+
+void readFlash(uint32_t addr,uint8_t *buf,int len)
+{
+  while(len>0)
+  {
+    // bank by bank through the XDATA window
+    int n=0x8000-(addr&0x7fff);
+    if(n>len) n=len;
+    cc_sfrUpdate(SFR_MEMCTR, 0x07, addr>>15);
+    cc_readBlock(0x8000+(addr&0x7fff), buf, n);
+    addr+=n; buf+=n; len-=n;
+  }
+}
+
+uint32_t flashSize()
+{
+  uint8_t info;
+  cc_readBlock(X_CHIPINFO0, &info, 1);
+  int size=(info>>4)&7;
+  return size>=1 && size<=4 ? 16384<<size : FLASH_PAGES*FLASH_PAGE_SIZE;
+}
+
+void readXDATA(uint16_t offset,uint8_t *bytes, int len)
+{
+  cc_readBlock(offset, bytes, len);
+}
+
+void writeXDATA(uint16_t offset,uint8_t *bytes, int len)
+{
+  cc_writeBlock(offset, bytes, len);
+}
+
+// primary IEEE address, in the information page
+#define INFO_IEEE  0x780C
+
+void readIEEE(uint8_t ieee[8])
+{
+  cc_readBlock(INFO_IEEE, ieee, 8);
+}
+
+void readPage(int page,struct page *p,uint8_t *buf)
+{
+  uint8_t bank=page>>4;
+  // select bank
+  cc_sfrUpdate(SFR_MEMCTR, 0x07, bank);
+  // calculer l'adresse de destination
+  uint32_t offset = ((page&0xf)<<11) + p->minoffset;
+  cc_readBlock(0x8000+offset, buf+p->minoffset, p->maxoffset-p->minoffset+1);
+}
+
+/**
+ * CRC routine, run from SRAM mapped at 0x8000 in code space (MEMCTR.XMAP).
+ * DPTR : first byte, R7:R6 : length (R6 = 0 counts 256)
+ * Below 0x1F00-0x1FFF, where SRAM is also DATA/IDATA (R7, R6, stack).
+ */
+#define CRC_STUB 0x1E00
+
+// flash controller timings (ns, CC253x datasheet), and CRC routine speed
+#define FLASH_ERASE_NS    20000000
+#define FLASH_WORD_NS     20000
+#define FLASH_POLL_NS     200000
+#define FLASH_TIMEOUT_NS  2000000000ULL
+#define CRC_BYTE_NS       700       // at 16 MHz
+#define CRC_POLL_NS       100000
+#define CRC_TIMEOUT_NS    100000000ULL
+static const uint8_t crcStub[] =
+{
+  0x75, 0xBC, 0xFF, //       MOV RNDL,#0FFh
+  0x75, 0xBC, 0xFF, //       MOV RNDL,#0FFh
+  0xE0,             // loop: MOVX A,@DPTR
+  0xF5, 0xBD,       //       MOV RNDH,A
+  0xA3,             //       INC DPTR
+  0xDE, 0xFA,       //       DJNZ R6,loop
+  0xDF, 0xF8,       //       DJNZ R7,loop
+  0xA5,             //       breakpoint
+};
+
+/**
+ * Start the CRC routine on <len> bytes of bank <bank> from <offset>.
+ * Returns the PC to come back to.
+ */
+static uint16_t crcStart(int bank,uint16_t offset,int len)
+{
+  uint16_t pc=cc_getPC();
+  cc_writeBlock(CRC_STUB, crcStub, sizeof(crcStub));
+  // SRAM in code space, flash bank in XDATA
+  cc_sfrUpdate(SFR_MEMCTR, 0x0F, 0x08|bank);
+  cc_setDPTR(0x8000+offset);
+  cc_exec2(0x7E, len&0xff);                   // MOV R6,#data
+  cc_exec2(0x7F, ((len>>8)&0xff)+((len&0xff)?1:0)); // MOV R7,#data
+  cc_execi(0x02, 0x8000+CRC_STUB);            // LJMP
+  cc_resume();
+  return pc;
+}
+
+/**
+ * CRC left by the routine, once the CPU halted on its breakpoint
+ */
+static uint16_t crcEnd(uint16_t pc)
+{
+  uint16_t crc = (cc_sfrFetch(SFR_RNDH)<<8) | cc_sfrFetch(SFR_RNDL);
+  cc_sfrUpdate(SFR_MEMCTR, 0x08, 0x00);
+  cc_execi(0x02, pc);                         // back to where the CPU was
+  return crc;
+}
+
+int flashCRC(int bank,uint16_t offset,int len,uint16_t *crc)
+{
+  uint16_t pc=crcStart(bank,offset,len);
+  int n;
+  for(n=0 ; n<1000 ; n++)
+  {
+    if(cc_getStatus() & 0x20) break;          // CPU_HALTED
+    cc_delay(200);
+  }
+  if(n==1000)
+  {
+    cc_halt();
+    LOG_WARN("CRC routine didn't stop");
+  }
+  *crc = crcEnd(pc);
+  return n==1000 ? -1 : 0;
+}
+
+uint8_t verifyByCRC=1;
+
+static __thread uint8_t verif1[2048];
+static __thread uint8_t verif2[2048];
+
+/**
+ * Read back and compare
+ */
+static int verifRead(int page,struct page *p)
+{
+  unsigned long overruns,echoes;
+  do
+  {
+    overruns=cc_rtOverruns();
+    echoes=cc_echoErrors();
+    readPage(page,p,verif1);
+    // in realtime mode, a read that met all its deadlines is trusted
+    if(cc_rtActive && cc_rtOverruns()==overruns) break;
+    // and so is a read whose every byte was echoed back the same
+    if(cc_echoCheck && cc_echoErrors()==echoes) break;
+    readPage(page,p,verif2);
+  } while (memcmp(verif1,verif2,2048));
+  for(int i=p->minoffset ; i<=p->maxoffset ;i++)
+  {
+    if(verif1[i] != p->datas[i])
+    {
+      LOG_ERR("page %d : error at 0x%x, 0x%x instead of 0x%x",page,i,verif1[i],p->datas[i]);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/////////////////////////////////////////////////////////////////////
+////                    STEPPED OPERATIONS                       ////
+/////////////////////////////////////////////////////////////////////
+
+uint64_t flash_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void flash_start(struct flashOp *op,int kind,int page,struct page *p)
+{
+  op->target=cc_current();
+  op->kind=kind;
+  op->page=page;
+  op->p=p;
+  op->state=0;
+  op->deadline=0;
+  op->result=0;
+}
+
+static int opWait(struct flashOp *op,uint64_t delay)
+{
+  op->deadline=flash_now()+delay;
+  return FLASH_WAIT;
+}
+
+static int opDone(struct flashOp *op,int result)
+{
+  op->result=result;
+  return FLASH_DONE;
+}
+
+/**
+ * Page write : upload to SRAM through DMA-0, then DMA-1 feeds the flash
+ * controller while the host waits
+ */
+static int writeStep(struct flashOp *op)
+{
+  int page=op->page;
+  struct page *p=op->p;
+  uint8_t res;
+  if(op->state==0)
+  {
+    unsigned long echoes=cc_echoErrors();
+    uint8_t bank=page>>4;
+    // select bank
+    cc_sfrUpdate(SFR_MEMCTR, 0x07, bank);
+    // calculer l'adresse de destination
+    // round minoffset because FADDR is a word address
+    p->minoffset = (p->minoffset & 0xfffffffc);
+    // round maxoffset to write entire words
+    p->maxoffset = (p->maxoffset |0x3);
+    uint32_t offset;
+
+    int len = p->maxoffset-p->minoffset+1;
+    //FIXME : sometimes incorrect length is wrote
+    //if(len&0xf && (p->minoffset+len<2032)) len= (len&0x7f0)+16;
+    // configure DMA-0 pour DEBUG --> RAM
+    // (descriptors and channel config stay in place from a page to the next :
+    //  only the changed bytes are written)
+    uint8_t dma_desc0[8];
+    dma_desc0[0] = 0x62;// src[15:8]
+    dma_desc0[1] = 0x60;// src[7:0]
+    dma_desc0[2] = 0x00;// dest[15:8]
+    dma_desc0[3] = 0x00;// dest[7:0]
+    dma_desc0[4] = (len>>8)&0xff;
+    dma_desc0[5] = (len&0xff);
+    dma_desc0[6] = 0x1f; //wordsize=0,tmode=0,trig=0x1F
+    dma_desc0[7] = 0x19;//srcinc=0,destinc=1,irqmask=1,m8=0,priority=1
+    cc_writeBlock( 0x1000, dma_desc0, 8 );
+    cc_sfrSet(SFR_DMA0CFGL, 0x00);
+    cc_sfrSet(SFR_DMA0CFGH, 0x10);
+
+    // configure DMA-1 pour RAM --> FLASH
+    uint8_t dma_desc1[8];
+    dma_desc1[0] = 0x00;// src[15:8]
+    dma_desc1[1] = 0x00;// src[7:0]
+    dma_desc1[2] = 0x62;// dest[15:8]
+    dma_desc1[3] = 0x73;// dest[7:0]
+    dma_desc1[4] = (len>>8)&0xff;
+    dma_desc1[5] = (len&0xff);
+    dma_desc1[6] = 0x12; //wordsize=0,tmode=0,trig=0x12
+    dma_desc1[7] = 0x42;//srcinc=1,destinc=0,irqmask=1,m8=0,priority=2
+    cc_writeBlock( 0x1008, dma_desc1, 8 );
+    cc_sfrSet(SFR_DMA1CFGL, 0x08);
+    cc_sfrSet(SFR_DMA1CFGH, 0x10);
+    // clear flash status
+    res = cc_xdataGet(X_FCTL) & 0x1F;
+    cc_xdataPut(X_FCTL, res);
+    // clear DMAIRQ 0 et 1
+    // (channels 2-4 are unused while the CPU is halted : their flags can't
+    //  change behind the shadow)
+    cc_sfrUpdate(SFR_DMAIRQ, 0x03, 0x00);
+    // disarm DMA Channel 0 et 1
+    cc_sfrUpdate(SFR_DMAARM, 0x03, 0x00);
+    // Upload to RAM through DMA-0
+    // arm DMA channel 0 :
+    cc_sfrUpdate(SFR_DMAARM, 0x01, 0x01);
+    cc_delay(200);
+    // transfert de données en mode burst
+    cc_write(0x80|( (len>>8)&0x7) );
+    cc_write(len&0xff);
+    for(int i=0 ; i<len ;i++)
+      cc_write(p->datas[i+p->minoffset]);
+    cc_xdataForget(0x0000, len);
+    cc_sfrForget(SFR_DMAIRQ, 0x01);
+    cc_sfrForget(SFR_DMAARM, 0x01);
+    // wait DMA end :
+    do
+    {
+      cc_delay(100);
+      res = cc_sfrFetch(SFR_DMAIRQ);
+      res &= 1;
+    } while (res==0);
+    // a finished block transfer disarms its channel
+    cc_sfrAssume(SFR_DMAARM, 0x01, 0x00);
+    // Clear DMA IRQ flag
+    cc_sfrUpdate(SFR_DMAIRQ, 0x01, 0x00);
+
+    // disarm DMA Channel 1
+    cc_sfrUpdate(SFR_DMAARM, 0x02, 0x00);
+    // écrire l'adresse de destination dans FADDRH FADDRL
+    offset = ((page&0xff)<<11) + p->minoffset;
+    uint8_t faddr[2];
+    faddr[0]=(offset>>2)&0xff;
+    faddr[1]=(offset>>10)&0xff;
+    cc_writeBlock( X_FADDRL, faddr, 2);
+    // arm DMA channel 1 :
+    cc_sfrUpdate(SFR_DMAARM, 0x02, 0x02);
+    cc_delay(200);
+    // a setup garbled on the bus would write elsewhere
+    if(cc_echoErrors()!=echoes)
+    {
+      LOG_ERR("page %d : bus errors while setting the write up",page);
+      return opDone(op,1);
+    }
+    // lancer la copie vers la FLASH
+    res = cc_xdataGet(X_FCTL);
+    cc_xdataPut(X_FCTL, res|2);
+    // the flash controller runs on its own now (FCTL, FADDR, FWDATA)
+    cc_xdataForget(X_FCTL, 4);
+    cc_sfrForget(SFR_DMAIRQ, 0x02);
+    cc_sfrForget(SFR_DMAARM, 0x02);
+    op->state=1;
+    op->timeout=flash_now()+FLASH_TIMEOUT_NS;
+    return opWait(op,(uint64_t)(len/4)*FLASH_WORD_NS);
+  }
+  // wait DMA end :
+  res = cc_sfrFetch(SFR_DMAIRQ);
+  if(!(res&2))
+  {
+    if(flash_now()<op->timeout) return opWait(op,FLASH_POLL_NS);
+    LOG_ERR("page %d : flash write doesn't end",page);
+    return opDone(op,1);
+  }
+  cc_sfrAssume(SFR_DMAARM, 0x02, 0x00);
+  // vérifie qu'il n'y a pas eu de flash abort
+  cc_readBlock(X_FCTL, &res, 1);
+  if (res&0x20)
+  {
+    LOG_ERR("page %d : flash error !!!",page);
+    return opDone(op,1);
+  }
+  return opDone(op,0);
+}
+
+static int eraseStep(struct flashOp *op)
+{
+  int page=op->page;
+  uint8_t res;
+  if(op->state==0)
+  {
+    unsigned long echoes=cc_echoErrors();
+    // FADDRH[7:1] selects the page to erase
+    uint8_t faddr[2];
+    faddr[0] = 0;
+    faddr[1] = (page<<1)&0xff;
+    cc_writeBlock( X_FADDRL, faddr, 2);
+    // and a garbled FADDR would erase another page
+    if(cc_echoErrors()!=echoes)
+    {
+      LOG_ERR("page %d : bus errors while setting the erase up",page);
+      return opDone(op,1);
+    }
+    // start erase
+    res = cc_xdataGet(X_FCTL);
+    cc_xdataPut(X_FCTL, res|1);
+    op->state=1;
+    op->timeout=flash_now()+FLASH_TIMEOUT_NS;
+    return opWait(op,FLASH_ERASE_NS);
+  }
+  // wait end of erase (FCTL.BUSY)
+  cc_readBlock(X_FCTL, &res, 1);
+  if(res&0x80)
+  {
+    if(flash_now()<op->timeout) return opWait(op,FLASH_POLL_NS);
+    LOG_ERR("page %d : erase doesn't end",page);
+    return opDone(op,1);
+  }
+  // vérifie qu'il n'y a pas eu de flash abort
+  if (res&0x20)
+  {
+    LOG_ERR("page %d : flash error !!!",page);
+    return opDone(op,1);
+  }
+  return opDone(op,0);
+}
+
+static int chipEraseStep(struct flashOp *op)
+{
+  if(op->state==0)
+  {
+    cc_chipErase();
+    op->state=1;
+    op->timeout=flash_now()+FLASH_TIMEOUT_NS;
+    return opWait(op,FLASH_ERASE_NS);
+  }
+  if(cc_getStatus() & 0x80)                   // CHIP_ERASE_BUSY
+  {
+    if(flash_now()<op->timeout) return opWait(op,FLASH_POLL_NS);
+    LOG_ERR("chip erase doesn't end");
+    return opDone(op,1);
+  }
+  return opDone(op,0);
+}
+
+/**
+ * Verify : CRC computed by the target, read back if it differs
+ */
+static int verifyStep(struct flashOp *op)
+{
+  int page=op->page;
+  struct page *p=op->p;
+  if(op->state==0 && verifyByCRC)
+  {
+    if(!p->hasCrc) image_pageCRC(p);
+    int len=p->maxoffset-p->minoffset+1;
+    op->pc=crcStart(page>>4,((page&0xf)<<11)+p->minoffset,len);
+    op->state=1;
+    op->timeout=flash_now()+CRC_TIMEOUT_NS;
+    return opWait(op,(uint64_t)len*CRC_BYTE_NS*16/cc_clockMHz());
+  }
+  if(op->state==1)
+  {
+    if(!(cc_getStatus() & 0x20))              // CPU_HALTED
+    {
+      if(flash_now()<op->timeout) return opWait(op,CRC_POLL_NS);
+      cc_halt();
+      LOG_WARN("CRC routine didn't stop");
+      crcEnd(op->pc);
+    }
+    else
+    {
+      uint16_t crc=crcEnd(op->pc);
+      if(crc==p->crc) return opDone(op,0);
+      LOG_DEBUG("page %d : CRC %04x instead of %04x, reading back",page,crc,p->crc);
+    }
+  }
+  return opDone(op,verifRead(page,p));
+}
+
+int flash_step(struct flashOp *op)
+{
+  cc_select(op->target);
+  switch(op->kind)
+  {
+    case FLASH_ERASE : return eraseStep(op);
+    case FLASH_WRITE : return writeStep(op);
+    case FLASH_VERIFY : return verifyStep(op);
+    case FLASH_CHIP_ERASE : return chipEraseStep(op);
+  }
+  return opDone(op,1);
+}
+
+int flash_run(struct flashOp *op)
+{
+  while(flash_step(op)==FLASH_WAIT)
+  {
+    uint64_t now=flash_now();
+    if(op->deadline<=now) continue;
+    struct timespec ts;
+    ts.tv_sec=(op->deadline-now)/1000000000;
+    ts.tv_nsec=(op->deadline-now)%1000000000;
+    nanosleep(&ts,NULL);
+  }
+  return op->result;
+}
+
+int verifPage(int page,struct page *p)
+{
+  struct flashOp op;
+  flash_start(&op,FLASH_VERIFY,page,p);
+  return flash_run(&op);
+}
+
+int writePage(int page,struct page *p)
+{
+  struct flashOp op;
+  flash_start(&op,FLASH_WRITE,page,p);
+  return flash_run(&op);
+}
+
+int erasePage(int page)
+{
+  struct flashOp op;
+  flash_start(&op,FLASH_ERASE,page,NULL);
+  return flash_run(&op);
+}
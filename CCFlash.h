@@ -0,0 +1,155 @@
+
+#ifndef CCFLASH_H
+#define CCFLASH_H
+
+#include <stdint.h>
+
+struct ccTarget;
+
+#define FLASH_PAGE_SIZE  2048
+#define FLASH_PAGES      128
+
+  /**
+   * A flash page of an image, with the range of bytes actually used
+   * (empty while maxoffset < minoffset)
+   */
+  struct page
+  {
+    uint32_t minoffset,maxoffset;
+    uint8_t *datas;   // FLASH_PAGE_SIZE bytes, 0xff where unused
+    uint16_t crc;     // CRC16 of the used range (see CCImage.h)
+    uint8_t hasCrc;   // crc is up to date
+  };
+
+  /**
+   * A flash image : only pages holding data are allocated
+   */
+  struct image
+  {
+    struct page *pages[FLASH_PAGES];
+    int maxpage;      // highest allocated page, -1 if none
+    uint32_t start;   // start address (record type 3 or 5), 0 if none
+  };
+
+  /**
+   * Empty image
+   */
+  void imageInit( struct image *img );
+
+  /**
+   * Page <page> of the image, allocated blank on first use
+   */
+  struct page *imagePage( struct image *img, int page );
+
+  /**
+   * Release every page of the image
+   */
+  void imageFree( struct image *img );
+
+  /**
+   * Read/write target XDATA memory through DPTR
+   */
+  void readXDATA( uint16_t offset, uint8_t *bytes, int len );
+  void writeXDATA( uint16_t offset, uint8_t *bytes, int len );
+
+  /**
+   * Read the primary IEEE address from the information page
+   * (least significant byte first)
+   */
+  void readIEEE( uint8_t ieee[8] );
+
+  /**
+   * Read 1k of flash bank <bank>, starting at <offset> in the bank
+   */
+  void read1k( int bank, uint16_t offset, uint8_t *buf );
+
+  /**
+   * Read <len> bytes of flash from physical address <addr>
+   */
+  void readFlash( uint32_t addr, uint8_t *buf, int len );
+
+  /**
+   * Flash size of the target in bytes, from CHIPINFO0
+   */
+  uint32_t flashSize();
+
+  /**
+   * Secondary IEEE address : 8 bytes before the lock bits, at the end of
+   * the last page (least significant byte first)
+   */
+  #define FLASH_IEEE_FROM_END  24
+
+  /**
+   * Read the used range of page <page> into buf (indexed by page offset)
+   */
+  void readPage( int page, struct page *p, uint8_t *buf );
+
+  /**
+   * CRC16 of <len> bytes of flash bank <bank> from <offset>, computed by
+   * the target itself (a small routine run from SRAM feeding RNDH).
+   * Returns 0, or -1 if the routine did not come back.
+   */
+  int flashCRC( int bank, uint16_t offset, int len, uint16_t *crc );
+
+  /**
+   * Check the used range of page <page> against the target, 0 if equal.
+   * Compares CRCs first, and reads the page back only if they differ
+   * (or if verifyByCRC is 0).
+   */
+  extern uint8_t verifyByCRC;
+  int verifPage( int page, struct page *p );
+
+  /**
+   * Write the used range of page <page> through DMA and the flash controller.
+   * DMA must have been enabled in the debug configuration.
+   * Returns 0, or 1 after a flash abort.
+   */
+  int writePage( int page, struct page *p );
+
+  /**
+   * Erase one flash page. Returns 0, or 1 after a flash abort.
+   */
+  int erasePage( int page );
+
+  /**
+   * The same long operations, one step at a time, so that one thread can
+   * drive several targets while their flash controllers work.
+   * flash_start() binds the operation to the selected target;
+   * flash_step() selects it, does the bus work possible right now, and
+   * returns FLASH_WAIT with a deadline, or FLASH_DONE with the result.
+   */
+  #define FLASH_ERASE   0
+  #define FLASH_WRITE   1
+  #define FLASH_VERIFY  2
+  #define FLASH_CHIP_ERASE  3     // whole flash, page ignored
+
+  #define FLASH_DONE    0
+  #define FLASH_WAIT    1
+
+  struct flashOp
+  {
+    struct ccTarget *target;
+    int kind;             // FLASH_ERASE, FLASH_WRITE, FLASH_VERIFY...
+    int page;
+    struct page *p;       // NULL to erase
+    int state;
+    uint16_t pc;          // PC to restore after the CRC routine
+    uint64_t timeout;
+    uint64_t deadline;    // FLASH_WAIT : step again from then on (flash_now())
+    int result;           // FLASH_DONE : as writePage(), erasePage(), verifPage()
+  };
+
+  void flash_start( struct flashOp *op, int kind, int page, struct page *p );
+  int flash_step( struct flashOp *op );
+
+  /**
+   * Step an operation until done, sleeping while the target works
+   */
+  int flash_run( struct flashOp *op );
+
+  /**
+   * CLOCK_MONOTONIC, in ns
+   */
+  uint64_t flash_now();
+
+#endif
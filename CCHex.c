@@ -0,0 +1,217 @@
+/***********************************************************************
+    Intel HEX loader.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "CCHex.h"
+#include "CCLog.h"
+
+/**
+ * Hex digit values, -1 for anything else
+ */
+static int8_t hexval[256];
+
+static void hex_table()
+{
+  static int done=0;
+  if(done) return;
+  memset(hexval,-1,sizeof(hexval));
+  for(int i=0 ; i<10 ; i++) hexval['0'+i]=i;
+  for(int i=0 ; i<6 ; i++) hexval['A'+i]=hexval['a'+i]=10+i;
+  done=1;
+}
+
+/**
+ * Decode one byte from 2 hex digits, -1 if not hex
+ */
+static inline int hex_byte(const char *s)
+{
+  int h=hexval[(uint8_t)s[0]], l=hexval[(uint8_t)s[1]];
+  if((h|l)<0) return -1;
+  return (h<<4)|l;
+}
+
+#define HEX_ERR(...) do { LOG_ERR("%s:%d : " __VA_ARGS__); return -1; } while(0)
+
+void hex_begin(struct hexParser *h, const char *name, struct image *img)
+{
+  memset(h,0,sizeof(*h));
+  h->name=name;
+  h->img=img;
+  h->lastPage=-1;
+  hex_table();
+}
+
+int hex_feed(struct hexParser *h, const char *text, size_t size, int last)
+{
+  const char *p=text, *end=text+size;
+  const char *name=h->name;
+  struct image *img=h->img;
+  uint32_t base=h->base;   // from record type 2 or 4
+  int line=h->line;
+  while(p<end && !h->done)
+  {
+    const char *eol=memchr(p,'\n',end-p);
+    if(!eol)
+    {
+      // partial line : wait for the rest
+      if(!last) break;
+      eol=end;
+    }
+    line++;
+    h->line=line;
+    // line length without CR and trailing blanks
+    const char *last=eol;
+    while(last>p && (last[-1]=='\r' || last[-1]==' ' || last[-1]=='\t')) last--;
+    if(last==p) { p = eol<end ? eol+1 : end; continue; }
+    if(*p != ':') HEX_ERR("':' missing",name,line);
+    if(last-p<11) HEX_ERR("incomplete line",name,line);
+    int len=hex_byte(p+1);
+    int ah=hex_byte(p+3), al=hex_byte(p+5);
+    int type=hex_byte(p+7);
+    if((len|ah|al|type)<0) HEX_ERR("incorrect record header",name,line);
+    if(last-p != 11+2*len) HEX_ERR("record length %d doesn't match line length",name,line,len);
+    uint16_t addr=(ah<<8)|al;
+    int sum=len+ah+al+type;
+    const char *d=p+9;
+
+    switch(type)
+    {
+     case 0 : // data, decoded into the pages
+      {
+        uint32_t a=base+addr;
+        if(a+len > FLASH_PAGES*FLASH_PAGE_SIZE) HEX_ERR("address 0x%x out of flash",name,line,a+len-1);
+        int i=0;
+        while(i<len)
+        {
+          if((int)(a>>11) > h->lastPage)
+          {
+            // files are written in address order : lower pages are complete
+            if(h->pageDone && h->lastPage>=0) h->pageDone(h->ctx,a>>11);
+            h->lastPage=a>>11;
+          }
+          struct page *pg=imagePage(img,a>>11);
+          uint32_t start=a&0x7ff;
+          uint32_t n=FLASH_PAGE_SIZE-start;
+          if(n>len-i) n=len-i;
+          for(uint32_t j=0 ; j<n ; j++, d+=2)
+          {
+            int b=hex_byte(d);
+            if(b<0) HEX_ERR("incorrect data",name,line);
+            pg->datas[start+j]=b;
+            sum+=b;
+          }
+          if(start < pg->minoffset) pg->minoffset=start;
+          if(start+n-1 > pg->maxoffset) pg->maxoffset=start+n-1;
+          i+=n;
+          a+=n;
+        }
+      }
+      break;
+     case 1 : // EOF
+      if(len) HEX_ERR("EOF record with data",name,line);
+      break;
+     case 2 : // extended segment address
+     case 4 : // extended linear address
+      {
+        if(len!=2) HEX_ERR("address record of length %d",name,line,len);
+        int hi=hex_byte(d), lo=hex_byte(d+2);
+        if((hi|lo)<0) HEX_ERR("incorrect extended addr",name,line);
+        sum+=hi+lo;
+        d+=4;
+        base = (type==2) ? ((hi<<8)|lo)<<4 : ((hi<<8)|lo)<<16;
+        h->base=base;
+      }
+      break;
+     case 3 : // start segment address (CS:IP)
+     case 5 : // start linear address
+      {
+        if(len!=4) HEX_ERR("start record of length %d",name,line,len);
+        uint32_t v=0;
+        for(int i=0 ; i<4 ; i++, d+=2)
+        {
+          int b=hex_byte(d);
+          if(b<0) HEX_ERR("incorrect start addr",name,line);
+          v=(v<<8)|b;
+          sum+=b;
+        }
+        img->start = (type==3) ? ((v>>16)<<4)+(v&0xffff) : v;
+      }
+      break;
+     default :
+      HEX_ERR("record type %d not implemented",name,line,type);
+    }
+    int cksum=hex_byte(d);
+    if(cksum<0) HEX_ERR("incorrect checksum",name,line);
+    if((sum+cksum)&0xff) HEX_ERR("bad checksum %02x instead of %02x",name,line,cksum,(-sum)&0xff);
+    if(type==1)
+    {
+      LOG_DEBUG("%s : %d lines read",name,line);
+      h->done=1;
+      return size;
+    }
+    p = eol<end ? eol+1 : end;
+  }
+  return h->done ? size : p-text;
+}
+
+int hex_end(struct hexParser *h)
+{
+  // a file cut short would go for a complete image
+  if(!h->done)
+  {
+    LOG_ERR("%s : EOF record missing, the file may be truncated",h->name);
+    return -1;
+  }
+  if(h->pageDone) h->pageDone(h->ctx,FLASH_PAGES);
+  return 0;
+}
+
+int hex_parse(const char *name, const char *text, size_t size, struct image *img)
+{
+  struct hexParser h;
+  hex_begin(&h,name,img);
+  if(hex_feed(&h,text,size,1)<0) return -1;
+  return hex_end(&h);
+}
+
+int hex_load(const char *path, struct image *img)
+{
+  int fd=open(path,O_RDONLY);
+  if(fd<0) { LOG_ERR("Can't open file %s.",path); return -1; }
+  struct stat st;
+  if(fstat(fd,&st)<0 || st.st_size==0)
+  {
+    close(fd);
+    LOG_ERR("%s : empty file",path);
+    return -1;
+  }
+  const char *text=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if(text==MAP_FAILED) { LOG_ERR("Can't map file %s.",path); return -1; }
+  madvise((void *)text,st.st_size,MADV_SEQUENTIAL);
+  int res=hex_parse(path,text,st.st_size,img);
+  munmap((void *)text,st.st_size);
+  return res;
+}
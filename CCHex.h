@@ -0,0 +1,51 @@
+
+#ifndef CCHEX_H
+#define CCHEX_H
+
+#include <stdint.h>
+#include "CCFlash.h"
+
+  /**
+   * Load an Intel HEX file into <img> (record types 0 to 5).
+   * The file is mapped, decoded and checksummed in a single pass,
+   * straight into the page buffers.
+   * Returns 0, or -1 after logging the file name and line of the error.
+   */
+  int hex_load( const char *path, struct image *img );
+
+  /**
+   * Same, from a buffer in memory
+   */
+  int hex_parse( const char *name, const char *text, size_t size, struct image *img );
+
+  /**
+   * Incremental parser, for input read piece by piece (pipes)
+   */
+  struct hexParser
+  {
+    const char *name;
+    struct image *img;
+    uint32_t base;      // extended address
+    int line;
+    int done;           // EOF record seen
+    int lastPage;       // highest page holding data so far
+    // called when data reach page <below> : lower pages are complete
+    // (for files in address order), and with FLASH_PAGES at the end
+    void (*pageDone)( void *ctx, int below );
+    void *ctx;
+  };
+
+  void hex_begin( struct hexParser *h, const char *name, struct image *img );
+
+  /**
+   * Parse the complete lines of text (and the partial last one if <last>).
+   * Returns the number of bytes used, or -1 after logging an error.
+   */
+  int hex_feed( struct hexParser *h, const char *text, size_t size, int last );
+
+  /**
+   * End of input : -1 after logging if the EOF record is missing
+   */
+  int hex_end( struct hexParser *h );
+
+#endif
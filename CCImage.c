@@ -0,0 +1,515 @@
+/***********************************************************************
+    Flash images : sparse image files, raw binary, CRCs.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+#include "CCImage.h"
+#include "CCHex.h"
+#include "CCLog.h"
+
+#define HEADER_SIZE  16
+#define ENTRY_SIZE   16
+
+/////////////////////////////////////////////////////////////////////
+////                            CRC                              ////
+/////////////////////////////////////////////////////////////////////
+
+static uint16_t crc16Table[256];
+static uint32_t crc32Table[256];
+
+static void crc_tables()
+{
+  static int done=0;
+  if(done) return;
+  for(int i=0 ; i<256 ; i++)
+  {
+    uint16_t c16=i<<8;
+    uint32_t c32=i;
+    for(int j=0 ; j<8 ; j++)
+    {
+      c16 = (c16&0x8000) ? (c16<<1)^0x8005 : c16<<1;
+      c32 = (c32&1) ? (c32>>1)^0xEDB88320 : c32>>1;
+    }
+    crc16Table[i]=c16;
+    crc32Table[i]=c32;
+  }
+  done=1;
+}
+
+uint16_t cc_crc16(uint16_t crc,const uint8_t *buf,int len)
+{
+  crc_tables();
+  for(int i=0 ; i<len ; i++)
+    crc = (crc<<8) ^ crc16Table[(crc>>8)^buf[i]];
+  return crc;
+}
+
+uint32_t cc_crc32(uint32_t crc,const uint8_t *buf,int len)
+{
+  crc_tables();
+  crc = ~crc;
+  for(int i=0 ; i<len ; i++)
+    crc = (crc>>8) ^ crc32Table[(crc^buf[i])&0xff];
+  return ~crc;
+}
+
+void image_pageCRC(struct page *p)
+{
+  // same rounding as writePage
+  p->minoffset &= 0xfffffffc;
+  p->maxoffset |= 0x3;
+  p->crc=cc_crc16(0xFFFF,p->datas+p->minoffset,p->maxoffset-p->minoffset+1);
+  p->hasCrc=1;
+}
+
+/////////////////////////////////////////////////////////////////////
+////                         LOADING                             ////
+/////////////////////////////////////////////////////////////////////
+
+static inline uint16_t le16(const uint8_t *b) { return b[0] | (b[1]<<8); }
+static inline uint32_t le32(const uint8_t *b) { return le16(b) | ((uint32_t)le16(b+2)<<16); }
+static inline void put16(uint8_t *b,uint16_t v) { b[0]=v; b[1]=v>>8; }
+static inline void put32(uint8_t *b,uint32_t v) { put16(b,v); put16(b+2,v>>16); }
+
+/**
+ * Map a whole file read-only, NULL after logging
+ */
+static const uint8_t *image_map(const char *path,size_t *size)
+{
+  int fd=open(path,O_RDONLY);
+  if(fd<0) { LOG_ERR("Can't open file %s.",path); return NULL; }
+  struct stat st;
+  if(fstat(fd,&st)<0 || st.st_size==0)
+  {
+    close(fd);
+    LOG_ERR("%s : empty file",path);
+    return NULL;
+  }
+  const uint8_t *map=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if(map==MAP_FAILED) { LOG_ERR("Can't map file %s.",path); return NULL; }
+  *size=st.st_size;
+  return map;
+}
+
+static int sparse_parse(const char *path,const uint8_t *map,size_t size,struct image *img)
+{
+  if(size<HEADER_SIZE || memcmp(map,CCIMG_MAGIC,4)) { LOG_ERR("%s : not a sparse image",path); return -1; }
+  if(map[4]!=CCIMG_VERSION) { LOG_ERR("%s : image version %d not supported",path,map[4]); return -1; }
+  int count=map[5];
+  if(HEADER_SIZE+count*ENTRY_SIZE > size) { LOG_ERR("%s : truncated page table",path); return -1; }
+  const uint8_t *table=map+HEADER_SIZE;
+  if(cc_crc32(0,table,count*ENTRY_SIZE) != le32(map+12)) { LOG_ERR("%s : bad page table CRC",path); return -1; }
+  img->start=le32(map+8);
+  for(int i=0 ; i<count ; i++)
+  {
+    const uint8_t *e=table+i*ENTRY_SIZE;
+    uint16_t offset=le16(e+2), len=le16(e+4);
+    uint32_t pos=le32(e+12);
+    int page=(e[0]<<4)+(offset>>11);
+    if(e[0]>7 || len==0 || (offset&0x7ff)+len > FLASH_PAGE_SIZE || pos+len > size)
+    {
+      LOG_ERR("%s : incorrect page entry %d",path,i);
+      return -1;
+    }
+    if(cc_crc32(0,map+pos,len) != le32(e+8))
+    {
+      LOG_ERR("%s : bad CRC32 for page %d",path,page);
+      return -1;
+    }
+    struct page *p=imagePage(img,page);
+    memcpy(p->datas+(offset&0x7ff),map+pos,len);
+    p->minoffset=offset&0x7ff;
+    p->maxoffset=p->minoffset+len-1;
+    p->crc=le16(e+6);
+    p->hasCrc=1;
+  }
+  return 0;
+}
+
+int image_loadSparse(const char *path,struct image *img)
+{
+  size_t size;
+  const uint8_t *map=image_map(path,&size);
+  if(!map) return -1;
+  int res=sparse_parse(path,map,size,img);
+  munmap((void *)map,size);
+  return res;
+}
+
+static int bin_parse(const char *path,const uint8_t *map,size_t size,struct image *img)
+{
+  if(size > FLASH_PAGES*FLASH_PAGE_SIZE) { LOG_ERR("%s : larger than the flash",path); return -1; }
+  image_put(img,0,map,size);
+  return 0;
+}
+
+int image_loadBin(const char *path,struct image *img)
+{
+  size_t size;
+  const uint8_t *map=image_map(path,&size);
+  if(!map) return -1;
+  int res=bin_parse(path,map,size,img);
+  munmap((void *)map,size);
+  return res;
+}
+
+int image_parse(const char *name,const uint8_t *data,size_t size,struct image *img,int format)
+{
+  if(format<0)
+  {
+    if(size>=4 && !memcmp(data,CCIMG_MAGIC,4)) format=IMAGE_SPARSE;
+    else if(size && data[0]==':') format=IMAGE_HEX;
+    // any data is a valid binary : only when asked for
+    else if(image_formatOf(name,-1)==IMAGE_BIN) format=IMAGE_BIN;
+    else { LOG_ERR("%s : neither Intel HEX nor a sparse image (raw binary : name it .bin)",name); return -1; }
+  }
+  switch(format)
+  {
+    case IMAGE_SPARSE : return sparse_parse(name,data,size,img);
+    case IMAGE_HEX : return hex_parse(name,(const char *)data,size,img);
+  }
+  return bin_parse(name,data,size,img);
+}
+
+int image_load(const char *path,struct image *img,int format)
+{
+  size_t size;
+  const uint8_t *map=image_map(path,&size);
+  if(!map) return -1;
+  int res=image_parse(path,map,size,img,format);
+  munmap((void *)map,size);
+  return res;
+}
+
+static inline int page_used(struct page *p)
+{
+  return p && p->maxoffset >= p->minoffset;
+}
+
+/////////////////////////////////////////////////////////////////////
+////                          SAVING                             ////
+/////////////////////////////////////////////////////////////////////
+
+#define OUT_BUF_SIZE  65536
+// longest HEX record : 16 data bytes
+#define HEX_LINE_MAX  (1+2*(4+16+1)+1)
+
+/**
+ * Two hex digits per byte value
+ */
+static char hexPair[256][2];
+
+static void hex_pairs()
+{
+  static const char digits[]="0123456789ABCDEF";
+  static int done=0;
+  if(done) return;
+  for(int i=0 ; i<256 ; i++)
+  {
+    hexPair[i][0]=digits[i>>4];
+    hexPair[i][1]=digits[i&0xf];
+  }
+  done=1;
+}
+
+/**
+ * Format one HEX record in dst, returns its length
+ */
+static int hex_record(char *dst,uint8_t type,uint16_t addr,const uint8_t *buf,int len)
+{
+  char *d=dst;
+  uint8_t sum=len+(addr>>8)+(addr&0xff)+type;
+  *d++=':';
+  memcpy(d,hexPair[len],2); d+=2;
+  memcpy(d,hexPair[addr>>8],2); d+=2;
+  memcpy(d,hexPair[addr&0xff],2); d+=2;
+  memcpy(d,hexPair[type],2); d+=2;
+  for(int i=0 ; i<len ; i++)
+  {
+    memcpy(d,hexPair[buf[i]],2); d+=2;
+    sum+=buf[i];
+  }
+  memcpy(d,hexPair[(uint8_t)-sum],2); d+=2;
+  *d++='\n';
+  return d-dst;
+}
+
+static int write_all(struct imageOut *out,const void *buf,size_t len)
+{
+  const char *p=buf;
+  while(len)
+  {
+    ssize_t n=write(out->fd,p,len);
+    if(n<0 && errno==EINTR) continue;
+    if(n<=0)
+    {
+      LOG_ERR("%s : write error (%s)",out->path,strerror(errno));
+      return -1;
+    }
+    p+=n;
+    len-=n;
+  }
+  return 0;
+}
+
+void image_put(struct image *img,uint32_t addr,const uint8_t *data,int len)
+{
+  while(len>0)
+  {
+    uint32_t start=addr&0x7ff;
+    int n = FLASH_PAGE_SIZE-start < len ? FLASH_PAGE_SIZE-start : len;
+    int first,last;
+    for(first=0 ; first<n && data[first]==0xff ; first++) ;
+    if(first<n)
+    {
+      for(last=n-1 ; data[last]==0xff ; last--) ;
+      struct page *p=imagePage(img,addr>>11);
+      memcpy(p->datas+start+first,data+first,last-first+1);
+      if(start+first < p->minoffset) p->minoffset=start+first;
+      if(start+last > p->maxoffset) p->maxoffset=start+last;
+      p->hasCrc=0;
+    }
+    addr+=n;
+    data+=n;
+    len-=n;
+  }
+}
+
+int image_format(const char *name)
+{
+  if(!strcmp(name,"hex")) return IMAGE_HEX;
+  if(!strcmp(name,"bin")) return IMAGE_BIN;
+  if(!strcmp(name,"sparse")) return IMAGE_SPARSE;
+  return -1;
+}
+
+int image_formatOf(const char *path,int format)
+{
+  const char *ext=strrchr(path,'.');
+  if(!ext) return format;
+  if(!strcmp(ext,".hex") || !strcmp(ext,".ihx")) return IMAGE_HEX;
+  if(!strcmp(ext,".bin")) return IMAGE_BIN;
+  if(!strcmp(ext,".ccimg")) return IMAGE_SPARSE;
+  return format;
+}
+
+int image_outOpen(struct imageOut *out,const char *path,int format)
+{
+  memset(out,0,sizeof(*out));
+  out->path=path;
+  out->format=format;
+  out->ela=-1;
+  imageInit(&out->img);
+  if(!strcmp(path,"-"))
+    out->fd=1;
+  else
+    out->fd=open(path,O_WRONLY|O_CREAT|O_TRUNC,0644);
+  if(out->fd<0)
+  {
+    LOG_ERR("Can't open file %s.",path);
+    return -1;
+  }
+  if(format==IMAGE_HEX)
+  {
+    hex_pairs();
+    out->buf=malloc(OUT_BUF_SIZE);
+    if(!out->buf) { LOG_ERR("out of memory"); return -1; }
+  }
+  return 0;
+}
+
+/**
+ * HEX lines of a block, skipping blank lines; one write() per block
+ * (per OUT_BUF_SIZE bytes of text for larger blocks)
+ */
+static int hex_block(struct imageOut *out,uint32_t addr,const uint8_t *data,int len)
+{
+  size_t pos=0;
+  while(len>0)
+  {
+    int n = 16-(addr&15) < len ? 16-(addr&15) : len;
+    int i;
+    for(i=0 ; i<n && data[i]==0xff ; i++) ;
+    if(i<n)
+    {
+      if(pos > OUT_BUF_SIZE-2*HEX_LINE_MAX)
+      {
+        if(write_all(out,out->buf,pos)) return -1;
+        pos=0;
+      }
+      if((int)(addr>>16) != out->ela)
+      {
+        // extended linear address, every 64 kB
+        out->ela=addr>>16;
+        uint8_t b[2]={ out->ela>>8, out->ela&0xff };
+        pos+=hex_record(out->buf+pos,4,0,b,2);
+      }
+      pos+=hex_record(out->buf+pos,0,addr&0xffff,data,n);
+    }
+    addr+=n;
+    data+=n;
+    len-=n;
+  }
+  return write_all(out,out->buf,pos);
+}
+
+int image_outBlock(struct imageOut *out,uint32_t addr,const uint8_t *data,int len)
+{
+  switch(out->format)
+  {
+   case IMAGE_HEX :
+    return hex_block(out,addr,data,len);
+   case IMAGE_BIN :
+    {
+      if(addr < out->pos) { LOG_ERR("%s : binary output must be sequential",out->path); return -1; }
+      // gap : erased flash
+      uint8_t blank[1024];
+      memset(blank,0xff,sizeof(blank));
+      while(out->pos < addr)
+      {
+        uint32_t n = addr-out->pos < sizeof(blank) ? addr-out->pos : sizeof(blank);
+        if(write_all(out,blank,n)) return -1;
+        out->pos+=n;
+      }
+      out->pos+=len;
+      return write_all(out,data,len);
+    }
+   case IMAGE_SPARSE :
+    image_put(&out->img,addr,data,len);
+    return 0;
+  }
+  return -1;
+}
+
+static int sparse_write(struct imageOut *out,struct image *img)
+{
+  uint8_t table[FLASH_PAGES*ENTRY_SIZE];
+  uint8_t header[HEADER_SIZE];
+  int count=0;
+  uint32_t pos=HEADER_SIZE;
+  for(int page=0 ; page<=img->maxpage ; page++)
+    if(page_used(img->pages[page])) pos+=ENTRY_SIZE;
+  for(int page=0 ; page<=img->maxpage ; page++)
+  {
+    struct page *p=img->pages[page];
+    if(!page_used(p)) continue;
+    image_pageCRC(p);
+    uint32_t len=p->maxoffset-p->minoffset+1;
+    uint8_t *e=table+count*ENTRY_SIZE;
+    memset(e,0,ENTRY_SIZE);
+    e[0]=page>>4;
+    put16(e+2,((page&0xf)<<11)+p->minoffset);
+    put16(e+4,len);
+    put16(e+6,p->crc);
+    put32(e+8,cc_crc32(0,p->datas+p->minoffset,len));
+    put32(e+12,pos);
+    pos+=len;
+    count++;
+  }
+  memcpy(header,CCIMG_MAGIC,4);
+  header[4]=CCIMG_VERSION;
+  header[5]=count;
+  put16(header+6,0);
+  put32(header+8,img->start);
+  put32(header+12,cc_crc32(0,table,count*ENTRY_SIZE));
+
+  if(write_all(out,header,HEADER_SIZE)) return -1;
+  if(write_all(out,table,count*ENTRY_SIZE)) return -1;
+  for(int page=0 ; page<=img->maxpage ; page++)
+  {
+    struct page *p=img->pages[page];
+    if(!page_used(p)) continue;
+    if(write_all(out,p->datas+p->minoffset,p->maxoffset-p->minoffset+1)) return -1;
+  }
+  return 0;
+}
+
+/**
+ * Trailer of the output : HEX start and EOF records, or the whole sparse image
+ */
+static int out_end(struct imageOut *out)
+{
+  if(out->format==IMAGE_HEX)
+  {
+    size_t pos=0;
+    if(out->img.start)
+    {
+      uint32_t st=out->img.start;
+      uint8_t b[4]={ st>>24, st>>16, st>>8, st };
+      pos+=hex_record(out->buf,5,0,b,4);
+    }
+    pos+=hex_record(out->buf+pos,1,0,NULL,0);
+    return write_all(out,out->buf,pos);
+  }
+  if(out->format==IMAGE_SPARSE)
+    return sparse_write(out,&out->img);
+  return 0;
+}
+
+static int out_release(struct imageOut *out)
+{
+  int res=0;
+  if(out->fd>1 && close(out->fd))
+  {
+    LOG_ERR("%s : write error (%s)",out->path,strerror(errno));
+    res=-1;
+  }
+  free(out->buf);
+  imageFree(&out->img);
+  return res;
+}
+
+int image_outClose(struct imageOut *out)
+{
+  int res=out_end(out);
+  if(out_release(out)) res=-1;
+  return res;
+}
+
+int image_save(const char *path,struct image *img,int format)
+{
+  struct imageOut out;
+  if(image_outOpen(&out,path,format)) return -1;
+  int res=0;
+  if(format==IMAGE_SPARSE)
+    res=sparse_write(&out,img);
+  else
+  {
+    for(int page=0 ; page<=img->maxpage && !res ; page++)
+    {
+      struct page *p=img->pages[page];
+      if(!p) continue;
+      if(format==IMAGE_BIN)
+        res=image_outBlock(&out,page<<11,p->datas,FLASH_PAGE_SIZE);
+      else if(page_used(p))
+        res=image_outBlock(&out,(page<<11)+p->minoffset,p->datas+p->minoffset,p->maxoffset-p->minoffset+1);
+    }
+    out.img.start=img->start;
+    if(!res) res=out_end(&out);
+  }
+  if(out_release(&out)) res=-1;
+  return res;
+}
@@ -0,0 +1,108 @@
+
+#ifndef CCIMAGE_H
+#define CCIMAGE_H
+
+#include <stdint.h>
+#include "CCFlash.h"
+
+/*
+ * Sparse image file (.ccimg), all fields little endian :
+ *
+ *  header, 16 bytes
+ *    0  "CCIM"
+ *    4  u8  version (1)
+ *    5  u8  number of page entries
+ *    6  u16 0
+ *    8  u32 start address
+ *   12  u32 CRC32 of the page table
+ *  page table, 16 bytes per non-blank page, in flash order
+ *    0  u8  bank
+ *    1  u8  0
+ *    2  u16 offset in the bank of the first byte (multiple of 4)
+ *    4  u16 length (multiple of 4)
+ *    6  u16 CRC16 of the data, as computed by the target (see flashCRC)
+ *    8  u32 CRC32 of the data
+ *   12  u32 file offset of the data (multiple of 4)
+ *
+ * The table is at a fixed place and data are aligned, so the file can be
+ * used mapped in memory.
+ */
+
+#define CCIMG_MAGIC    "CCIM"
+#define CCIMG_VERSION  1
+
+  /**
+   * CRC16 fed byte by byte like the CC253x RNDH register
+   * (x16+x15+x2+1, MSB first); start with 0xFFFF
+   */
+  uint16_t cc_crc16( uint16_t crc, const uint8_t *buf, int len );
+
+  /**
+   * CRC32 (IEEE 802.3, as zlib); start with 0
+   */
+  uint32_t cc_crc32( uint32_t crc, const uint8_t *buf, int len );
+
+  /**
+   * Round the used range of a page to flash words and compute its CRC16
+   */
+  void image_pageCRC( struct page *p );
+
+  /**
+   * Load an image file in <format>, or with -1 : sparse image or Intel HEX
+   * told apart by their first bytes, raw binary only when named .bin
+   * (anything else is refused). Returns 0, or -1 after logging.
+   */
+  int image_load( const char *path, struct image *img, int format );
+  int image_parse( const char *name, const uint8_t *data, size_t size, struct image *img, int format );
+  int image_loadSparse( const char *path, struct image *img );
+  int image_loadBin( const char *path, struct image *img );
+
+  /**
+   * Store data in an image, leaving out blank (0xff) pages and page ends
+   */
+  void image_put( struct image *img, uint32_t addr, const uint8_t *data, int len );
+
+  /**
+   * Output formats
+   */
+  #define IMAGE_HEX     0
+  #define IMAGE_BIN     1
+  #define IMAGE_SPARSE  2
+
+  /**
+   * Format from its name (hex, bin, sparse), -1 if unknown
+   */
+  int image_format( const char *name );
+
+  /**
+   * Format from a file extension (.hex .ihx .bin .ccimg), else <format>
+   */
+  int image_formatOf( const char *path, int format );
+
+  /**
+   * Save an image. Returns 0, or -1 after logging.
+   */
+  int image_save( const char *path, struct image *img, int format );
+
+  /**
+   * Output stream, fed block by block in address order ("-" : stdout).
+   * HEX text is formatted in a buffer and written with one write() per
+   * block, binary goes straight out, sparse images are written on close.
+   * Blank (0xff) lines and pages are left out of HEX and sparse outputs.
+   */
+  struct imageOut
+  {
+    int fd;
+    int format;
+    const char *path;
+    int ela;            // 64 kB segment of the last HEX record
+    uint32_t pos;       // bytes of binary output
+    char *buf;          // HEX text
+    struct image img;   // pages of a sparse output
+  };
+
+  int image_outOpen( struct imageOut *out, const char *path, int format );
+  int image_outBlock( struct imageOut *out, uint32_t addr, const uint8_t *data, int len );
+  int image_outClose( struct imageOut *out );
+
+#endif
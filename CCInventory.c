@@ -0,0 +1,54 @@
+/***********************************************************************
+    Fleet inventory files.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "CCInventory.h"
+#include "CCLog.h"
+
+int inv_load(const char *path,struct inventory *inv)
+{
+  memset(inv,0,sizeof(*inv));
+  FILE *f=fopen(path,"r");
+  if(!f) { LOG_ERR("Can't open file %s.",path); return -1; }
+  char line[256];
+  int n=0;
+  while(fgets(line,sizeof(line),f))
+  {
+    n++;
+    line[strcspn(line,"#\n")]=0;
+    struct invTarget *t=&inv->targets[inv->nbTargets];
+    int fields=sscanf(line,"%31s %31s %31s %d %d %d",t->station,t->name,t->chip,&t->rst,&t->dc,&t->dd);
+    if(fields<=0) continue;
+    if(fields!=6) { LOG_ERR("%s:%d : station name gpiochip pin_reset pin_DC pin_DD expected.",path,n); fclose(f); return -1; }
+    if(inv->nbTargets==INV_MAX_TARGETS) { LOG_ERR("%s : more than %d targets.",path,INV_MAX_TARGETS); fclose(f); return -1; }
+    // station of a previous target, or a new one
+    int s;
+    for(s=0 ; s<inv->nbTargets ; s++)
+      if(!strcmp(inv->targets[s].station,t->station)) break;
+    if(s<inv->nbTargets)
+      t->stationIndex=inv->targets[s].stationIndex;
+    else if(inv->nbStations==INV_MAX_STATIONS) { LOG_ERR("%s : more than %d stations.",path,INV_MAX_STATIONS); fclose(f); return -1; }
+    else
+      t->stationIndex=inv->nbStations++;
+    inv->nbTargets++;
+  }
+  fclose(f);
+  if(!inv->nbTargets) { LOG_ERR("%s : no target.",path); return -1; }
+  return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef CCINVENTORY_H
+#define CCINVENTORY_H
+
+/*
+ * Targets of a fleet (cc_fleet, cc_inventory), one per line :
+ *   station name gpiochip pin_reset pin_DC pin_DD
+ * '#' starts a comment, gpiochip "sim" gives a simulated dongle.
+ * The tools give each station a thread of its own.
+ */
+
+#define INV_MAX_TARGETS   64
+#define INV_MAX_STATIONS  16
+
+  struct invTarget
+  {
+    char station[32];
+    char name[32];
+    char chip[32];
+    int rst,dc,dd;
+    int stationIndex;       // stations numbered in order of appearance
+  };
+
+  struct inventory
+  {
+    struct invTarget targets[INV_MAX_TARGETS];
+    int nbTargets;
+    int nbStations;
+  };
+
+  /**
+   * Load an inventory file, numbering its stations.
+   * Returns 0, or -1 after logging (syntax, no target, too many targets
+   * or stations).
+   */
+  int inv_load( const char *path, struct inventory *inv );
+
+#endif
@@ -0,0 +1,144 @@
+/***********************************************************************
+    Leveled logging with a buffered sink.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "CCLog.h"
+
+#define LOG_BUFFER  16384
+
+uint8_t cc_logLevel=CC_LOG_WARN;
+
+static char logBuffer[LOG_BUFFER];
+static int logLen;
+static int registered;
+// the pipelined tools log from two threads
+static pthread_mutex_t logLock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *levelNames[] = { "error", "warn", "info", "debug", "trace" };
+
+static uint64_t log_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void log_register()
+{
+  if (registered) return;
+  registered = 1;
+  atexit(cc_logFlush);
+}
+
+void cc_logInit()
+{
+  static int initialized;
+  if (initialized) return;
+  initialized = 1;
+
+  const char *env = getenv("CC_LOG");
+  log_register();
+  if (!env || !*env) return;
+  for (int i = 0; i <= CC_LOG_TRACE; i++)
+    if (!strcasecmp(env, levelNames[i])) {
+      cc_logLevel = i;
+      return;
+    }
+  if (env[0] >= '0' && env[0] <= '4')
+    cc_logLevel = env[0] - '0';
+}
+
+void cc_logVerbosity( int delta )
+{
+  int level = cc_logLevel + delta;
+  if (level < CC_LOG_ERROR) level = CC_LOG_ERROR;
+  if (level > CC_LOG_TRACE) level = CC_LOG_TRACE;
+  cc_logLevel = level;
+}
+
+static void log_flush()
+{
+  int done = 0;
+  while (done < logLen) {
+    ssize_t n = write(STDERR_FILENO, logBuffer + done, logLen - done);
+    if (n <= 0) break;
+    done += n;
+  }
+  logLen = 0;
+}
+
+void cc_logFlush()
+{
+  pthread_mutex_lock(&logLock);
+  log_flush();
+  pthread_mutex_unlock(&logLock);
+}
+
+void cc_logWrite( uint8_t level, const char *fmt, ... )
+{
+  char line[512];
+  va_list ap;
+  int n;
+
+  log_register();
+  n = snprintf(line, sizeof(line), "%s: ", levelNames[level]);
+  va_start(ap, fmt);
+  n += vsnprintf(line + n, sizeof(line) - n, fmt, ap);
+  va_end(ap);
+  if (n >= (int)sizeof(line) - 1) n = sizeof(line) - 2;
+  if (line[n-1] != '\n') line[n++] = '\n';
+
+  pthread_mutex_lock(&logLock);
+  if (logLen + n > LOG_BUFFER)
+    log_flush();
+  memcpy(logBuffer + logLen, line, n);
+  logLen += n;
+  // errors and warnings must not wait for the next flush
+  if (level <= CC_LOG_WARN)
+    log_flush();
+  pthread_mutex_unlock(&logLock);
+}
+
+void cc_progress( long done, long total, const char *what )
+{
+  static int tty = -1;
+  static uint64_t last;
+
+  if (cc_logLevel < CC_LOG_WARN) return;
+  if (tty < 0) tty = isatty(STDERR_FILENO);
+
+  uint64_t now = log_now();
+  if (done < total && now - last < (tty ? 200 : 5000)) return;
+  last = now;
+
+  char line[128];
+  int n = snprintf(line, sizeof(line), tty ? "\r  %s %ld/%ld" : "  %s %ld/%ld\n", what, done, total);
+  if (tty && done >= total && n < (int)sizeof(line) - 1) line[n++] = '\n';
+  pthread_mutex_lock(&logLock);
+  log_flush();
+  if (write(STDERR_FILENO, line, n) < 0) n = 0;
+  pthread_mutex_unlock(&logLock);
+}
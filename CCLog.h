@@ -0,0 +1,64 @@
+
+#ifndef CCLOG_H
+#define CCLOG_H
+
+#include <stdint.h>
+
+#define CC_LOG_ERROR  0
+#define CC_LOG_WARN   1
+#define CC_LOG_INFO   2
+#define CC_LOG_DEBUG  3
+#define CC_LOG_TRACE  4
+
+// Messages above CC_LOG_MAX are compiled out (make CFLAGS=-DCC_LOG_MAX=1)
+#ifndef CC_LOG_MAX
+#define CC_LOG_MAX    CC_LOG_TRACE
+#endif
+
+  /**
+   * Runtime level, CC_LOG_WARN by default.
+   * cc_logInit() takes it from the CC_LOG environment variable.
+   */
+  extern uint8_t cc_logLevel;
+
+#define cc_log(level, ...) \
+  do { \
+    if ((level) <= CC_LOG_MAX && (level) <= cc_logLevel) \
+      cc_logWrite((level), __VA_ARGS__); \
+  } while (0)
+
+#define LOG_ERR(...)   cc_log(CC_LOG_ERROR, __VA_ARGS__)
+#define LOG_WARN(...)  cc_log(CC_LOG_WARN, __VA_ARGS__)
+#define LOG_INFO(...)  cc_log(CC_LOG_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) cc_log(CC_LOG_DEBUG, __VA_ARGS__)
+#define LOG_TRACE(...) cc_log(CC_LOG_TRACE, __VA_ARGS__)
+
+  /**
+   * Read CC_LOG (error, warn, info, debug, trace or 0-4), once.
+   * Tools call it before parsing -v/-q, cc_init() calls it otherwise.
+   */
+  void cc_logInit();
+
+  /**
+   * Change the level by <delta> : -v and -q of the tools
+   */
+  void cc_logVerbosity( int delta );
+
+  /**
+   * Format a message into the log buffer, flushed when full, on errors and at exit
+   */
+  void cc_logWrite( uint8_t level, const char *fmt, ... ) __attribute__((format(printf, 2, 3)));
+
+  /**
+   * Write the log buffer to stderr
+   */
+  void cc_logFlush();
+
+  /**
+   * Rate limited progress : at most every 200 ms on a terminal,
+   * every 5 s otherwise, and always when done == total.
+   * Shown unless the level is below CC_LOG_WARN (-q).
+   */
+  void cc_progress( long done, long total, const char *what );
+
+#endif
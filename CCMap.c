@@ -0,0 +1,145 @@
+/***********************************************************************
+    Firmware symbols from linker map files.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "CCMap.h"
+#include "CCFlash.h"
+#include "CCLog.h"
+
+#define CODE_SIZE  (FLASH_PAGES*FLASH_PAGE_SIZE)
+
+/**
+ * Address token : 0x1234, 1234H, or hex digits holding a decimal digit
+ */
+static int parseAddr( const char *s, uint32_t *addr )
+{
+  const char *p = s;
+  int digit = 0;
+  if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) { p += 2; digit = 1; }
+  const char *start = p;
+  while (isxdigit((unsigned char)*p)) { if (isdigit((unsigned char)*p)) digit = 1; p++; }
+  int len = p - start;
+  if ((*p == 'h' || *p == 'H') && !p[1]) p++;
+  if (*p || !digit || len < 4 || len > 8) return 0;
+  uint32_t v = strtoul(start, NULL, 16);
+  *addr = v > 0xFFFF ? map_physAddr(v >> 16, v & 0xFFFF) : v;
+  return *addr < CODE_SIZE;
+}
+
+static int isIdent( const char *s )
+{
+  if (!isalpha((unsigned char)*s) && *s != '_' && *s != '?') return 0;
+  for (s++; *s; s++)
+    if (!isalnum((unsigned char)*s) && *s != '_' && *s != '?' && *s != '.' && *s != '$') return 0;
+  return 1;
+}
+
+static int symCompare( const void *a, const void *b )
+{
+  const struct mapSymbol *sa = a, *sb = b;
+  if (sa->addr != sb->addr) return sa->addr < sb->addr ? -1 : 1;
+  return 0;
+}
+
+int map_load( const char *path, struct symbolMap *m )
+{
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    LOG_ERR("%s : %s", path, strerror(errno));
+    return -1;
+  }
+  char line[1024];
+  int max = 0;
+  m->syms = NULL;
+  m->count = 0;
+  while (fgets(line, sizeof(line), f)) {
+    char *name = NULL, *save;
+    uint32_t addr = 0;
+    int hasAddr = 0;
+    for (char *tok = strtok_r(line, " \t\r\n", &save); tok; tok = strtok_r(NULL, " \t\r\n", &save)) {
+      uint32_t a;
+      if (!hasAddr && parseAddr(tok, &a)) { addr = a; hasAddr = 1; }
+      else if (!name && isIdent(tok) && strlen(tok) > 1) name = tok;
+      if (name && hasAddr) break;
+    }
+    if (!name || !hasAddr) continue;
+    if (m->count == max) {
+      max = max ? 2*max : 1024;
+      struct mapSymbol *syms = realloc(m->syms, max * sizeof(*syms));
+      if (!syms) {
+        LOG_ERR("out of memory");
+        fclose(f);
+        map_free(m);
+        return -1;
+      }
+      m->syms = syms;
+    }
+    m->syms[m->count].addr = addr;
+    m->syms[m->count].name = strdup(name);
+    m->count++;
+  }
+  fclose(f);
+  qsort(m->syms, m->count, sizeof(*m->syms), symCompare);
+  // first name of each address
+  int n = 0;
+  for (int i = 0; i < m->count; i++)
+    if (!n || m->syms[i].addr != m->syms[n-1].addr) m->syms[n++] = m->syms[i];
+    else free(m->syms[i].name);
+  m->count = n;
+  LOG_INFO("%d symbols in %s.", m->count, path);
+  return 0;
+}
+
+int map_find( const struct symbolMap *m, uint32_t addr )
+{
+  int lo = 0, hi = m->count - 1, found = -1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (m->syms[mid].addr <= addr) { found = mid; lo = mid + 1; }
+    else hi = mid - 1;
+  }
+  return found;
+}
+
+int map_lookup( const struct symbolMap *m, const char *name, uint32_t *addr )
+{
+  for (int i = 0; i < m->count; i++)
+    if (!strcmp(m->syms[i].name, name)) {
+      *addr = m->syms[i].addr;
+      return 0;
+    }
+  // a number : 0x prefix not required here
+  char *end;
+  unsigned long v = strtoul(name, &end, 16);
+  if (!*name || *end) return -1;
+  *addr = v > 0xFFFF ? map_physAddr(v >> 16, v & 0xFFFF) : v;
+  return *addr < CODE_SIZE ? 0 : -1;
+}
+
+void map_free( struct symbolMap *m )
+{
+  for (int i = 0; i < m->count; i++) free(m->syms[i].name);
+  free(m->syms);
+  m->syms = NULL;
+  m->count = 0;
+}
@@ -0,0 +1,56 @@
+
+#ifndef CCMAP_H
+#define CCMAP_H
+
+#include <stdint.h>
+
+/*
+ * Symbols of a firmware, from a linker map file. Addresses are physical
+ * flash addresses : code space 0x0000-0x7FFF is bank 0, 0x8000-0xFFFF
+ * the bank selected by FMAP.
+ */
+
+  struct mapSymbol
+  {
+    uint32_t addr;
+    char *name;
+  };
+
+  struct symbolMap
+  {
+    struct mapSymbol *syms;   // sorted by address, one per address
+    int count;
+  };
+
+  /**
+   * Flash address of code address <pc> with FMAP = <bank>
+   */
+  static inline uint32_t map_physAddr( uint8_t bank, uint16_t pc )
+  {
+    if (pc < 0x8000) return pc;
+    return ((bank & 7) << 15) + (pc - 0x8000);
+  }
+
+  /**
+   * Load the lines holding a symbol name and its address, in either
+   * order (nm output, SDCC and IAR map files); other lines are skipped.
+   * 16 bits addresses are code addresses of the common area or bank 1
+   * (the default FMAP), larger ones bank<<16 | code address.
+   * Returns 0, or -1 after logging.
+   */
+  int map_load( const char *path, struct symbolMap *m );
+
+  /**
+   * Symbol holding <addr> : the last one at or below it, -1 if none
+   */
+  int map_find( const struct symbolMap *m, uint32_t addr );
+
+  /**
+   * Address of a symbol given by name, or by address (0x1234, bank<<16 |
+   * address). Returns 0, or -1 if unknown.
+   */
+  int map_lookup( const struct symbolMap *m, const char *name, uint32_t *addr );
+
+  void map_free( struct symbolMap *m );
+
+#endif
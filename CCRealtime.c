@@ -0,0 +1,145 @@
+/***********************************************************************
+    Real-time execution mode for bit-banging.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+#include "CCRealtime.h"
+#include "CCLog.h"
+
+#define RT_PRIORITY    80
+#define STACK_PREFAULT (256*1024)
+
+uint8_t cc_rtActive=0;
+
+static unsigned long overruns;
+static uint64_t lastDelay;
+static int rtCpu = -1;
+
+static inline uint64_t rt_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * First cpu listed in /sys/devices/system/cpu/isolated, else the last cpu
+ */
+static int rt_defaultCpu()
+{
+  int cpu = -1;
+  FILE *f = fopen("/sys/devices/system/cpu/isolated", "r");
+  if (f) {
+    if (fscanf(f, "%d", &cpu) != 1) cpu = -1;
+    fclose(f);
+  }
+  if (cpu < 0)
+    cpu = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  return cpu < 0 ? 0 : cpu;
+}
+
+static void rt_prefaultStack()
+{
+  volatile uint8_t stack[STACK_PREFAULT];
+  memset((void *)stack, 0, sizeof(stack));
+}
+
+int cc_realtime( int cpu )
+{
+  int ret = 0;
+
+  // lock current and future pages : static buffers get faulted in here
+  if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+    LOG_WARN("mlockall : %s", strerror(errno));
+    ret = -1;
+  }
+  rt_prefaultStack();
+
+  if (cpu < 0) cpu = rt_defaultCpu();
+  rtCpu = cpu;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set)) {
+    LOG_WARN("sched_setaffinity : %s", strerror(errno));
+    ret = -1;
+  }
+
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = RT_PRIORITY;
+  if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+    LOG_WARN("sched_setscheduler : %s", strerror(errno));
+    ret = -1;
+  }
+
+  LOG_INFO("realtime : cpu %d, SCHED_FIFO %d%s", cpu, RT_PRIORITY, ret ? " (partial)" : "");
+  overruns = 0;
+  lastDelay = 0;
+  cc_rtActive = 1;
+  return ret;
+}
+
+void cc_rtWorker()
+{
+  if (!cc_rtActive) return;
+  // threads inherit SCHED_FIFO and the bus cpu : give both back
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  if (pthread_setschedparam(pthread_self(), SCHED_OTHER, &param))
+    LOG_WARN("pthread_setschedparam : %s", strerror(errno));
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  if (ncpu < 2) return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu = 0; cpu < ncpu; cpu++)
+    if (cpu != rtCpu) CPU_SET(cpu, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+    LOG_WARN("pthread_setaffinity_np : %s", strerror(errno));
+}
+
+void cc_rtDelay( uint8_t ns )
+{
+  uint64_t start = rt_now();
+  // the previous half period lasted too long : we were preempted
+  if (lastDelay && start - lastDelay > CC_RT_DEADLINE_NS)
+    overruns++;
+  uint64_t t = start;
+  while (t - start < ns)
+    t = rt_now();
+  lastDelay = t;
+}
+
+void cc_rtMark()
+{
+  lastDelay = 0;
+}
+
+unsigned long cc_rtOverruns()
+{
+  return overruns;
+}
@@ -0,0 +1,43 @@
+
+#ifndef CCREALTIME_H
+#define CCREALTIME_H
+
+#include <stdint.h>
+
+// Longest acceptable gap between two half clock periods of a byte
+#define CC_RT_DEADLINE_NS  100000
+
+  /**
+   * Non zero once cc_realtime() succeeded
+   */
+  extern uint8_t cc_rtActive;
+
+  /**
+   * Lock memory, pin the calling thread on <cpu> (first isolated cpu,
+   * else the last one when cpu<0) and switch it to SCHED_FIFO.
+   * Returns 0 on success, -1 if a step failed (the others still apply).
+   */
+  int cc_realtime( int cpu );
+
+  /**
+   * Called first by helper threads : back to SCHED_OTHER, on every cpu
+   * but the bus one (does nothing when not in realtime mode)
+   */
+  void cc_rtWorker();
+
+  /**
+   * Busy-wait delay used by cc_delay() in realtime mode
+   */
+  void cc_rtDelay( uint8_t ns );
+
+  /**
+   * Start of a byte transfer : the next delay is not checked against the previous one
+   */
+  void cc_rtMark();
+
+  /**
+   * Number of half clock periods that missed their deadline
+   */
+  unsigned long cc_rtOverruns();
+
+#endif
@@ -0,0 +1,201 @@
+/***********************************************************************
+    Recording of the debug commands.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+/*
+ * File : "ccrec 1\n", then one record per command :
+ *   kind (1 byte), start since the previous record (ns), bus time (ns),
+ *   bytes out count, bytes out, bytes in count, bytes in
+ * numbers as LEB128 varints. A command is kept in memory until the next
+ * one starts, so recording adds a clock_gettime() per byte.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "CCRecord.h"
+#include "CCLog.h"
+
+#define RECORD_MAGIC   "ccrec 1\n"
+
+uint8_t cc_recording=0;
+
+static FILE *recordFile;
+static struct ccRecord cur;
+static uint8_t pending;           // cur holds a command not written yet
+static uint64_t t0, lastStart;
+static uint64_t readT;            // start of the last record read
+
+static uint64_t record_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void putVarint( uint64_t v )
+{
+  do {
+    uint8_t b = v & 0x7f;
+    v >>= 7;
+    fputc(v ? b | 0x80 : b, recordFile);
+  } while (v);
+}
+
+static int getVarint( FILE *f, uint64_t *v )
+{
+  *v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = fgetc(f);
+    if (c == EOF) return -1;
+    *v |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80)) return 0;
+  }
+  return -1;
+}
+
+static void record_flush()
+{
+  if (!pending) return;
+  pending = 0;
+  fputc(cur.kind, recordFile);
+  putVarint(cur.t - lastStart);
+  lastStart = cur.t;
+  putVarint(cur.busNs);
+  putVarint(cur.nOut);
+  fwrite(cur.out, 1, cur.nOut, recordFile);
+  putVarint(cur.nIn);
+  fwrite(cur.in, 1, cur.nIn, recordFile);
+}
+
+int cc_recordOpen( const char *path )
+{
+  if (cc_recording) cc_recordClose();
+
+  recordFile = fopen(path, "wb");
+  if (!recordFile) {
+    LOG_ERR("can't open recording %s", path);
+    return -1;
+  }
+  setvbuf(recordFile, NULL, _IOFBF, 1 << 16);
+  fputs(RECORD_MAGIC, recordFile);
+  t0 = record_now();
+  lastStart = 0;
+  pending = 0;
+
+  static int registered;
+  if (!registered) {
+    // tools may leave through exit() on errors
+    atexit(cc_recordClose);
+    registered = 1;
+  }
+  cc_recording = 1;
+  return 0;
+}
+
+void cc_recordClose()
+{
+  if (!cc_recording) return;
+  cc_recording = 0;
+  record_flush();
+  fclose(recordFile);
+}
+
+void cc_recordOut( uint8_t b )
+{
+  uint64_t t = record_now() - t0;
+  if (!pending || cur.kind != CC_RECORD_CMD || cur.nIn || cur.nOut == CC_RECORD_OUT) {
+    record_flush();
+    cur.kind = CC_RECORD_CMD;
+    cur.t = t;
+    cur.nOut = cur.nIn = 0;
+    pending = 1;
+  }
+  cur.out[cur.nOut++] = b;
+  cur.busNs = t - cur.t;
+}
+
+void cc_recordIn( uint8_t b )
+{
+  if (!pending || cur.nIn == CC_RECORD_IN) return;
+  cur.in[cur.nIn++] = b;
+  cur.busNs = record_now() - t0 - cur.t;
+}
+
+void cc_recordEnter()
+{
+  record_flush();
+  cur.kind = CC_RECORD_ENTER;
+  cur.t = record_now() - t0;
+  cur.busNs = 0;
+  cur.nOut = cur.nIn = 0;
+  pending = 1;
+  record_flush();
+}
+
+int cc_recordStart( FILE *f, const char *path )
+{
+  char magic[sizeof(RECORD_MAGIC)-1];
+  if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) || memcmp(magic, RECORD_MAGIC, sizeof(magic))) {
+    LOG_ERR("%s : not a recording of debug commands", path);
+    return -1;
+  }
+  readT = 0;
+  return 0;
+}
+
+int cc_recordNext( FILE *f, struct ccRecord *r )
+{
+  int c = fgetc(f);
+  if (c == EOF) return 0;
+  uint64_t dt, bus, nOut, nIn;
+  r->kind = c;
+  if (getVarint(f, &dt) || getVarint(f, &bus) || getVarint(f, &nOut) || nOut > CC_RECORD_OUT)
+    return -1;
+  if (fread(r->out, 1, nOut, f) != nOut) return -1;
+  if (getVarint(f, &nIn) || nIn > CC_RECORD_IN) return -1;
+  if (fread(r->in, 1, nIn, f) != nIn) return -1;
+  readT += dt;
+  r->t = readT;
+  r->busNs = bus;
+  r->nOut = nOut;
+  r->nIn = nIn;
+  return 1;
+}
+
+const char *cc_recordName( uint8_t b )
+{
+  // default instruction table
+  switch (b & 0xF8) {
+    case 0x10: return "CHIP_ERASE";
+    case 0x18: return "WR_CONFIG";
+    case 0x20: return "RD_CONFIG";
+    case 0x28: return "GET_PC";
+    case 0x30: return "READ_STATUS";
+    case 0x38: return "SET_HW_BRKPNT";
+    case 0x40: return "HALT";
+    case 0x48: return "RESUME";
+    case 0x50: return "DEBUG_INSTR";
+    case 0x58: return "STEP_INSTR";
+    case 0x60: return "GET_BM";
+    case 0x68: return "GET_CHIP_ID";
+    case 0x80: return "BURST_WRITE";
+  }
+  return "UNKNOWN";
+}
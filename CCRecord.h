@@ -0,0 +1,77 @@
+
+#ifndef CCRECORD_H
+#define CCRECORD_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Recording of the debug commands : bytes sent, bytes received and bus
+ * time of each command, in a compact binary file to replay later
+ * (cc_replay) against the simulated target or a live one.
+ */
+
+#define CC_RECORD_CMD     0   // a debug command
+#define CC_RECORD_ENTER   1   // debug mode entry (RST and DC sequence)
+
+#define CC_RECORD_OUT     2050  // BURST_WRITE : 2 bytes header and 2048 data bytes
+#define CC_RECORD_IN      4
+
+  struct ccRecord
+  {
+    uint8_t kind;
+    uint64_t t;         // ns from the start of the recording
+    uint32_t busNs;     // from the first byte out to the last byte in
+    uint16_t nOut, nIn;
+    uint8_t out[CC_RECORD_OUT];
+    uint8_t in[CC_RECORD_IN];
+  };
+
+  /**
+   * Non zero while recording; tested before every record call
+   */
+  extern uint8_t cc_recording;
+
+  /**
+   * Start recording to <path>.
+   * cc_init() calls it when the CC_RECORD environment variable is set.
+   */
+  int cc_recordOpen( const char *path );
+
+  /**
+   * Flush and close the recording
+   */
+  void cc_recordClose();
+
+  /**
+   * A byte sent to the target : the first one after received bytes starts
+   * a new command
+   */
+  void cc_recordOut( uint8_t b );
+
+  /**
+   * A byte received from the target
+   */
+  void cc_recordIn( uint8_t b );
+
+  /**
+   * Debug mode entry
+   */
+  void cc_recordEnter();
+
+  /**
+   * Check the header of a recording. Returns 0, or -1 after logging.
+   */
+  int cc_recordStart( FILE *f, const char *path );
+
+  /**
+   * Next record of a recording. Returns 1, 0 at the end, -1 if truncated.
+   */
+  int cc_recordNext( FILE *f, struct ccRecord *r );
+
+  /**
+   * Name of the debug command starting with byte <b>
+   */
+  const char *cc_recordName( uint8_t b );
+
+#endif
@@ -0,0 +1,346 @@
+/***********************************************************************
+    Host side shadow of the target registers.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+/*
+ * Each debug instruction costs 3 to 5 bytes on a bit-banged bus, so a
+ * register read or a write of a value already in place is a waste.
+ * Every shadowed byte keeps a mask of known bits; a byte of XDATA is
+ * only shadowed in SRAM (0x0000-0x1FFF) and in the XREG area.
+ * A and DPTR are shadowed too : every debug instruction returns A.
+ * With cc_echoCheck, that A is compared with the value it must have
+ * whenever the shadow knows it beforehand : a command or an answer
+ * garbled on the bus shows at no extra bus cost.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CCDebugger.h"
+#include "CCRegs.h"
+#include "CCLog.h"
+
+#define XRAM_SIZE   0x2000
+#define XREG_BASE   0x6000
+#define XREG_SIZE   0x400
+
+struct ccRegs
+{
+  uint8_t sfrVal[128];
+  uint8_t sfrKnown[128];
+  uint8_t xramVal[XRAM_SIZE];
+  uint8_t xramKnown[XRAM_SIZE];
+  uint8_t xregVal[XREG_SIZE];
+  uint8_t xregKnown[XREG_SIZE];
+  uint16_t dptr;
+  uint8_t dptrKnown;
+  uint8_t acc;
+  uint8_t accKnown;
+  uint32_t epoch;
+  unsigned long saved;
+  unsigned long echoErrors;
+};
+
+uint8_t cc_echoCheck=0;
+
+// shadow of the selected target
+static __thread struct ccRegs *R;
+static __thread struct ccTarget *owner;
+
+static void regsClear()
+{
+  memset(R->sfrKnown,0,sizeof(R->sfrKnown));
+  memset(R->xramKnown,0,sizeof(R->xramKnown));
+  memset(R->xregKnown,0,sizeof(R->xregKnown));
+  R->dptrKnown=0;
+  R->accKnown=0;
+  R->epoch=cc_getEpoch();
+}
+
+/**
+ * Follow cc_select() : each target has its own shadow
+ */
+static inline void regsSelect()
+{
+  struct ccTarget *t = cc_current();
+  if (t == owner) return;
+  owner = t;
+  if (!t->regs) {
+    t->regs = calloc(1, sizeof(struct ccRegs));
+    if (!t->regs) { LOG_ERR("out of memory"); exit(1); }
+    R = t->regs;
+    regsClear();
+  }
+  R = t->regs;
+}
+
+void cc_regsReset()
+{
+  regsSelect();
+  regsClear();
+}
+
+/**
+ * Forget everything if the CPU ran since the last access
+ */
+static inline void regsSync()
+{
+  regsSelect();
+  if (R->epoch != cc_getEpoch())
+    regsClear();
+}
+
+/**
+ * Shadow slot of an XDATA address, or NULL if not shadowed
+ */
+static inline uint8_t *xslot(uint16_t addr, uint8_t **known)
+{
+  if (addr < XRAM_SIZE) {
+    *known = &R->xramKnown[addr];
+    return &R->xramVal[addr];
+  }
+  if (addr >= XREG_BASE && addr < XREG_BASE+XREG_SIZE) {
+    *known = &R->xregKnown[addr-XREG_BASE];
+    return &R->xregVal[addr-XREG_BASE];
+  }
+  return NULL;
+}
+
+static inline void xlearn(uint16_t addr, uint8_t val)
+{
+  uint8_t *known, *slot = xslot(addr,&known);
+  if (slot) {
+    *slot = val;
+    *known = 0xff;
+  }
+}
+
+/**
+ * Debug instructions, tracking A
+ */
+static inline uint8_t rx1(uint8_t oc0)
+{
+  R->acc = cc_exec(oc0);
+  R->accKnown = 1;
+  return R->acc;
+}
+
+static inline uint8_t rx2(uint8_t oc0, uint8_t oc1)
+{
+  R->acc = cc_exec2(oc0,oc1);
+  R->accKnown = 1;
+  return R->acc;
+}
+
+static inline uint8_t rx3(uint8_t oc0, uint8_t oc1, uint8_t oc2)
+{
+  R->acc = cc_exec3(oc0,oc1,oc2);
+  R->accKnown = 1;
+  return R->acc;
+}
+
+/**
+ * A echoed by an instruction whose result was known : 0 if as expected.
+ * On a difference, which of the two is right is unknown.
+ */
+static inline int echo(uint8_t got, uint8_t expected)
+{
+  if (!cc_echoCheck || got == expected) return 0;
+  R->echoErrors++;
+  R->accKnown = 0;
+  LOG_DEBUG("A echoed %02x, %02x expected", got, expected);
+  return 1;
+}
+
+/**
+ * Instruction leaving A alone : 0 if as expected
+ */
+static inline int echoKept(uint8_t got)
+{
+  if (R->accKnown && echo(got, R->acc)) return 1;
+  R->acc = got;
+  R->accKnown = 1;
+  return 0;
+}
+
+/**
+ * SFR of an 8-bit SFR address (0x80-0xFF)
+ */
+#define SFR(a) ((a)&0x7f)
+
+uint8_t cc_sfrFetch( uint8_t sfr )
+{
+  regsSync();
+  uint8_t val = rx2(0xE5, sfr); // MOV A,direct
+  R->sfrVal[SFR(sfr)] = val;
+  R->sfrKnown[SFR(sfr)] = 0xff;
+  return val;
+}
+
+uint8_t cc_sfrGet( uint8_t sfr )
+{
+  regsSync();
+  if (R->sfrKnown[SFR(sfr)] == 0xff) {
+    R->saved++;
+    return R->sfrVal[SFR(sfr)];
+  }
+  return cc_sfrFetch(sfr);
+}
+
+void cc_sfrSet( uint8_t sfr, uint8_t val )
+{
+  regsSync();
+  if (R->sfrKnown[SFR(sfr)] == 0xff && R->sfrVal[SFR(sfr)] == val) {
+    R->saved++;
+    return;
+  }
+  uint8_t got = cc_exec3(0x75, sfr, val); // MOV direct,#data
+  if (sfr != SFR_ACC)
+    echoKept(got);
+  else if (!echo(got, val)) {
+    R->acc = val;
+    R->accKnown = 1;
+  }
+  R->sfrVal[SFR(sfr)] = val;
+  R->sfrKnown[SFR(sfr)] = 0xff;
+  if (sfr == SFR_DPL || sfr == SFR_DPH) R->dptrKnown = 0;
+}
+
+void cc_sfrUpdate( uint8_t sfr, uint8_t mask, uint8_t val )
+{
+  regsSync();
+  // untouched bits must be written back as they are
+  if ((R->sfrKnown[SFR(sfr)] | mask) != 0xff)
+    cc_sfrFetch(sfr);
+  else
+    R->saved++;
+  cc_sfrSet(sfr, (R->sfrVal[SFR(sfr)] & ~mask) | (val & mask));
+}
+
+void cc_sfrForget( uint8_t sfr, uint8_t bits )
+{
+  regsSelect();
+  R->sfrKnown[SFR(sfr)] &= ~bits;
+}
+
+void cc_sfrAssume( uint8_t sfr, uint8_t mask, uint8_t val )
+{
+  regsSync();
+  R->sfrVal[SFR(sfr)] = (R->sfrVal[SFR(sfr)] & ~mask) | (val & mask);
+  R->sfrKnown[SFR(sfr)] |= mask;
+}
+
+void cc_setDPTR( uint16_t addr )
+{
+  regsSync();
+  if (R->dptrKnown && R->dptr == addr) {
+    R->saved++;
+    return;
+  }
+  if (R->dptrKnown && (uint16_t)(R->dptr+1) == addr)
+    echoKept(cc_exec(0xA3)); // INC DPTR : one byte shorter than MOV DPTR
+  else
+    echoKept(cc_execi(0x90, addr)); // MOV DPTR,#data16 (leaves A alone)
+  R->dptr = addr;
+  R->dptrKnown = 1;
+  // DPL and DPH are SFRs too
+  R->sfrVal[SFR(SFR_DPL)] = addr & 0xff;
+  R->sfrVal[SFR(SFR_DPH)] = addr >> 8;
+  R->sfrKnown[SFR(SFR_DPL)] = R->sfrKnown[SFR(SFR_DPH)] = 0xff;
+}
+
+void cc_readBlock( uint16_t addr, uint8_t *buf, int len )
+{
+  cc_setDPTR(addr);
+  for (int i=0 ; i<len ; i++)
+  {
+    buf[i] = rx1(0xE0); // MOVX A,@DPTR
+    // INC DPTR echoes the byte a second time
+    if (!echo(cc_exec(0xA3), buf[i]))
+      xlearn(addr+i, buf[i]);
+  }
+  R->dptr = addr+len;
+  R->sfrVal[SFR(SFR_DPL)] = R->dptr & 0xff;
+  R->sfrVal[SFR(SFR_DPH)] = R->dptr >> 8;
+}
+
+void cc_xdataPut( uint16_t addr, uint8_t val )
+{
+  cc_setDPTR(addr);
+  int bad = 0;
+  if (!R->accKnown || R->acc != val) {
+    bad = echo(cc_exec2(0x74, val), val); // MOV A,#data
+    R->acc = val;
+    R->accKnown = !bad;
+  } else
+    R->saved++;
+  bad |= echoKept(cc_exec(0xF0)); // MOVX @DPTR,A
+  if (!bad)
+    xlearn(addr, val);
+  else
+    cc_xdataForget(addr, 1);
+}
+
+void cc_writeBlock( uint16_t addr, const uint8_t *buf, int len )
+{
+  regsSync();
+  for (int i=0 ; i<len ; i++)
+  {
+    uint8_t *known, *slot = xslot(addr+i,&known);
+    if (slot && *known == 0xff && *slot == buf[i]) {
+      R->saved+=3;
+      continue;
+    }
+    // DPTR follows lazily : INC DPTR only before the next write
+    cc_xdataPut(addr+i, buf[i]);
+  }
+}
+
+uint8_t cc_xdataGet( uint16_t addr )
+{
+  regsSync();
+  uint8_t *known, *slot = xslot(addr,&known);
+  if (slot && *known == 0xff) {
+    R->saved+=3;
+    return *slot;
+  }
+  uint8_t val;
+  cc_readBlock(addr, &val, 1);
+  return val;
+}
+
+void cc_xdataForget( uint16_t addr, int len )
+{
+  regsSelect();
+  for (int i=0 ; i<len ; i++)
+  {
+    uint8_t *known, *slot = xslot(addr+i,&known);
+    if (slot) *known = 0;
+  }
+}
+
+unsigned long cc_echoErrors()
+{
+  regsSelect();
+  return R->echoErrors;
+}
+
+unsigned long cc_regsSaved()
+{
+  regsSelect();
+  return R->saved;
+}
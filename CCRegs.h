@@ -0,0 +1,141 @@
+
+#ifndef CCREGS_H
+#define CCREGS_H
+
+#include <stdint.h>
+
+// SFRs touched by the tools
+#define SFR_SP         0x81
+#define SFR_DPL        0x82
+#define SFR_DPH        0x83
+#define SFR_DPS        0x92   // DPTR1 in place of DPTR0 when set
+#define SFR_CLKCONSTA  0x9E   // clock in use
+#define SFR_FMAP       0x9F   // flash bank seen in code space 0x8000-0xFFFF
+#define SFR_T1STAT     0xAF   // Timer 1 flags : OVFIF 0x20
+#define SFR_RNDL       0xBC   // CRC16 result, low byte (write twice to seed)
+#define SFR_RNDH       0xBD   // CRC16 result, high byte (write feeds the CRC)
+#define SFR_CLKCONCMD  0xC6   // clock asked : OSC 0x40 (RC), TICKSPD 0x38, CLKSPD 0x07
+#define SFR_U0DBUF     0xC1   // UART 0 data, reading it pops the RX FIFO
+#define SFR_MEMCTR     0xC7   // XBANK : flash bank seen in XDATA 0x8000-0xFFFF ("FMAP" in the tools), XMAP : SRAM in code space
+#define SFR_PSW        0xD0   // register bank RS 0x18
+#define SFR_DMAIRQ     0xD1
+#define SFR_DMA1CFGL   0xD2
+#define SFR_DMA1CFGH   0xD3
+#define SFR_DMA0CFGL   0xD4
+#define SFR_DMA0CFGH   0xD5
+#define SFR_DMAARM     0xD6
+#define SFR_RFD        0xD9   // radio data, reading it pops the RX FIFO
+#define SFR_ACC        0xE0
+#define SFR_T1CNTL     0xE2   // Timer 1 count, reading it latches T1CNTH, writing clears
+#define SFR_T1CNTH     0xE3
+#define SFR_T1CTL      0xE4   // Timer 1 prescaler 0x0C, mode 0x03 (1 : free-running)
+#define SFR_B          0xF0
+#define SFR_U1DBUF     0xF9   // UART 1 data, reading it pops the RX FIFO
+
+// reading pops a FIFO : memory dumps show these as 0
+#define SFR_POPS(sfr)  ((sfr)==SFR_U0DBUF || (sfr)==SFR_RFD || (sfr)==SFR_U1DBUF)
+
+// XDATA registers
+#define X_SFR          0x7000   // SFRs are mirrored at X_SFR+sfr (0x7080-0x70FF)
+#define X_POPS(addr)   ((addr)>=X_SFR+0x80 && (addr)<X_SFR+0x100 && SFR_POPS((addr)-X_SFR))
+#define X_DBGDATA      0x6260
+#define X_FCTL         0x6270
+#define X_FADDRL       0x6271
+#define X_FADDRH       0x6272
+#define X_FWDATA       0x6273
+#define X_CHIPINFO0    0x6276   // FLASHSIZE (bits 6:4) : 1 32 KB, 2 64 KB, 3 128 KB, 4 256 KB
+
+/*
+ * Host side shadow of target SFRs, XDATA RAM/XREG bytes, DPTR and A.
+ * Every bit is either known or not : reads of known bits and writes of
+ * values already in place cost no debug command.
+ * Bits the hardware changes (DMA done, flash busy...) must be forgotten
+ * by the caller; everything is forgotten when the CPU runs (cc_enter,
+ * cc_resume, cc_step, cc_halt) or on cc_regsReset().
+ */
+
+  /**
+   * Forget every shadowed value (after raw cc_exec calls changing SFR, DPTR or XDATA)
+   */
+  void cc_regsReset();
+
+  /**
+   * SFR read, from the shadow when all bits are known
+   */
+  uint8_t cc_sfrGet( uint8_t sfr );
+
+  /**
+   * SFR read, always from the target (polling hardware bits)
+   */
+  uint8_t cc_sfrFetch( uint8_t sfr );
+
+  /**
+   * SFR write, skipped when the value is known to be in place
+   */
+  void cc_sfrSet( uint8_t sfr, uint8_t val );
+
+  /**
+   * Read-modify-write : bits in <mask> take the value of <val>
+   */
+  void cc_sfrUpdate( uint8_t sfr, uint8_t mask, uint8_t val );
+
+  /**
+   * Bits changed by the hardware
+   */
+  void cc_sfrForget( uint8_t sfr, uint8_t bits );
+
+  /**
+   * Bits whose value the caller deduced (a finished DMA channel is disarmed...)
+   */
+  void cc_sfrAssume( uint8_t sfr, uint8_t mask, uint8_t val );
+
+  /**
+   * Point DPTR to addr (INC DPTR when one step ahead)
+   */
+  void cc_setDPTR( uint16_t addr );
+
+  /**
+   * Read XDATA from the target, refreshing the shadow
+   */
+  void cc_readBlock( uint16_t addr, uint8_t *buf, int len );
+
+  /**
+   * Write XDATA, skipping bytes known to hold their value already
+   */
+  void cc_writeBlock( uint16_t addr, const uint8_t *buf, int len );
+
+  /**
+   * Write one XDATA byte even if unchanged (registers with write side effects)
+   */
+  void cc_xdataPut( uint16_t addr, uint8_t val );
+
+  /**
+   * XDATA byte, from the shadow when known
+   */
+  uint8_t cc_xdataGet( uint16_t addr );
+
+  /**
+   * XDATA bytes changed behind the debugger's back (DMA, flash controller)
+   */
+  void cc_xdataForget( uint16_t addr, int len );
+
+  /**
+   * Number of debug commands saved by the shadow
+   */
+  unsigned long cc_regsSaved();
+
+  /**
+   * Compare the A echoed by each debug instruction of the functions above
+   * with the value it must have, when known : MOV A,#data, MOVX @DPTR,A,
+   * instructions leaving A alone, and the INC DPTR following each byte
+   * read, which echoes that byte a second time. Off by default.
+   */
+  extern uint8_t cc_echoCheck;
+
+  /**
+   * Echoes that differed on the selected target. A read with no new
+   * difference can be trusted without a second pass.
+   */
+  unsigned long cc_echoErrors();
+
+#endif
@@ -0,0 +1,115 @@
+/***********************************************************************
+    Single producer, single consumer ring of buffers.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+
+#include "CCRing.h"
+
+// spins before sleeping, and sleep length when waiting
+#define RING_SPINS     1000
+#define RING_SLEEP_NS  20000
+
+int ring_init(struct ring *r,unsigned count,size_t size)
+{
+  r->slots=calloc(count,sizeof(struct ringSlot));
+  uint8_t *bufs=malloc(count*size);
+  if(!r->slots || !bufs) return -1;
+  for(unsigned i=0 ; i<count ; i++)
+    r->slots[i].data=bufs+i*size;
+  r->count=count;
+  atomic_init(&r->head,0);
+  atomic_init(&r->tail,0);
+  atomic_init(&r->closed,0);
+  atomic_init(&r->failed,0);
+  r->waits=0;
+  return 0;
+}
+
+void ring_free(struct ring *r)
+{
+  if(r->slots) free(r->slots[0].data);
+  free(r->slots);
+  r->slots=NULL;
+}
+
+static void ring_wait(int *spins)
+{
+  if(++*spins < RING_SPINS)
+  {
+    sched_yield();
+    return;
+  }
+  struct timespec tp = {0, RING_SLEEP_NS};
+  nanosleep(&tp, NULL);
+}
+
+struct ringSlot *ring_claim(struct ring *r)
+{
+  unsigned head=atomic_load_explicit(&r->head,memory_order_relaxed);
+  int spins=0;
+  while(head - atomic_load_explicit(&r->tail,memory_order_acquire) >= r->count)
+  {
+    if(atomic_load_explicit(&r->failed,memory_order_relaxed)) return NULL;
+    if(!spins) r->waits++;
+    ring_wait(&spins);
+  }
+  if(atomic_load_explicit(&r->failed,memory_order_relaxed)) return NULL;
+  return &r->slots[head & (r->count-1)];
+}
+
+void ring_publish(struct ring *r)
+{
+  unsigned head=atomic_load_explicit(&r->head,memory_order_relaxed);
+  atomic_store_explicit(&r->head,head+1,memory_order_release);
+}
+
+void ring_close(struct ring *r)
+{
+  atomic_store_explicit(&r->closed,1,memory_order_release);
+}
+
+struct ringSlot *ring_next(struct ring *r)
+{
+  unsigned tail=atomic_load_explicit(&r->tail,memory_order_relaxed);
+  int spins=0;
+  while(atomic_load_explicit(&r->head,memory_order_acquire) == tail)
+  {
+    if(atomic_load_explicit(&r->failed,memory_order_relaxed)) return NULL;
+    if(atomic_load_explicit(&r->closed,memory_order_acquire))
+    {
+      // the last slots may have been published just before closing
+      if(atomic_load_explicit(&r->head,memory_order_acquire) != tail) break;
+      return NULL;
+    }
+    ring_wait(&spins);
+  }
+  return &r->slots[tail & (r->count-1)];
+}
+
+void ring_release(struct ring *r)
+{
+  unsigned tail=atomic_load_explicit(&r->tail,memory_order_relaxed);
+  atomic_store_explicit(&r->tail,tail+1,memory_order_release);
+}
+
+void ring_fail(struct ring *r)
+{
+  atomic_store_explicit(&r->failed,1,memory_order_release);
+}
@@ -0,0 +1,74 @@
+
+#ifndef CCRING_H
+#define CCRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*
+ * Lock-free ring of buffers between exactly one producer thread and one
+ * consumer thread. Each side only waits when the ring is full (producer)
+ * or empty (consumer).
+ */
+
+  /**
+   * A buffer of the ring, with the flash address and length of its data
+   */
+  struct ringSlot
+  {
+    uint32_t addr;
+    uint32_t len;
+    uint32_t aux;       // free for the user (CRC...)
+    uint8_t *data;
+  };
+
+  struct ring
+  {
+    struct ringSlot *slots;
+    unsigned count;             // power of 2
+    _Atomic unsigned head;      // slots published, written by the producer
+    _Atomic unsigned tail;      // slots released, written by the consumer
+    _Atomic int closed;         // producer is done
+    _Atomic int failed;         // one side gave up
+    unsigned long waits;        // times the producer found the ring full
+  };
+
+  /**
+   * <count> (power of 2) buffers of <size> bytes; 0, or -1 if out of memory
+   */
+  int ring_init( struct ring *r, unsigned count, size_t size );
+  void ring_free( struct ring *r );
+
+  /**
+   * Producer : next free slot (waits while the ring is full), NULL if failed
+   */
+  struct ringSlot *ring_claim( struct ring *r );
+
+  /**
+   * Producer : hand the claimed slot over to the consumer
+   */
+  void ring_publish( struct ring *r );
+
+  /**
+   * Producer : no more slots
+   */
+  void ring_close( struct ring *r );
+
+  /**
+   * Consumer : next published slot (waits while the ring is empty),
+   * NULL once the ring is closed and drained, or failed
+   */
+  struct ringSlot *ring_next( struct ring *r );
+
+  /**
+   * Consumer : give the slot back to the producer
+   */
+  void ring_release( struct ring *r );
+
+  /**
+   * Either side : stop the other one (claim and next return NULL)
+   */
+  void ring_fail( struct ring *r );
+
+#endif
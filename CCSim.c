@@ -0,0 +1,824 @@
+/***********************************************************************
+    Simulated CC2531 debug target.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+/*
+ * The simulated target decodes the debug protocol at pin level, exactly
+ * as the chip sees it (bits sampled on DC rising edges), and runs the
+ * small 8051 instruction subset used by the tools, plus the DMA
+ * controller and the flash controller needed by cc_write.
+ * RESUME runs the code at once, up to a breakpoint (0xA5).
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "CCDebugger.h"
+#include "CCSim.h"
+
+// SFR addresses
+#define SFR_SP         0x81
+#define SFR_DPL        0x82
+#define SFR_DPH        0x83
+#define SFR_CLKCONSTA  0x9E
+#define SFR_T1STAT     0xAF
+#define SFR_RNDL       0xBC
+#define SFR_RNDH       0xBD
+#define SFR_FMAP       0x9F
+#define SFR_CLKCONCMD  0xC6
+#define SFR_MEMCTR     0xC7
+#define SFR_PSW        0xD0
+#define SFR_DMAIRQ     0xD1
+#define SFR_DMA1CFGL   0xD2
+#define SFR_DMA1CFGH   0xD3
+#define SFR_DMA0CFGL   0xD4
+#define SFR_DMA0CFGH   0xD5
+#define SFR_DMAARM     0xD6
+#define SFR_ACC        0xE0
+#define SFR_T1CNTL     0xE2
+#define SFR_T1CNTH     0xE3
+#define SFR_T1CTL      0xE4
+
+// XDATA registers
+#define X_DBGDATA      0x6260
+#define X_FCTL         0x6270
+#define X_FADDRL       0x6271
+#define X_FADDRH       0x6272
+#define X_CHIPINFO0    0x6276
+
+// DMA triggers
+#define TRIG_FLASH     18
+#define TRIG_DBG_BW    31
+
+// Debug status bits
+#define ST_CHIP_ERASE_BUSY 0x80
+#define ST_CPU_HALTED  0x20
+#define ST_HALT_STATUS 0x08
+#define ST_OSC_STABLE  0x02
+
+// Debug config bits
+#define CFG_DMA_PAUSE  0x04
+#define CFG_TIMER_SUSPEND 0x02
+
+// cycles per instruction, for Timer 1
+#define SIM_INSTR_CYCLES 2
+
+// MEMCTR.XMAP : SRAM mapped in code space from 0x8000
+#define MEMCTR_XMAP    0x08
+
+// a running CPU executes one instruction every SIM_INSTR_NS (16 MHz,
+// half on the crystal), simulated when the debug port next looks at it;
+// at most SIM_RUN_LIMIT at a time
+#define SIM_INSTR_NS   125
+#define SIM_RUN_LIMIT  10000000
+
+// flash controller timings (ns) : page erase, and write of a 32-bit word
+#define SIM_ERASE_NS   20000000
+#define SIM_WORD_NS    20000
+
+struct ccsim
+{
+  // pins
+  uint8_t rst, dc, ddHost, ddOutput, ddTarget;
+  uint8_t debug, entryEdges;
+  // command decoding
+  uint8_t shift, bits;
+  uint8_t cmd[4], cmdLen, cmdNeed;
+  uint8_t inBurst;
+  uint16_t burstLen, burstCount;
+  // response
+  uint8_t resp[2], respLen, respPos, respBit;
+  uint8_t busy;
+  // cpu
+  uint8_t halted;
+  uint64_t runFrom;       // running : instructions simulated up to then
+  uint8_t resumed;        // next instruction is the one resumed from
+  uint8_t haltByBreak;    // last halt from a breakpoint (HALT_STATUS)
+  uint32_t breaks[4];     // hardware breakpoints : flash address, bit 31 set if enabled
+  uint32_t t1Cycles;      // Timer 1 : cycles counted since the last tick
+  uint16_t t1Count;
+  uint8_t t1Latch;        // T1CNTH, latched by reading T1CNTL
+  uint8_t config;
+  uint16_t pc;
+  uint8_t sfr[128];
+  uint16_t dmaCount[5];
+  uint32_t flashAddr;
+  uint8_t flashWrite;
+  uint64_t flashBusy;     // end of the flash operation in progress, 0 if none
+  uint8_t flashIrq;       // DMA channel done at that time
+  uint8_t chipErase;      // the operation is a chip erase
+  uint64_t clockSwitch;   // CLKCONCMD reaches CLKCONSTA then, 0 if done
+  // memories
+  uint8_t xram[0x2000];
+  uint8_t xreg[0x400];
+  uint8_t info[0x800];
+  uint8_t flash[CCSIM_FLASH_SIZE];
+};
+
+static __thread struct ccsim *sim;
+
+#define SFR(a) sim->sfr[(a)-0x80]
+// DATA/IDATA is the top of SRAM
+#define SIM_IDATA 0x1F00
+#define IRAM(a) sim->xram[SIM_IDATA+(a)]
+
+static uint8_t sim_xread( uint16_t addr );
+static void sim_xwrite( uint16_t addr, uint8_t val );
+
+static uint64_t sim_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * The 32 MHz crystal takes a while to start : CLKCONSTA follows
+ * CLKCONCMD once it is stable
+ */
+#define SIM_XOSC_NS     300000
+
+static inline void sim_clockTick()
+{
+  if (!sim->clockSwitch || sim_now() < sim->clockSwitch) return;
+  sim->clockSwitch = 0;
+  SFR(SFR_CLKCONSTA) = SFR(SFR_CLKCONCMD);
+}
+
+/**
+ * The flash controller is done when its time has come : FCTL.BUSY
+ * drops and the DMA channel feeding it completes
+ */
+static inline void sim_flashTick()
+{
+  if (!sim->flashBusy || sim_now() < sim->flashBusy) return;
+  sim->flashBusy = 0;
+  sim->chipErase = false;
+  sim->xreg[X_FCTL - 0x6000] &= ~0x80;
+  SFR(SFR_DMAARM) &= ~sim->flashIrq;
+  SFR(SFR_DMAIRQ) |= sim->flashIrq;
+  sim->flashIrq = 0;
+}
+
+/////////////////////////////////////////////////////////////////////
+////                         CPU / MEMORY                        ////
+/////////////////////////////////////////////////////////////////////
+
+/**
+ * CPU reset : SFRs back to their reset values
+ */
+static void sim_reset()
+{
+  memset(&IRAM(0), 0, 0x100);
+  memset(sim->sfr, 0, sizeof(sim->sfr));
+  memset(sim->dmaCount, 0, sizeof(sim->dmaCount));
+  SFR(SFR_SP) = 0x07;
+  SFR(SFR_FMAP) = 0x01;
+  SFR(SFR_CLKCONCMD) = 0xC9;    // 16 MHz RCOSC
+  SFR(SFR_CLKCONSTA) = 0xC9;
+  sim->clockSwitch = 0;
+  sim->config = CFG_DMA_PAUSE;
+  sim->pc = 0;
+  sim->halted = false;
+  sim->runFrom = sim_now();
+  sim->haltByBreak = false;
+  memset(sim->breaks, 0, sizeof(sim->breaks));
+  sim->t1Count = 0;
+  sim->t1Cycles = 0;
+}
+
+/**
+ * Timer 1 in free-running mode, prescaled by T1CTL.DIV (1, 8, 32, 128)
+ */
+static inline void sim_timerCycles( uint32_t cycles )
+{
+  uint8_t ctl = SFR(SFR_T1CTL);
+  if ((ctl & 0x03) != 0x01) return;
+  static const uint8_t shifts[4] = { 0, 3, 5, 7 };
+  sim->t1Cycles += cycles;
+  uint32_t ticks = sim->t1Cycles >> shifts[(ctl >> 2) & 3];
+  sim->t1Cycles -= ticks << shifts[(ctl >> 2) & 3];
+  if (sim->t1Count + ticks > 0xFFFF)
+    SFR(SFR_T1STAT) |= 0x20;    // OVFIF
+  sim->t1Count += ticks;
+}
+
+static uint8_t sim_readDirect( uint8_t addr )
+{
+  if (addr < 0x80) return IRAM(addr);
+  sim_flashTick();
+  switch (addr) {
+    case SFR_CLKCONSTA:
+      sim_clockTick();
+      break;
+    case SFR_T1CNTL:
+      sim->t1Latch = sim->t1Count >> 8;
+      return sim->t1Count & 0xFF;
+    case SFR_T1CNTH:
+      return sim->t1Latch;
+  }
+  return SFR(addr);
+}
+
+static void sim_writeDirect( uint8_t addr, uint8_t val )
+{
+  if (addr < 0x80) {
+    IRAM(addr) = val;
+    return;
+  }
+  switch (addr) {
+    case SFR_CLKCONCMD:
+      // back to the RC oscillator at once, the crystal needs to start
+      if ((val & 0x40) || !(SFR(SFR_CLKCONSTA) & 0x40)) {
+        SFR(SFR_CLKCONSTA) = val;
+        sim->clockSwitch = 0;
+      } else
+        sim->clockSwitch = sim_now() + SIM_XOSC_NS;
+      break;
+    case SFR_T1CNTL:
+      // any write clears the counter
+      sim->t1Count = 0;
+      sim->t1Cycles = 0;
+      return;
+    case SFR_RNDL:
+      // seed : previous low byte moves to the high byte
+      SFR(SFR_RNDH) = SFR(SFR_RNDL);
+      break;
+    case SFR_RNDH: {
+      // CRC16 (x16+x15+x2+1) of the byte written, MSB first
+      uint16_t crc = (SFR(SFR_RNDH) << 8) | SFR(SFR_RNDL);
+      crc ^= val << 8;
+      for (int i = 0; i < 8; i++)
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1;
+      SFR(SFR_RNDH) = crc >> 8;
+      SFR(SFR_RNDL) = crc & 0xFF;
+      return;
+    }
+    case SFR_DMAARM:
+      // ABORT clears the selected channels
+      if (val & 0x80) {
+        SFR(SFR_DMAARM) &= ~(val & 0x1F);
+        return;
+      }
+      for (int ch = 0; ch < 5; ch++)
+        if ((val & (1<<ch)) && !(SFR(SFR_DMAARM) & (1<<ch)))
+          sim->dmaCount[ch] = 0;
+      break;
+  }
+  SFR(addr) = val;
+}
+
+static uint8_t *sim_reg( uint8_t n )
+{
+  return &IRAM((SFR(SFR_PSW) & 0x18) + n);
+}
+
+static uint16_t sim_dptr()
+{
+  return (SFR(SFR_DPH) << 8) | SFR(SFR_DPL);
+}
+
+static void sim_setDptr( uint16_t v )
+{
+  SFR(SFR_DPH) = v >> 8;
+  SFR(SFR_DPL) = v & 0xFF;
+}
+
+/**
+ * Code memory : common area, then SRAM (MEMCTR.XMAP) or the bank selected by FMAP
+ */
+static uint8_t sim_code( uint16_t addr )
+{
+  if (addr < 0x8000) return sim->flash[addr];
+  if ((SFR(SFR_MEMCTR) & MEMCTR_XMAP) && addr < 0x8000 + sizeof(sim->xram))
+    return sim->xram[addr - 0x8000];
+  return sim->flash[((SFR(SFR_FMAP) & 0x07) << 15) + (addr & 0x7FFF)];
+}
+
+/**
+ * Execute one instruction, op[] holds its bytes.
+ * When running, PC moves past it; from the debug port only jumps move PC.
+ */
+static void sim_step( const uint8_t *op, int running )
+{
+  uint8_t *acc = &SFR(SFR_ACC);
+  uint16_t next = sim->pc;
+  uint8_t len = 1;
+  int8_t rel;
+
+  switch (op[0]) {
+    case 0x00: // NOP
+      break;
+    case 0x02: // LJMP addr16
+      sim->pc = (op[1] << 8) | op[2];
+      return;
+    case 0x04: // INC A
+      (*acc)++;
+      break;
+    case 0x14: // DEC A
+      (*acc)--;
+      break;
+    case 0x60: // JZ rel
+    case 0x70: // JNZ rel
+    case 0x80: // SJMP rel
+      len = 2;
+      rel = (int8_t)op[1];
+      if (op[0] == 0x80 || (op[0] == 0x60) == (*acc == 0))
+        next += rel;
+      break;
+    case 0x74: // MOV A,#data
+      len = 2;
+      *acc = op[1];
+      break;
+    case 0x75: // MOV direct,#data
+      len = 3;
+      sim_writeDirect(op[1], op[2]);
+      break;
+    case 0x85: // MOV direct,direct (src first)
+      len = 3;
+      sim_writeDirect(op[2], sim_readDirect(op[1]));
+      break;
+    case 0x90: // MOV DPTR,#data16
+      len = 3;
+      sim_setDptr((op[1] << 8) | op[2]);
+      break;
+    case 0x93: // MOVC A,@A+DPTR
+      *acc = sim_code(sim_dptr() + *acc);
+      break;
+    case 0xA3: // INC DPTR
+      sim_setDptr(sim_dptr() + 1);
+      break;
+    case 0xA5: // software breakpoint
+      sim->halted = true;
+      sim->haltByBreak = true;
+      return;
+    case 0xC5: { // XCH A,direct
+      len = 2;
+      uint8_t v = sim_readDirect(op[1]);
+      sim_writeDirect(op[1], *acc);
+      *acc = v;
+      break;
+    }
+    case 0xE0: // MOVX A,@DPTR
+      *acc = sim_xread(sim_dptr());
+      break;
+    case 0xE4: // CLR A
+      *acc = 0;
+      break;
+    case 0xE5: // MOV A,direct
+      len = 2;
+      *acc = sim_readDirect(op[1]);
+      break;
+    case 0xF0: // MOVX @DPTR,A
+      sim_xwrite(sim_dptr(), *acc);
+      break;
+    case 0xF5: // MOV direct,A
+      len = 2;
+      sim_writeDirect(op[1], *acc);
+      break;
+    default:
+      if ((op[0] & 0xF8) == 0x78) {         // MOV Rn,#data
+        len = 2;
+        *sim_reg(op[0] & 7) = op[1];
+      } else if ((op[0] & 0xF8) == 0xD8) {  // DJNZ Rn,rel
+        len = 2;
+        if (--*sim_reg(op[0] & 7))
+          next += (int8_t)op[1];
+      } else if ((op[0] & 0xF8) == 0xE8) {  // MOV A,Rn
+        *acc = *sim_reg(op[0] & 7);
+      } else if ((op[0] & 0xF8) == 0xF8) {  // MOV Rn,A
+        *sim_reg(op[0] & 7) = *acc;
+      }
+      break;
+  }
+  if (running)
+    sim->pc = next + len;
+}
+
+/**
+ * Run from PC the instructions a running CPU had time for since the
+ * last look, until a breakpoint halts it
+ */
+static void sim_run()
+{
+  if (sim->halted) return;
+  uint64_t now = sim_now();
+  uint64_t ns = (SFR(SFR_CLKCONSTA) & 0x40) ? SIM_INSTR_NS : SIM_INSTR_NS / 2;
+  uint64_t n = (now - sim->runFrom) / ns;
+  if (n > SIM_RUN_LIMIT) {
+    n = SIM_RUN_LIMIT;
+    sim->runFrom = now;
+  } else
+    sim->runFrom += n * ns;
+  for (uint64_t i = 0; i < n && !sim->halted; i++) {
+    // hardware breakpoints, but not on the instruction resumed from
+    if (!sim->resumed) {
+      uint32_t phys = sim->pc < 0x8000 ? sim->pc
+		: ((SFR(SFR_FMAP) & 0x07) << 15) + (sim->pc & 0x7FFF);
+      for (int b = 0; b < 4; b++)
+        if (sim->breaks[b] == (phys | 0x80000000)) {
+          sim->halted = true;
+          sim->haltByBreak = true;
+        }
+      if (sim->halted) break;
+    }
+    uint8_t op[3] = { sim_code(sim->pc), sim_code(sim->pc+1), sim_code(sim->pc+2) };
+    sim_step(op, true);
+    sim->resumed = false;
+    sim_timerCycles(SIM_INSTR_CYCLES);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////
+////                       DMA / FLASH                           ////
+/////////////////////////////////////////////////////////////////////
+
+static uint16_t sim_dmaDesc( uint8_t ch )
+{
+  if (ch == 0)
+    return (SFR(SFR_DMA0CFGH) << 8) | SFR(SFR_DMA0CFGL);
+  return ((SFR(SFR_DMA1CFGH) << 8) | SFR(SFR_DMA1CFGL)) + (ch-1) * 8;
+}
+
+static int16_t sim_dmaInc( uint8_t mode )
+{
+  switch (mode & 3) {
+    case 0: return 0;
+    case 1: return 1;
+    case 2: return 2;
+  }
+  return -1;
+}
+
+/**
+ * One DMA transfer for channel ch; returns 1 when the block is complete
+ */
+static int sim_dmaTransfer( uint8_t ch, uint8_t fromDebug, uint8_t val )
+{
+  uint16_t d = sim_dmaDesc(ch);
+  uint16_t src = (sim_xread(d) << 8) | sim_xread(d+1);
+  uint16_t dst = (sim_xread(d+2) << 8) | sim_xread(d+3);
+  uint16_t len = ((sim_xread(d+4) & 0x1F) << 8) | sim_xread(d+5);
+  uint8_t flags = sim_xread(d+7);
+  uint16_t n = sim->dmaCount[ch];
+
+  if (!fromDebug)
+    val = sim_xread(src + n * sim_dmaInc(flags >> 6));
+  sim_xwrite(dst + n * sim_dmaInc(flags >> 4), val);
+
+  if (++sim->dmaCount[ch] < len)
+    return 0;
+  sim->dmaCount[ch] = 0;
+  SFR(SFR_DMAARM) &= ~(1 << ch);
+  SFR(SFR_DMAIRQ) |= (1 << ch);
+  return 1;
+}
+
+static int sim_dmaArmed( uint8_t ch, uint8_t trig )
+{
+  if (!(SFR(SFR_DMAARM) & (1 << ch))) return 0;
+  if (sim->halted && (sim->config & CFG_DMA_PAUSE)) return 0;
+  return (sim_xread(sim_dmaDesc(ch) + 6) & 0x1F) == trig;
+}
+
+/**
+ * Byte received by BURST_WRITE : goes to DBGDATA and triggers DMA
+ */
+static void sim_burstByte( uint8_t val )
+{
+  sim->xreg[X_DBGDATA - 0x6000] = val;
+  for (uint8_t ch = 0; ch < 5; ch++)
+    if (sim_dmaArmed(ch, TRIG_DBG_BW)) {
+      sim_dmaTransfer(ch, true, val);
+      return;
+    }
+}
+
+/**
+ * FCTL write : page erase or DMA driven flash write.
+ * The flash array changes at once, but the controller stays busy as long
+ * as the real one would (see sim_flashTick).
+ */
+static void sim_flashControl( uint8_t val )
+{
+  uint32_t addr = ((sim->xreg[X_FADDRH - 0x6000] << 8) | sim->xreg[X_FADDRL - 0x6000]) << 2;
+
+  if (val & 0x01) {
+    // page erase
+    memset(sim->flash + (addr & ~0x7FF), 0xFF, 2048);
+    sim->flashBusy = sim_now() + SIM_ERASE_NS;
+    val &= ~0x01;
+  }
+  if (val & 0x02) {
+    // FWDATA writes program flash from FADDR on
+    sim->flashWrite = true;
+    sim->flashAddr = addr;
+    for (uint8_t ch = 0; ch < 5; ch++)
+      if (sim_dmaArmed(ch, TRIG_FLASH)) {
+        int bytes = 0;
+        while (!sim_dmaTransfer(ch, false, 0))
+          bytes++;
+        // completion shows when the last word is written
+        SFR(SFR_DMAARM) |= 1 << ch;
+        SFR(SFR_DMAIRQ) &= ~(1 << ch);
+        sim->flashIrq = 1 << ch;
+        sim->flashBusy = sim_now() + (uint64_t)(bytes/4 + 1) * SIM_WORD_NS;
+        break;
+      }
+    sim->flashWrite = false;
+    val &= ~0x02;
+  }
+  sim->xreg[X_FCTL - 0x6000] = sim->flashBusy ? val | 0x80 : val & ~0x80;
+}
+
+static uint8_t sim_xread( uint16_t addr )
+{
+  if (addr < 0x2000) return sim->xram[addr];
+  if (addr == X_FCTL) sim_flashTick();
+  if (addr >= 0x6000 && addr < 0x6400) return sim->xreg[addr - 0x6000];
+  if (addr >= 0x7080 && addr < 0x7100) return sim_readDirect(addr - 0x7000);
+  if (addr >= 0x7800 && addr < 0x8000) return sim->info[addr - 0x7800];
+  if (addr >= 0x8000)
+    return sim->flash[((SFR(SFR_MEMCTR) & 0x07) << 15) + (addr & 0x7FFF)];
+  return 0;
+}
+
+static void sim_xwrite( uint16_t addr, uint8_t val )
+{
+  if (addr < 0x2000) {
+    sim->xram[addr] = val;
+  } else if (addr == X_FCTL) {
+    sim_flashControl(val);
+  } else if (addr == 0x6273) {
+    // FWDATA : flash bits can only be cleared
+    if (sim->flashWrite && sim->flashAddr < CCSIM_FLASH_SIZE)
+      sim->flash[sim->flashAddr++] &= val;
+  } else if (addr >= 0x6000 && addr < 0x6400) {
+    sim->xreg[addr - 0x6000] = val;
+  } else if (addr >= 0x7080 && addr < 0x7100) {
+    sim_writeDirect(addr - 0x7000, val);
+  }
+  // info page and flash window are read-only
+}
+
+/////////////////////////////////////////////////////////////////////
+////                        DEBUG PORT                           ////
+/////////////////////////////////////////////////////////////////////
+
+static uint8_t sim_status()
+{
+  uint8_t st = ST_OSC_STABLE;
+  sim_flashTick();
+  if (sim->chipErase) st |= ST_CHIP_ERASE_BUSY;
+  if (sim->halted) st |= ST_CPU_HALTED;
+  if (sim->haltByBreak) st |= ST_HALT_STATUS;
+  return st;
+}
+
+static void sim_respond( uint8_t len, uint8_t b0, uint8_t b1 )
+{
+  sim->resp[0] = b0;
+  sim->resp[1] = b1;
+  sim->respLen = len;
+  sim->respPos = 0;
+  sim->respBit = 0;
+  sim->ddTarget = sim->busy ? 1 : 0;
+}
+
+/**
+ * Number of bytes making up the command starting with b
+ */
+static uint8_t sim_cmdLength( uint8_t b )
+{
+  if ((b & 0xFC) == 0x50) return 1 + (b & 3);  // DEBUG_INSTR
+  switch (b & 0xF8) {
+    case 0x18: return 2;                        // WR_CONFIG
+    case 0x38: return 4;                        // SET_HW_BRKPNT
+    case 0x80: return 2;                        // BURST_WRITE header
+  }
+  return 1;
+}
+
+static void sim_command()
+{
+  uint8_t c = sim->cmd[0];
+
+  // catch up with the running CPU before answering
+  sim_run();
+
+  if ((c & 0xFC) == 0x50 && (c & 3)) {
+    sim_step(sim->cmd + 1, false);
+    sim_respond(1, SFR(SFR_ACC), 0);
+    return;
+  }
+  switch (c & 0xF8) {
+    case 0x10: // CHIP_ERASE
+      memset(sim->flash, 0xFF, sizeof(sim->flash));
+      sim->flashBusy = sim_now() + SIM_ERASE_NS;
+      sim->chipErase = true;
+      sim_respond(1, sim_status(), 0);
+      break;
+    case 0x18: // WR_CONFIG
+      sim->config = sim->cmd[1];
+      sim_respond(1, sim_status(), 0);
+      break;
+    case 0x20: // RD_CONFIG
+      sim_respond(1, sim->config, 0);
+      break;
+    case 0x28: // GET_PC
+      sim_respond(2, sim->pc >> 8, sim->pc & 0xFF);
+      break;
+    case 0x30: // READ_STATUS
+      sim_respond(1, sim_status(), 0);
+      break;
+    case 0x38: { // SET_HW_BRKPNT : number, enable, address 17:16, address 15:0
+      uint8_t b = (sim->cmd[1] >> 3) & 3;
+      uint32_t addr = ((sim->cmd[1] & 3) << 16) | (sim->cmd[2] << 8) | sim->cmd[3];
+      sim->breaks[b] = (sim->cmd[1] & 0x04) ? addr | 0x80000000 : 0;
+      sim_respond(1, sim_status(), 0);
+      break;
+    }
+    case 0x40: // HALT
+      sim->haltByBreak = false;
+      sim->halted = true;
+      sim_respond(1, sim_status(), 0);
+      break;
+    case 0x48: // RESUME
+      sim->halted = false;
+      sim->runFrom = sim_now();
+      sim->resumed = true;
+      sim_respond(1, sim_status(), 0);
+      break;
+    case 0x58: { // STEP_INSTR
+      uint8_t op[3] = { sim_code(sim->pc), sim_code(sim->pc+1), sim_code(sim->pc+2) };
+      sim_step(op, true);
+      sim_respond(1, SFR(SFR_ACC), 0);
+      break;
+    }
+    case 0x68: // GET_CHIP_ID
+      sim_respond(2, CCSIM_CHIP_ID >> 8, CCSIM_CHIP_ID & 0xFF);
+      break;
+    case 0x80: // BURST_WRITE
+      // 11 bit length, 0 stands for 2048
+      sim->burstLen = ((c & 0x07) << 8) | sim->cmd[1];
+      if (!sim->burstLen) sim->burstLen = 2048;
+      sim->burstCount = 0;
+      sim->inBurst = true;
+      break;
+    default:
+      sim_respond(1, sim_status(), 0);
+      break;
+  }
+}
+
+static void sim_byteIn( uint8_t b )
+{
+  if (sim->inBurst) {
+    sim_burstByte(b);
+    if (++sim->burstCount == sim->burstLen) {
+      sim->inBurst = false;
+      sim_respond(1, sim_status(), 0);
+    }
+    return;
+  }
+  sim->cmd[sim->cmdLen++] = b;
+  if (sim->cmdLen == 1)
+    sim->cmdNeed = sim_cmdLength(b);
+  if (sim->cmdLen < sim->cmdNeed)
+    return;
+  sim->cmdLen = 0;
+  sim_command();
+}
+
+static void sim_clockEdge()
+{
+  // two DC pulses while RST is low request debug mode
+  if (!sim->rst) {
+    sim->entryEdges++;
+    return;
+  }
+  if (!sim->debug) return;
+
+  if (sim->ddOutput) {
+    sim->shift = (sim->shift << 1) | sim->ddHost;
+    if (++sim->bits == 8) {
+      sim->bits = 0;
+      sim_byteIn(sim->shift);
+    }
+    return;
+  }
+
+  // target drives DD
+  if (sim->busy) {
+    sim->ddTarget = (--sim->busy) ? 1 : 0;
+    return;
+  }
+  if (sim->respPos < sim->respLen) {
+    sim->ddTarget = (sim->resp[sim->respPos] >> (7 - sim->respBit)) & 1;
+    if (++sim->respBit == 8) {
+      sim->respBit = 0;
+      sim->respPos++;
+    }
+  }
+}
+
+/////////////////////////////////////////////////////////////////////
+////                         INTERFACE                           ////
+/////////////////////////////////////////////////////////////////////
+
+void ccsim_init()
+{
+  static int chips = 0;
+  memset(sim, 0, sizeof(*sim));
+  memset(sim->flash, 0xFF, sizeof(sim->flash));
+  memset(sim->info, 0xFF, sizeof(sim->info));
+  // IEEE address in the info page, least significant byte first
+  // (one more for each simulated chip)
+  static const uint8_t ieee[8] = { 0x11, 0x22, 0x33, 0x44, 0x00, 0x4B, 0x12, 0x00 };
+  memcpy(sim->info + 0x0C, ieee, 8);
+  sim->info[0x0C] += __atomic_fetch_add(&chips, 1, __ATOMIC_RELAXED);
+  // a CC2531F256 : 256 KB flash, USB
+  sim->xreg[X_CHIPINFO0 - 0x6000] = 0x48;
+  sim_reset();
+}
+
+struct ccsim *ccsim_new()
+{
+  struct ccsim *s = malloc(sizeof(struct ccsim));
+  if (!s) return NULL;
+  sim = s;
+  ccsim_init();
+  return s;
+}
+
+void ccsim_select( struct ccsim *s )
+{
+  sim = s;
+}
+
+void ccsim_pinWrite( uint8_t line, int value )
+{
+  value = value ? 1 : 0;
+  switch (line) {
+    case CC_LINE_RST:
+      if (!value && sim->rst) {
+        // reset asserted
+        sim_reset();
+        sim->debug = false;
+        sim->entryEdges = 0;
+      } else if (value && !sim->rst && sim->entryEdges >= 2) {
+        // reset released after the debug entry sequence
+        sim->debug = true;
+        sim->halted = true;
+        sim->cmdLen = 0;
+        sim->inBurst = false;
+      }
+      sim->rst = value;
+      break;
+    case CC_LINE_DC:
+      if (value && !sim->dc)
+        sim_clockEdge();
+      sim->dc = value;
+      break;
+    case CC_LINE_DD:
+      sim->ddHost = value;
+      break;
+  }
+}
+
+int ccsim_pinRead()
+{
+  return sim->ddOutput ? sim->ddHost : sim->ddTarget;
+}
+
+void ccsim_ddDirection( uint8_t output )
+{
+  sim->ddOutput = output;
+  if (output) {
+    // host takes the bus back : drop any unread response
+    sim->respLen = 0;
+    sim->bits = 0;
+  }
+}
+
+uint8_t *ccsim_flash()
+{
+  return sim->flash;
+}
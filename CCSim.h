@@ -0,0 +1,55 @@
+
+#ifndef CCSIM_H
+#define CCSIM_H
+
+#include <stdint.h>
+
+// Identity reported by the simulated target (CC2531F256, rev 0x24)
+#define CCSIM_CHIP_ID     0xB524
+#define CCSIM_FLASH_SIZE  (256*1024)
+
+  /**
+   * Power-on the selected simulated CC2531 : flash erased, reset line
+   * held low. Each chip gets its own IEEE address.
+   */
+  void ccsim_init();
+
+  /**
+   * One more simulated chip, powered on and selected
+   */
+  struct ccsim *ccsim_new();
+
+  /**
+   * Chip driven by the pins below, in the calling thread
+   */
+  void ccsim_select( struct ccsim *s );
+
+  ////////////////////////////
+  // Pin level interface, driven by CCDebugger.c
+  ////////////////////////////
+
+  /**
+   * Host drives RST, DC or DD (CC_LINE_* from CCDebugger.h)
+   */
+  void ccsim_pinWrite( uint8_t line, int value );
+
+  /**
+   * Host samples DD
+   */
+  int ccsim_pinRead();
+
+  /**
+   * Host switches DD direction (1 = host drives DD)
+   */
+  void ccsim_ddDirection( uint8_t output );
+
+  ////////////////////////////
+  // Back door, for tests and benchmarks
+  ////////////////////////////
+
+  /**
+   * Direct access to the simulated flash array
+   */
+  uint8_t *ccsim_flash();
+
+#endif
@@ -0,0 +1,143 @@
+/***********************************************************************
+    VCD waveform capture of the debug bus.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+/*
+ * Events are stored raw in memory and only formatted when the buffer is
+ * flushed, so recording adds a clock_gettime() and a store per event.
+ * The output opens in GTKWave and in sigrok/PulseView (VCD import).
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "CCTrace.h"
+#include "CCLog.h"
+
+#define TRACE_SIGNALS  7
+#define TRACE_BUFFER   65536
+
+struct traceEvent
+{
+  uint64_t t;
+  uint8_t signal, value;
+};
+
+uint8_t cc_tracing=0;
+
+static FILE *traceFile;
+static struct traceEvent *events;
+static int nbEvents;
+static uint64_t t0;
+static uint8_t sampleToggle;
+
+static const char ids[TRACE_SIGNALS] = { 'r', 'c', 'd', 'o', 'i', 's', 'w' };
+static const char *names[TRACE_SIGNALS] = { "rst", "dc", "dd", "dd_out", "dd_in", "dd_sample", "wait" };
+
+static uint64_t trace_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void trace_flush()
+{
+  uint64_t last = UINT64_MAX;
+  for (int i = 0; i < nbEvents; i++) {
+    if (events[i].t != last) {
+      fprintf(traceFile, "#%llu\n", (unsigned long long)events[i].t);
+      last = events[i].t;
+    }
+    fprintf(traceFile, "%c%c\n", events[i].value ? '1' : '0', ids[events[i].signal]);
+  }
+  nbEvents = 0;
+}
+
+int cc_traceOpen( const char *path )
+{
+  if (cc_tracing) cc_traceClose();
+
+  traceFile = fopen(path, "w");
+  if (!traceFile) {
+    LOG_ERR("can't open trace file %s", path);
+    return -1;
+  }
+  events = malloc(TRACE_BUFFER * sizeof(struct traceEvent));
+  if (!events) {
+    fclose(traceFile);
+    return -1;
+  }
+  nbEvents = 0;
+  sampleToggle = 0;
+  t0 = trace_now();
+
+  time_t now = time(NULL);
+  fprintf(traceFile, "$date %s$end\n", ctime(&now));
+  fprintf(traceFile, "$version flash_cc2531 debug bus trace $end\n");
+  fprintf(traceFile, "$timescale 1ns $end\n");
+  fprintf(traceFile, "$scope module cc_debug $end\n");
+  for (int i = 0; i < TRACE_SIGNALS; i++)
+    fprintf(traceFile, "$var wire 1 %c %s $end\n", ids[i], names[i]);
+  fprintf(traceFile, "$upscope $end\n$enddefinitions $end\n");
+  fprintf(traceFile, "#0\n$dumpvars\n");
+  for (int i = 0; i < TRACE_SIGNALS; i++)
+    fprintf(traceFile, "x%c\n", ids[i]);
+  fprintf(traceFile, "$end\n");
+
+  static int registered;
+  if (!registered) {
+    // tools may leave through exit() on errors
+    atexit(cc_traceClose);
+    registered = 1;
+  }
+  cc_tracing = 1;
+  return 0;
+}
+
+void cc_traceClose()
+{
+  if (!cc_tracing) return;
+  cc_tracing = 0;
+  trace_flush();
+  fprintf(traceFile, "#%llu\n", (unsigned long long)(trace_now() - t0));
+  fclose(traceFile);
+  free(events);
+  events = NULL;
+}
+
+void cc_traceEvent( uint8_t signal, uint8_t value )
+{
+  uint64_t t = trace_now() - t0;
+
+  if (nbEvents + 2 > TRACE_BUFFER)
+    trace_flush();
+  events[nbEvents].t = t;
+  events[nbEvents].signal = signal;
+  events[nbEvents].value = value;
+  nbEvents++;
+  // a sample also toggles the strobe, so equal samples stay visible
+  if (signal == CC_TRACE_DD_IN) {
+    sampleToggle ^= 1;
+    events[nbEvents].t = t;
+    events[nbEvents].signal = CC_TRACE_SAMPLE;
+    events[nbEvents].value = sampleToggle;
+    nbEvents++;
+  }
+}
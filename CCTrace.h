@@ -0,0 +1,39 @@
+
+#ifndef CCTRACE_H
+#define CCTRACE_H
+
+#include <stdint.h>
+
+// Traced signals (RST, DC and DD share the CC_LINE_* numbers)
+#define CC_TRACE_RST      0   // reset line
+#define CC_TRACE_DC       1   // debug clock
+#define CC_TRACE_DD       2   // DD as driven by the host
+#define CC_TRACE_DD_DIR   3   // 1 when the host drives DD
+#define CC_TRACE_DD_IN    4   // last DD sample
+#define CC_TRACE_SAMPLE   5   // toggles on every DD sample
+#define CC_TRACE_WAIT     6   // 1 while cc_switchRead waits for the target
+
+  /**
+   * Non zero while a trace is recorded; tested before every trace call
+   * so tracing costs a single branch when disabled.
+   * One target only is traced (ccTarget.traced) : the trace isn't locked.
+   */
+  extern uint8_t cc_tracing;
+
+  /**
+   * Start recording a VCD trace to <path>.
+   * cc_init() calls it when the CC_TRACE environment variable is set.
+   */
+  int cc_traceOpen( const char *path );
+
+  /**
+   * Flush and close the trace
+   */
+  void cc_traceClose();
+
+  /**
+   * Record a signal value, timestamped with CLOCK_MONOTONIC
+   */
+  void cc_traceEvent( uint8_t signal, uint8_t value );
+
+#endif
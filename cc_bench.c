@@ -0,0 +1,370 @@
+/***********************************************************************
+    Debug transport benchmarks.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+/*
+ * Every result is printed as one JSON object per line :
+ *   {"bench":"exec1","value":..,"unit":"us/op","n":..,"target":"sim","tag":".."}
+ * so runs on different commits can be compared with jq or a spreadsheet.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "CCDebugger.h"
+#include "CCRealtime.h"
+#include "CCLog.h"
+#include "CCFlash.h"
+#include "CCRegs.h"
+
+// raw debug commands of the default instruction table
+#define CMD_GET_PC       0x28
+#define CMD_READ_STATUS  0x30
+#define CMD_BURST_WRITE  0x80
+
+FILE *out;
+char *chipName="sim";
+char *tag="";
+
+double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void result(const char *bench, double value, const char *unit, long n)
+{
+  fprintf(out,"{\"bench\":\"%s\",\"value\":%.3f,\"unit\":\"%s\",\"n\":%ld,\"target\":\"%s\",\"tag\":\"%s\"}\n"
+	,bench,value,unit,n,chipName,tag);
+  fflush(out);
+}
+
+/**
+ * DC toggles while the target drives DD (no command in progress)
+ */
+void benchGpio(long n)
+{
+  cc_write(CMD_READ_STATUS);
+  cc_switchRead(250);
+  cc_read();
+  double t=now();
+  for(long i=0 ; i<n ; i++)
+    cc_clock(1);
+  t=now()-t;
+  cc_switchWrite();
+  result("gpio_toggle",2*n/t,"toggles/s",n);
+}
+
+/**
+ * cc_write byte rate, through a BURST_WRITE with no DMA channel armed
+ */
+void benchWrite(long n)
+{
+  double t=0;
+  long bytes=0;
+  while(bytes<n)
+  {
+    int len = (n-bytes) > 1024 ? 1024 : (n-bytes);
+    cc_write(CMD_BURST_WRITE|((len>>8)&0x7));
+    cc_write(len&0xff);
+    double t0=now();
+    for(int i=0 ; i<len ; i++)
+      cc_write(i&0xff);
+    t+=now()-t0;
+    cc_switchRead(250);
+    cc_read();
+    cc_switchWrite();
+    bytes+=len;
+  }
+  result("cc_write",bytes/t,"bytes/s",bytes);
+}
+
+/**
+ * cc_read byte rate, on GET_PC answers
+ */
+void benchRead(long n)
+{
+  double t=0;
+  for(long i=0 ; i<n ; i+=2)
+  {
+    cc_write(CMD_GET_PC);
+    cc_switchRead(250);
+    double t0=now();
+    cc_read();
+    cc_read();
+    t+=now()-t0;
+    cc_switchWrite();
+  }
+  result("cc_read",n/t,"bytes/s",n);
+}
+
+void benchExec(long n)
+{
+  double t=now();
+  for(long i=0 ; i<n ; i++)
+    cc_exec(0x00); // NOP
+  result("exec1",(now()-t)*1e6/n,"us/op",n);
+
+  t=now();
+  for(long i=0 ; i<n ; i++)
+    cc_exec2(0x74,i&0xff); // MOV A,#data
+  result("exec2",(now()-t)*1e6/n,"us/op",n);
+
+  t=now();
+  for(long i=0 ; i<n ; i++)
+    cc_exec3(0x75,0xF0,i&0xff); // MOV B,#data
+  result("exec3",(now()-t)*1e6/n,"us/op",n);
+
+  t=now();
+  for(long i=0 ; i<n ; i++)
+    cc_execi(0x90,i&0xffff); // MOV DPTR,#data16
+  result("execi",(now()-t)*1e6/n,"us/op",n);
+  // A, B and DPTR changed behind the register shadow
+  cc_regsReset();
+}
+
+/**
+ * XDATA throughput, in target SRAM
+ */
+void benchXDATA(int len)
+{
+  uint8_t *w=malloc(len), *r=malloc(len);
+  for(int i=0 ; i<len ; i++) w[i]=rand();
+
+  double t=now();
+  writeXDATA(0x0000,w,len);
+  result("xdata_write",len/(now()-t),"bytes/s",len);
+
+  t=now();
+  readXDATA(0x0000,r,len);
+  result("xdata_read",len/(now()-t),"bytes/s",len);
+
+  result("xdata_errors",memcmp(w,r,len)?1:0,"count",len);
+  free(w);
+  free(r);
+}
+
+/**
+ * Full page erase, write and verify
+ */
+void benchPage(int page)
+{
+  static uint8_t datas[FLASH_PAGE_SIZE];
+  struct page p;
+  p.datas=datas;
+  p.hasCrc=0;
+  p.minoffset=0;
+  p.maxoffset=FLASH_PAGE_SIZE-1;
+  for(int i=0 ; i<FLASH_PAGE_SIZE ; i++) p.datas[i]=rand();
+
+  // activer DMA
+  uint8_t conf=cc_getConfig();
+  conf &= ~0x4;
+  cc_setConfig(conf);
+
+  double t=now();
+  erasePage(page);
+  result("page_erase",(now()-t)*1e3,"ms",1);
+
+  t=now();
+  writePage(page,&p);
+  result("page_write",(now()-t)*1e3,"ms",FLASH_PAGE_SIZE);
+
+  t=now();
+  int bad=verifPage(page,&p);
+  result("page_verify",(now()-t)*1e3,"ms",FLASH_PAGE_SIZE);
+  result("page_errors",bad,"count",1);
+  result("regs_saved",cc_regsSaved(),"commands",0);
+}
+
+/**
+ * Page erase on <count> more simulated targets, one after the other, then
+ * interleaved by one thread stepping every erase in turn
+ */
+void benchInterleave(int page,int count)
+{
+  struct ccTarget *main=cc_current();
+  struct ccTarget *targets[count];
+  struct flashOp ops[count];
+  for(int i=0 ; i<count ; i++)
+  {
+    targets[i]=cc_open("sim",-1,-1,-1);
+    if(!targets[i]) exit(1);
+    cc_enter();
+    cc_setConfig(cc_getConfig() & ~0x4);
+    // warm up the register shadow
+    erasePage(page);
+  }
+
+  double t=now();
+  for(int i=0 ; i<count ; i++)
+  {
+    cc_select(targets[i]);
+    erasePage(page);
+  }
+  result("erase_sequential",(now()-t)*1e3,"ms",count);
+
+  t=now();
+  for(int i=0 ; i<count ; i++)
+  {
+    cc_select(targets[i]);
+    flash_start(&ops[i],FLASH_ERASE,page,NULL);
+  }
+  int busy=count;
+  uint8_t done[count];
+  for(int i=0 ; i<count ; i++) done[i]=0;
+  while(busy)
+  {
+    // step every target whose deadline has come, then sleep until the next one
+    uint64_t next=UINT64_MAX;
+    for(int i=0 ; i<count ; i++)
+    {
+      if(done[i]) continue;
+      if(ops[i].deadline<=flash_now() && flash_step(&ops[i])==FLASH_DONE)
+      {
+        done[i]=1;
+        busy--;
+        continue;
+      }
+      if(ops[i].deadline<next) next=ops[i].deadline;
+    }
+    uint64_t tnow=flash_now();
+    if(busy && next>tnow)
+    {
+      struct timespec ts={ (next-tnow)/1000000000, (next-tnow)%1000000000 };
+      nanosleep(&ts,NULL);
+    }
+  }
+  result("erase_interleaved",(now()-t)*1e3,"ms",count);
+  cc_select(main);
+}
+
+void helpo()
+{
+  fprintf(stderr,"usage : cc_bench [-v] [-q] [--realtime[=cpu]] [-g gpiochip] [-d pin_DD] [-c pin_DC] [-r pin_reset] [-n count] [-t tag] [-o file] [-w page]\n");
+  fprintf(stderr,"	-g : gpiochip name, or sim (default sim)\n");
+  fprintf(stderr,"	-c : change pin_DC (default " PIN_STR(PIN_DC) ")\n");
+  fprintf(stderr,"	-d : change pin_DD (default " PIN_STR(PIN_DD) ")\n");
+  fprintf(stderr,"	-r : change reset pin (default " PIN_STR(PIN_RST) ")\n");
+  fprintf(stderr,"	-v : more messages (repeat for debug, trace)\n");
+  fprintf(stderr,"	-q : quiet, no progress\n");
+  fprintf(stderr,"	--realtime[=cpu] : lock memory, pin to cpu and run SCHED_FIFO\n");
+  fprintf(stderr,"	-n : operations per benchmark (default 200)\n");
+  fprintf(stderr,"	-t : tag copied in every result (commit, board...)\n");
+  fprintf(stderr,"	-o : write results to file (default stdout)\n");
+  fprintf(stderr,"	-w : page used by the flash benchmark (ERASED !)\n");
+  fprintf(stderr,"	     required on a real target, page 127 on sim\n");
+}
+
+int main(int argc,char *argv[])
+{
+  int opt;
+  int realtime=0;
+  int rtCpu=-1;
+  static struct option longopts[] =
+  {
+    { "realtime", optional_argument, NULL, 'R' },
+    { NULL, 0, NULL, 0 }
+  };
+  int rePin=-1;
+  int dcPin=-1;
+  int ddPin=-1;
+  long n=200;
+  int page=-1;
+  out=stdout;
+  cc_logInit();
+  while( (opt=getopt_long(argc,argv,"g:d:c:r:n:t:o:w:vqh?",longopts,NULL)) != -1)
+  {
+    switch(opt)
+    {
+     case 'g' : // gpiochip
+      chipName=optarg;
+      break;
+     case 'd' : // DD pinglo
+      ddPin=atoi(optarg);
+      break;
+     case 'c' : // DC pinglo
+      dcPin=atoi(optarg);
+      break;
+     case 'r' : // restarigi pinglo
+      rePin=atoi(optarg);
+      break;
+     case 'n' :
+      n=atol(optarg);
+      if(n<2) n=2;
+      break;
+     case 't' :
+      tag=optarg;
+      break;
+     case 'o' :
+      out=fopen(optarg,"w");
+      if(!out) { fprintf(stderr," Can't open file %s.\n",optarg); exit(1); }
+      break;
+     case 'w' :
+      page=atoi(optarg);
+      if(page<0 || page>=FLASH_PAGES) { fprintf(stderr," incorrect page %s.\n",optarg); exit(1); }
+      break;
+     case 'v' : // verbose
+      cc_logVerbosity(1);
+      break;
+     case 'q' : // quiet
+      cc_logVerbosity(-1);
+      break;
+     case 'R' : // realtime
+      realtime=1;
+      if(optarg) rtCpu=atoi(optarg);
+      break;
+     case 'h' : // helpo
+     case '?' : // helpo
+      helpo();
+      exit(0);
+      break;
+    }
+  }
+  if(page<0 && !strcmp(chipName,"sim")) page=FLASH_PAGES-1;
+
+  // initialize GPIO and debugger
+  if(cc_init(chipName,rePin,dcPin,ddPin)<0) exit(1);
+  if(realtime) cc_realtime(rtCpu);
+  // enter debug mode
+  cc_enter();
+  uint16_t ID = cc_getChipID();
+  if(cc_error()) { fprintf(stderr," no answer from target.\n"); exit(1); }
+  LOG_INFO("ID = %04x.",ID);
+  srand(1);
+
+  benchWrite(n*8);
+  benchRead(n*2);
+  benchExec(n);
+  benchXDATA(n*2);
+  if(page>=0)
+    benchPage(page);
+  if(page>=0 && !strcmp(chipName,"sim"))
+    benchInterleave(page,4);
+  benchGpio(n*8);
+
+  if(realtime) result("rt_overruns",cc_rtOverruns(),"count",0);
+  cc_setActive(false);
+  if(out!=stdout) fclose(out);
+  return 0;
+}
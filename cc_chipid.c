@@ -26,26 +26,43 @@
 #include <gpiod.h>
 #include <limits.h>
 #include "CCDebugger.h"
+#include "CCRealtime.h"
+#include "CCLog.h"
+#include "CCFlash.h"
 
 void helpo()
 {
-  fprintf(stderr,"usage : cc_chipid [-d pin_DD] [-c pin_DC] [-r pin_reset] <chip name>\n"); 
-  fprintf(stderr,"	-c : change pin_DC (default 27)\n");
-  fprintf(stderr,"	-d : change pin_DD (default 28)\n");
-  fprintf(stderr,"	-r : change reset pin (default 24)\n");
+  fprintf(stderr,"usage : cc_chipid [-v] [-q] [--realtime[=cpu]] [-a] [-d pin_DD] [-c pin_DC] [-r pin_reset] [chip name]\n"); 
+  fprintf(stderr,"	-c : change pin_DC (default " PIN_STR(PIN_DC) ")\n");
+  fprintf(stderr,"	-d : change pin_DD (default " PIN_STR(PIN_DD) ")\n");
+  fprintf(stderr,"	-r : change reset pin (default " PIN_STR(PIN_RST) ")\n");
+  fprintf(stderr,"	-v : more messages (repeat for debug, trace)\n");
+  fprintf(stderr,"	-q : quiet, no progress\n");
+  fprintf(stderr,"	--realtime[=cpu] : lock memory, pin to cpu and run SCHED_FIFO\n");
+  fprintf(stderr,"	-a, --attach : join the debug session left by a previous command, without resetting the chip\n");
 }
 
 int main(int argc,char *argv[])
 {
   
   int opt;
+  int realtime=0;
+  int attach=0;
+  int rtCpu=-1;
+  static struct option longopts[] =
+  {
+    { "realtime", optional_argument, NULL, 'R' },
+    { "attach", no_argument, NULL, 'a' },
+    { NULL, 0, NULL, 0 }
+  };
   int rePin=-1;
   int dcPin=-1;
   int ddPin=-1;
  
   char *name;
 
-  while( (opt=getopt(argc,argv,"d:c:r:h?")) != -1)
+  cc_logInit();
+  while( (opt=getopt_long(argc,argv,"d:c:r:avqh?",longopts,NULL)) != -1)
   {
     switch(opt)
     {
@@ -58,6 +75,19 @@ int main(int argc,char *argv[])
      case 'r' : // restarigi pinglo
       rePin=atoi(optarg);
       break;
+     case 'v' : // verbose
+      cc_logVerbosity(1);
+      break;
+     case 'q' : // quiet
+      cc_logVerbosity(-1);
+      break;
+     case 'a' : // attach
+      attach=1;
+      break;
+     case 'R' : // realtime
+      realtime=1;
+      if(optarg) rtCpu=atoi(optarg);
+      break;
      case 'h' : // helpo
      case '?' : // helpo
       helpo();
@@ -69,15 +99,31 @@ int main(int argc,char *argv[])
   argc -= optind;
   argv += optind;
 
-  name = argv[0];
+  name = argc > 0 ? argv[0] : GPIOCHIP;
     
   // initialize GPIO and debugger
   cc_init(name, rePin, dcPin, ddPin);
-  // enter debug mode
-  cc_enter();
+  if(realtime) cc_realtime(rtCpu);
+  // enter debug mode, or join the running session
+  if(attach)
+  {
+    if(cc_attach())
+    {
+      fprintf(stderr," not in debug mode : run without --attach (resets the chip).\n");
+      cc_setActive(false);
+      exit(1);
+    }
+  }
+  else
+    cc_enter();
   // get ChipID :
   uint16_t res;
   res = cc_getChipID();
   printf("  ID = %04x.\n",res);
+  uint8_t ieee[8];
+  readIEEE(ieee);
+  LOG_INFO("IEEE = %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x.",
+	ieee[7],ieee[6],ieee[5],ieee[4],ieee[3],ieee[2],ieee[1],ieee[0]);
+  if(realtime) printf("  %lu deadline overruns.\n",cc_rtOverruns());
   cc_setActive(false);
 }
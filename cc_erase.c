@@ -14,34 +14,55 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 *************************************************************************/
 
-#include <wiringPi.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <getopt.h>
 
 #include "CCDebugger.h"
+#include "CCRealtime.h"
+#include "CCLog.h"
 
 void helpo()
 {
-  fprintf(stderr,"usage : cc_erase [-d pin_DD] [-c pin_DC] [-r pin_reset]\n"); 
-  fprintf(stderr,"	-c : change pin_DC (default 27)\n");
-  fprintf(stderr,"	-d : change pin_DD (default 28)\n");
-  fprintf(stderr,"	-r : change reset pin (default 24)\n");
+  fprintf(stderr,"usage : cc_erase [-v] [-q] [--realtime[=cpu]] [--xosc] [-g gpiochip] [-d pin_DD] [-c pin_DC] [-r pin_reset]\n"); 
+  fprintf(stderr,"	-g : gpiochip name, or sim (default " GPIOCHIP ")\n");
+  fprintf(stderr,"	-c : change pin_DC (default " PIN_STR(PIN_DC) ")\n");
+  fprintf(stderr,"	-d : change pin_DD (default " PIN_STR(PIN_DD) ")\n");
+  fprintf(stderr,"	-r : change reset pin (default " PIN_STR(PIN_RST) ")\n");
+  fprintf(stderr,"	-v : more messages (repeat for debug, trace)\n");
+  fprintf(stderr,"	-q : quiet, no progress\n");
+  fprintf(stderr,"	--realtime[=cpu] : lock memory, pin to cpu and run SCHED_FIFO\n");
+  fprintf(stderr,"	--xosc : run the target on its 32 MHz crystal while debugging\n");
 }
 
 int main(int argc,char *argv[])
 {
   int opt;
+  int realtime=0;
+  int xosc=0;
+  int rtCpu=-1;
+  static struct option longopts[] =
+  {
+    { "realtime", optional_argument, NULL, 'R' },
+    { "xosc", no_argument, NULL, 'X' },
+    { NULL, 0, NULL, 0 }
+  };
   int rePin=-1;
   int dcPin=-1;
   int ddPin=-1;
-  while( (opt=getopt(argc,argv,"d:c:r:h?")) != -1)
+  char *chipName=GPIOCHIP;
+  cc_logInit();
+  while( (opt=getopt_long(argc,argv,"g:d:c:r:vqh?",longopts,NULL)) != -1)
   {
     switch(opt)
     {
+     case 'g' : // gpiochip
+      chipName=optarg;
+      break;
      case 'd' : // DD pinglo
       ddPin=atoi(optarg);
       break;
@@ -51,6 +72,19 @@ int main(int argc,char *argv[])
      case 'r' : // restarigi pinglo
       rePin=atoi(optarg);
       break;
+     case 'v' : // verbose
+      cc_logVerbosity(1);
+      break;
+     case 'q' : // quiet
+      cc_logVerbosity(-1);
+      break;
+     case 'X' : // 32 MHz crystal
+      xosc=1;
+      break;
+     case 'R' : // realtime
+      realtime=1;
+      if(optarg) rtCpu=atoi(optarg);
+      break;
      case 'h' : // helpo
      case '?' : // helpo
       helpo();
@@ -59,16 +93,19 @@ int main(int argc,char *argv[])
     }
   }
   // initialize GPIO and debugger
-  cc_init(rePin,dcPin,ddPin);
+  cc_init(chipName,rePin,dcPin,ddPin);
+  if(realtime) cc_realtime(rtCpu);
+  cc_useXOSC(xosc);
   // enter debug mode
   cc_enter();
   // get ChipID :
   uint16_t res;
   res = cc_getChipID();
-  printf("  ID = %04x.\n",res);
+  LOG_INFO("ID = %04x.",res);
   // erase flash
   res = cc_chipErase();
   printf("  erase result = %04x.\n",res);
+  if(realtime) printf("  %lu deadline overruns.\n",cc_rtOverruns());
   cc_setActive(false);
 
 }
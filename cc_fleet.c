@@ -0,0 +1,675 @@
+/***********************************************************************
+    Programming fleet : many targets, one job queue.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+/*
+ * The inventory (CCInventory.h) lists one target per line :
+ *   station name gpiochip pin_reset pin_DC pin_DD
+ * ('#' starts a comment, gpiochip "sim" gives a simulated dongle).
+ * Each station gets a worker thread, which steps all its targets in turn
+ * (see flash_step in CCFlash.h). Jobs are dealt to the workers' queues;
+ * a worker whose queue is empty steals from the others.
+ * A target that fails waits longer and longer before its next job, and
+ * is set aside after MAX_FAILS failures in a row; a target much slower
+ * than the best one waits a little before taking a job, so that faster
+ * ones get it first.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "CCDebugger.h"
+#include "CCLog.h"
+#include "CCInventory.h"
+#include "CCFlash.h"
+#include "CCImage.h"
+#include "CCRegs.h"
+
+#define MAX_FAILS      3          // failures in a row before a target is set aside
+#define MAX_TRIES      2          // targets a failed job is tried on
+#define BACKOFF_NS     1000000000ULL
+#define SLOW_RATIO     2          // this many times slower than the best is slow
+#define SLOW_DELAY_NS  500000000ULL
+#define IDLE_NS        10000000ULL
+
+#define JOB_ERASE   0
+#define JOB_WRITE   1
+#define JOB_VERIFY  2
+#define JOB_READ    3
+
+const char *jobNames[] = { "erase", "write", "verify", "read" };
+
+/**
+ * A job runs its steps in a row on the same dongle (erase+write=fw.hex)
+ */
+#define MAX_STEPS   4
+
+struct target;
+
+struct job
+{
+  int id;
+  const char *spec;
+  int nbSteps;
+  int kinds[MAX_STEPS];
+  const char *args[MAX_STEPS];  // image, or output file pattern for read
+  struct image *imgs[MAX_STEPS];
+  int tries;
+  struct target *failedOn;      // last target the job failed on
+};
+
+struct target
+{
+  const struct invTarget *inv;
+  struct ccTarget *cc;
+  // job in progress
+  struct job *job;
+  int step;
+  int page;
+  struct page cur;        // page of the image, private copy
+  struct flashOp op;
+  int opRunning;
+  struct imageOut out;
+  uint64_t start;
+  uint64_t ready;         // next step, or next job
+  int waitedSlow;
+  // accounting (statsLock) : written under the lock by the owning worker,
+  // the only one to read them without it
+  int done,failed,fails;
+  uint64_t bytes;         // written, verified or read
+  uint64_t busyNs;        // time spent on jobs
+  uint8_t disabled;
+};
+
+/**
+ * Jobs of a worker : the owner takes from the head, thieves from the tail
+ */
+struct worker
+{
+  pthread_t thread;
+  int index;
+  pthread_mutex_t lock;
+  struct job **jobs;
+  _Atomic int head,tail;
+  struct target *targets[INV_MAX_TARGETS];
+  int count;
+  unsigned long stolen;
+};
+
+struct inventory inv;
+struct target targets[INV_MAX_TARGETS];
+int nbTargets;
+struct worker workers[INV_MAX_STATIONS];
+int nbWorkers;
+_Atomic int pending;
+pthread_mutex_t statsLock=PTHREAD_MUTEX_INITIALIZER;
+
+/////////////////////////////////////////////////////////////////////
+////                         JOB QUEUES                          ////
+/////////////////////////////////////////////////////////////////////
+
+void queuePush(struct worker *w,struct job *j)
+{
+  pthread_mutex_lock(&w->lock);
+  w->jobs[w->tail++]=j;
+  pthread_mutex_unlock(&w->lock);
+}
+
+/**
+ * Job at the head (or the tail when stealing), left in place when it
+ * failed on target <avoid>
+ */
+struct job *queueTake(struct worker *w,int steal,struct target *avoid)
+{
+  struct job *j=NULL;
+  pthread_mutex_lock(&w->lock);
+  if(w->head<w->tail)
+  {
+    j = steal ? w->jobs[w->tail-1] : w->jobs[w->head];
+    if(avoid && j->failedOn==avoid) j=NULL;
+    else if(steal) w->tail--;
+    else w->head++;
+  }
+  pthread_mutex_unlock(&w->lock);
+  return j;
+}
+
+/**
+ * Another target than <t> can still take jobs
+ */
+int othersActive(struct target *t)
+{
+  int others=0;
+  pthread_mutex_lock(&statsLock);
+  for(int i=0 ; i<nbTargets ; i++)
+    if(&targets[i]!=t && !targets[i].disabled) others=1;
+  pthread_mutex_unlock(&statsLock);
+  return others;
+}
+
+/**
+ * Next job for target <t> of worker <w> : its own, else one stolen from
+ * the busiest; not one that just failed on <t> while others can take it
+ */
+struct job *jobTake(struct worker *w,struct target *t)
+{
+  struct target *avoid=othersActive(t) ? t : NULL;
+  struct job *j=queueTake(w,0,avoid);
+  if(j) return j;
+  int best=-1,most=0;
+  for(int i=0 ; i<nbWorkers ; i++)
+  {
+    // a hint, checked again under the lock
+    int left=atomic_load(&workers[i].tail)-atomic_load(&workers[i].head);
+    if(i!=w->index && left>most) { most=left; best=i; }
+  }
+  if(best<0) return NULL;
+  j=queueTake(&workers[best],1,avoid);
+  if(j) w->stolen++;
+  return j;
+}
+
+/////////////////////////////////////////////////////////////////////
+////                            JOBS                             ////
+/////////////////////////////////////////////////////////////////////
+
+/**
+ * Throughput of a target in bytes/s, 0 if unknown
+ */
+double throughput(struct target *t)
+{
+  return t->busyNs ? t->bytes*1e9/t->busyNs : 0;
+}
+
+/**
+ * Count <n> bytes done by <t>
+ */
+void addBytes(struct target *t,uint64_t n)
+{
+  pthread_mutex_lock(&statsLock);
+  t->bytes+=n;
+  pthread_mutex_unlock(&statsLock);
+}
+
+/**
+ * Much slower than the best target
+ */
+int isSlow(struct target *t)
+{
+  pthread_mutex_lock(&statsLock);
+  double mine=throughput(t),best=0;
+  for(int i=0 ; i<nbTargets ; i++)
+    if(!targets[i].disabled && throughput(&targets[i])>best) best=throughput(&targets[i]);
+  pthread_mutex_unlock(&statsLock);
+  return mine>0 && mine*SLOW_RATIO<best;
+}
+
+/**
+ * Output file of a read : <pattern> with each %s replaced by the target
+ * name (the pattern is never used as a printf format).
+ * Returns 0, or -1 if the path doesn't fit.
+ */
+int readPath(char *path,size_t size,const char *pattern,const char *name)
+{
+  size_t len=0,nameLen=strlen(name);
+  for(const char *p=pattern ; *p ; )
+  {
+    const char *from=p;
+    size_t n=1;
+    if(!strncmp(p,"%s",2)) { from=name; n=nameLen; p+=2; }
+    else p++;
+    if(len+n>=size) return -1;
+    memcpy(path+len,from,n);
+    len+=n;
+  }
+  path[len]=0;
+  return 0;
+}
+
+int stepBegin(struct target *t)
+{
+  struct job *j=t->job;
+  t->page=0;
+  t->opRunning=0;
+  cc_select(t->cc);
+  if(j->kinds[t->step]==JOB_WRITE)
+  {
+    // activer DMA
+    cc_setConfig(cc_getConfig() & ~0x4);
+  }
+  if(j->kinds[t->step]==JOB_READ)
+  {
+    char path[1024];
+    if(readPath(path,sizeof(path),j->args[t->step],t->inv->name))
+    {
+      LOG_ERR("%s : path too long.",j->args[t->step]);
+      return -1;
+    }
+    if(image_outOpen(&t->out,path,image_formatOf(path,IMAGE_HEX))) return -1;
+  }
+  return 0;
+}
+
+int jobBegin(struct target *t,struct job *j)
+{
+  t->job=j;
+  t->step=0;
+  t->start=t->ready=flash_now();
+  cc_select(t->cc);
+  cc_enter();
+  uint16_t ID=cc_getChipID();
+  if(cc_error() || ID==0 || ID==0xffff)
+  {
+    LOG_ERR("%s/%s : no dongle (ID %04x).",t->inv->station,t->inv->name,ID);
+    return -1;
+  }
+  return stepBegin(t);
+}
+
+/**
+ * Write and/or verify the pages of the image, one flash operation at a time
+ */
+int imageStep(struct target *t)
+{
+  struct image *img=t->job->imgs[t->step];
+  if(t->opRunning)
+  {
+    if(flash_step(&t->op)==FLASH_WAIT)
+    {
+      t->ready=t->op.deadline;
+      return FLASH_WAIT;
+    }
+    t->opRunning=0;
+    if(t->op.result) return FLASH_DONE;
+    if(t->op.kind==FLASH_WRITE)
+    {
+      // each page is verified once written
+      flash_start(&t->op,FLASH_VERIFY,t->page,&t->cur);
+      t->opRunning=1;
+      return FLASH_WAIT;
+    }
+    addBytes(t,t->cur.maxoffset-t->cur.minoffset+1);
+    t->page++;
+  }
+  while(t->page<=img->maxpage && !img->pages[t->page])
+    t->page++;
+  if(t->page>img->maxpage)
+  {
+    t->op.result=0;
+    return FLASH_DONE;
+  }
+  t->cur=*img->pages[t->page];
+  cc_select(t->cc);
+  flash_start(&t->op,t->job->kinds[t->step]==JOB_WRITE ? FLASH_WRITE : FLASH_VERIFY,t->page,&t->cur);
+  t->opRunning=1;
+  return FLASH_WAIT;
+}
+
+/**
+ * Read 1 kB per step, so the other targets of the worker keep going
+ */
+int readStep(struct target *t)
+{
+  static __thread uint8_t buf[1024],buf2[1024];
+  if(t->page>=FLASH_PAGES*2)
+  {
+    t->op.result=image_outClose(&t->out) ? 1 : 0;
+    return FLASH_DONE;
+  }
+  cc_select(t->cc);
+  int bank=t->page/32;
+  uint16_t offset=(t->page%32)*1024;
+  unsigned long echoes;
+  do
+  {
+    echoes=cc_echoErrors();
+    read1k(bank,offset,buf);
+    // with --echo, a read whose bytes were all echoed back the same is trusted
+    if(cc_echoCheck && cc_echoErrors()==echoes) break;
+    read1k(bank,offset,buf2);
+  } while(memcmp(buf,buf2,1024));
+  if(image_outBlock(&t->out,t->page*1024,buf,1024))
+  {
+    image_outClose(&t->out);
+    t->op.result=1;
+    return FLASH_DONE;
+  }
+  addBytes(t,1024);
+  t->page++;
+  return FLASH_WAIT;
+}
+
+/**
+ * One step of the job of <t> : FLASH_WAIT (t->ready set) or FLASH_DONE
+ */
+int jobStep(struct target *t)
+{
+  uint64_t t0=flash_now();
+  t->ready=t0;
+  int res;
+  switch(t->job->kinds[t->step])
+  {
+    case JOB_ERASE :
+      if(!t->opRunning)
+      {
+        cc_select(t->cc);
+        flash_start(&t->op,FLASH_CHIP_ERASE,0,NULL);
+        t->opRunning=1;
+      }
+      res=flash_step(&t->op);
+      t->ready=t->op.deadline;
+      break;
+    case JOB_WRITE :
+    case JOB_VERIFY :
+      res=imageStep(t);
+      break;
+    default :
+      res=readStep(t);
+  }
+  // next step of the job
+  if(res==FLASH_DONE && !t->op.result && t->step+1<t->job->nbSteps)
+  {
+    t->step++;
+    if(stepBegin(t))
+      t->op.result=1;
+    else
+      res=FLASH_WAIT;
+  }
+  return res;
+}
+
+void jobEnd(struct target *t,struct worker *w,int result)
+{
+  struct job *j=t->job;
+  uint64_t now=flash_now();
+  cc_select(t->cc);
+  cc_exit();
+  pthread_mutex_lock(&statsLock);
+  t->busyNs+=now-t->start;
+  if(!result)
+  {
+    t->done++;
+    t->fails=0;
+  }
+  else
+  {
+    t->failed++;
+    t->fails++;
+    if(t->fails>=MAX_FAILS) t->disabled=1;
+  }
+  pthread_mutex_unlock(&statsLock);
+  t->job=NULL;
+  t->waitedSlow=0;
+  if(!result)
+  {
+    LOG_INFO("%s/%s : job %d (%s) done in %.1f s.",t->inv->station,t->inv->name,j->id,j->spec,(now-t->start)*1e-9);
+    atomic_fetch_sub(&pending,1);
+    return;
+  }
+  LOG_WARN("%s/%s : job %d (%s) failed.",t->inv->station,t->inv->name,j->id,j->spec);
+  if(t->disabled)
+    LOG_WARN("%s/%s : %d failures in a row, set aside.",t->inv->station,t->inv->name,t->fails);
+  // back off : 1 s, 2 s, 4 s...
+  t->ready=now+(BACKOFF_NS<<(t->fails-1));
+  // the dongle in this socket may be at fault : try the job elsewhere,
+  // starting with the next station
+  j->failedOn=t;
+  if(++j->tries<MAX_TRIES)
+    queuePush(&workers[(w->index+1)%nbWorkers],j);
+  else
+  {
+    LOG_ERR("job %d (%s) : failed on %d targets, given up.",j->id,j->spec,j->tries);
+    atomic_fetch_sub(&pending,1);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////
+////                           WORKERS                           ////
+/////////////////////////////////////////////////////////////////////
+
+void *workerLoop(void *arg)
+{
+  struct worker *w=arg;
+  while(atomic_load(&pending)>0)
+  {
+    uint64_t now=flash_now();
+    uint64_t next=now+IDLE_NS;
+    int active=0;
+    for(int i=0 ; i<w->count ; i++)
+    {
+      struct target *t=w->targets[i];
+      if(t->disabled) continue;
+      active++;
+      if(!t->job)
+      {
+        if(now<t->ready) { if(t->ready<next) next=t->ready; continue; }
+        // a slow target lets the others take the job first
+        if(!t->waitedSlow && isSlow(t))
+        {
+          t->waitedSlow=1;
+          t->ready=now+SLOW_DELAY_NS;
+          if(t->ready<next) next=t->ready;
+          continue;
+        }
+        struct job *j=jobTake(w,t);
+        if(!j) continue;
+
+        if(jobBegin(t,j)) { jobEnd(t,w,1); continue; }
+      }
+      if(t->ready<=now && jobStep(t)==FLASH_DONE)
+      {
+        jobEnd(t,w,t->op.result);
+        continue;
+      }
+      if(t->ready<next) next=t->ready;
+    }
+    if(!active) break;
+    now=flash_now();
+    if(next>now)
+    {
+      struct timespec ts={ (next-now)/1000000000, (next-now)%1000000000 };
+      nanosleep(&ts,NULL);
+    }
+  }
+  return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////
+////                            MAIN                             ////
+/////////////////////////////////////////////////////////////////////
+
+/**
+ * Image of a write or verify job, loaded once and shared (read only)
+ */
+struct image *jobImage(const char *path)
+{
+  static struct { const char *path; struct image *img; } images[16];
+  static int nbImages;
+  for(int i=0 ; i<nbImages ; i++)
+    if(!strcmp(images[i].path,path)) return images[i].img;
+  if(nbImages==16) { fprintf(stderr," too many images.\n"); exit(1); }
+  struct image *img=malloc(sizeof(struct image));
+  imageInit(img);
+  if(image_load(path,img,-1)) exit(1);
+  // rounded and CRCed here, so the workers only read the pages
+  for(int page=0 ; page<=img->maxpage ; page++)
+  {
+    struct page *p=img->pages[page];
+    if(!p) continue;
+    if(p->maxoffset<p->minoffset) { free(p); img->pages[page]=NULL; continue; }
+    image_pageCRC(p);
+  }
+  images[nbImages].path=path;
+  images[nbImages++].img=img;
+  return img;
+}
+
+void report()
+{
+  printf("%-12s %-12s %6s %6s %10s %8s %8s %7s\n","station","target","ok","failed","kB","time s","kB/s","errors");
+  for(int s=0 ; s<nbWorkers ; s++)
+  {
+    int ok=0,failed=0;
+    uint64_t bytes=0,busy=0;
+    for(int i=0 ; i<workers[s].count ; i++)
+    {
+      struct target *t=workers[s].targets[i];
+      printf("%-12s %-12s %6d %6d %10.1f %8.1f %8.2f %6.0f%%%s\n",t->inv->station,t->inv->name,t->done,t->failed,
+	t->bytes/1024.,t->busyNs*1e-9,throughput(t)/1024,
+	t->done+t->failed ? 100.*t->failed/(t->done+t->failed) : 0.,t->disabled?" set aside":"");
+      ok+=t->done; failed+=t->failed; bytes+=t->bytes; busy+=t->busyNs;
+    }
+    printf("%-12s %-12s %6d %6d %10.1f %8.1f %8.2f %6.0f%%  (%lu jobs stolen)\n",workers[s].targets[0]->inv->station,"*",ok,failed,
+	bytes/1024.,busy*1e-9,busy ? bytes*1e9/busy/1024 : 0.,ok+failed ? 100.*failed/(ok+failed) : 0.,workers[s].stolen);
+  }
+}
+
+void helpo()
+{
+  fprintf(stderr,"usage : cc_fleet [-v] [-q] [--xosc] [--echo] -i inventory [-n count] job...\n");
+  fprintf(stderr,"	-i : targets, one per line : station name gpiochip pin_reset pin_DC pin_DD\n");
+  fprintf(stderr,"	-n : queue the jobs <count> times (default 1, not for read jobs)\n");
+  fprintf(stderr,"	-v : more messages (repeat for debug, trace)\n");
+  fprintf(stderr,"	-q : quiet\n");
+  fprintf(stderr,"	--xosc : run the target on its 32 MHz crystal while debugging\n");
+  fprintf(stderr,"	--echo : check the accumulator echoed by each debug instruction, read each block once\n");
+  fprintf(stderr,"	job : steps run in a row on one dongle, joined by + :\n");
+  fprintf(stderr,"	      erase, write=file, verify=file or read=file (%%s : target name)\n");
+}
+
+int main(int argc,char *argv[])
+{
+  int opt;
+  const char *inventory=NULL;
+  int count=1;
+  int xosc=0;
+  static struct option longopts[] =
+  {
+    { "xosc", no_argument, NULL, 'X' },
+    { "echo", no_argument, NULL, 'E' },
+    { NULL, 0, NULL, 0 }
+  };
+  cc_logInit();
+  while( (opt=getopt_long(argc,argv,"i:n:vqh?",longopts,NULL)) != -1)
+  {
+    switch(opt)
+    {
+     case 'i' : // inventory
+      inventory=optarg;
+      break;
+     case 'n' : // repeat
+      count=atoi(optarg);
+      if(count<1) count=1;
+      break;
+     case 'v' : // verbose
+      cc_logVerbosity(1);
+      break;
+     case 'q' : // quiet
+      cc_logVerbosity(-1);
+      break;
+     case 'X' : // 32 MHz crystal
+      xosc=1;
+      break;
+     case 'E' : // echo
+      cc_echoCheck=1;
+      break;
+     case 'h' : // helpo
+     case '?' : // helpo
+      helpo();
+      exit(0);
+      break;
+    }
+  }
+  if(!inventory || optind>=argc) { helpo(); exit(1); }
+  if(inv_load(inventory,&inv)) exit(1);
+  nbTargets=inv.nbTargets;
+  nbWorkers=inv.nbStations;
+
+  // jobs
+  int nbJobs=(argc-optind)*count;
+  struct job *jobs=calloc(nbJobs,sizeof(struct job));
+  for(int n=0 ; n<nbJobs ; n++)
+  {
+    struct job *j=&jobs[n];
+    j->id=n+1;
+    j->spec=argv[optind+n%(argc-optind)];
+    char *steps=strdup(j->spec),*save;
+    for(char *s=strtok_r(steps,"+",&save) ; s ; s=strtok_r(NULL,"+",&save))
+    {
+      if(j->nbSteps==MAX_STEPS) { fprintf(stderr," %s : too many steps.\n",j->spec); exit(1); }
+      char *eq=strchr(s,'=');
+      if(eq) *eq++=0;
+      int kind;
+      for(kind=0 ; kind<4 ; kind++)
+        if(!strcmp(s,jobNames[kind])) break;
+      if(kind==4 || (kind!=JOB_ERASE && !eq)) { fprintf(stderr," unknown job %s.\n",j->spec); exit(1); }
+      j->kinds[j->nbSteps]=kind;
+      j->args[j->nbSteps]=eq;
+      // the repeats would overwrite the same file
+      if(kind==JOB_READ && count>1) { fprintf(stderr," %s : read jobs can't be repeated with -n.\n",j->spec); exit(1); }
+      if(kind==JOB_WRITE || kind==JOB_VERIFY) j->imgs[j->nbSteps]=jobImage(eq);
+      j->nbSteps++;
+    }
+    if(!j->nbSteps) { fprintf(stderr," empty job.\n"); exit(1); }
+  }
+
+  // one worker per station
+  for(int i=0 ; i<nbTargets ; i++)
+  {
+    struct target *t=&targets[i];
+    t->inv=&inv.targets[i];
+    int s=t->inv->stationIndex;
+    workers[s].targets[workers[s].count++]=t;
+    t->cc=cc_open(t->inv->chip,t->inv->rst,t->inv->dc,t->inv->dd);
+    if(!t->cc) exit(1);
+    cc_useXOSC(xosc);
+  }
+  // deal the jobs
+  for(int s=0 ; s<nbWorkers ; s++)
+  {
+    workers[s].index=s;
+    pthread_mutex_init(&workers[s].lock,NULL);
+    // room for the jobs coming back after a failure
+    workers[s].jobs=malloc(nbJobs*MAX_TRIES*sizeof(struct job *));
+  }
+  for(int n=0 ; n<nbJobs ; n++)
+    queuePush(&workers[n%nbWorkers],&jobs[n]);
+  atomic_init(&pending,nbJobs);
+  LOG_INFO("%d jobs, %d targets, %d stations.",nbJobs,nbTargets,nbWorkers);
+
+  for(int s=0 ; s<nbWorkers ; s++)
+    pthread_create(&workers[s].thread,NULL,workerLoop,&workers[s]);
+  for(int s=0 ; s<nbWorkers ; s++)
+    pthread_join(workers[s].thread,NULL);
+
+  for(int i=0 ; i<nbTargets ; i++)
+  {
+    cc_select(targets[i].cc);
+    cc_setActive(false);
+  }
+  report();
+  int left=atomic_load(&pending);
+  if(left) printf(" %d jobs not done : no target left.\n",left);
+  return left ? 1 : 0;
+}
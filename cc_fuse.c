@@ -0,0 +1,474 @@
+/***********************************************************************
+  Copyright © 2019 Jean Michault.
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+#define FUSE_USE_VERSION 31
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <fuse.h>
+
+#include "CCDebugger.h"
+#include "CCLog.h"
+#include "CCFlash.h"
+#include "CCRegs.h"
+#include "CCRealtime.h"
+
+/**
+ * One debug session for the whole mount : FUSE calls are serialized.
+ * The chip stays halted while mounted.
+ */
+pthread_mutex_t busLock=PTHREAD_MUTEX_INITIALIZER;
+
+char *chipName=GPIOCHIP;
+int rePin=-1,dcPin=-1,ddPin=-1;
+int attach=0;
+int xosc=0;
+
+// XDATA below the flash window : SRAM, XREG, SFR mirror, info page
+#define XDATA_SIZE  0x8000
+#define INFO_ADDR   0x7800
+#define INFO_SIZE   0x800
+
+enum { F_FLASH, F_XDATA, F_SFR, F_INFO, NB_FILES };
+
+static const struct
+{
+  const char *name;
+  int size;
+  int mode;
+} files[NB_FILES] =
+{
+  { "flash", FLASH_PAGES*FLASH_PAGE_SIZE, 0644 },
+  { "xdata", XDATA_SIZE, 0644 },
+  { "sfr", 0x80, 0644 },
+  { "info", INFO_SIZE, 0444 },
+};
+
+/////////////////////////////////////////////////////////////////////
+////                         PAGE CACHE                          ////
+/////////////////////////////////////////////////////////////////////
+
+/**
+ * Flash pages and the info page, read on first use.
+ * A word may only be written twice between erases : the writes of each
+ * word since the last erase are counted, a word found programmed when its
+ * page is read counts as written twice (its history is unknown).
+ */
+#define PAGE_WORDS  (FLASH_PAGE_SIZE/4)
+#define MAX_WRITES  2
+uint8_t *flashCache[FLASH_PAGES];
+uint8_t *wordWrites[FLASH_PAGES];
+uint8_t *infoCache;
+unsigned long pagesRead,pagesErased,wordsWritten;
+
+static void flashForget(int page)
+{
+  free(flashCache[page]);
+  free(wordWrites[page]);
+  flashCache[page]=NULL;
+  wordWrites[page]=NULL;
+}
+
+static uint8_t *flashPage(int page)
+{
+  if(flashCache[page]) return flashCache[page];
+  uint8_t *buf=malloc(FLASH_PAGE_SIZE);
+  uint8_t *writes=malloc(PAGE_WORDS);
+  if(!buf || !writes) { free(buf); free(writes); return NULL; }
+  uint8_t bank=page>>4;
+  uint16_t offset=(page&0xf)*FLASH_PAGE_SIZE;
+  // the cache decides erasing and is programmed back whole after an
+  // erase : read twice until both reads match, as cc_read does
+  static uint8_t again[FLASH_PAGE_SIZE];
+  unsigned long overruns,echoes;
+  do
+  {
+    overruns=cc_rtOverruns();
+    echoes=cc_echoErrors();
+    read1k(bank,offset,buf);
+    read1k(bank,offset+1024,buf+1024);
+    if(cc_error()) break;
+    if(cc_rtActive && cc_rtOverruns()==overruns) break;
+    if(cc_echoCheck && cc_echoErrors()==echoes) break;
+    read1k(bank,offset,again);
+    read1k(bank,offset+1024,again+1024);
+  } while(!cc_error() && memcmp(buf,again,FLASH_PAGE_SIZE));
+  if(cc_error()) { free(buf); free(writes); return NULL; }
+  static const uint8_t blank[4]={ 0xff,0xff,0xff,0xff };
+  for(int w=0 ; w<PAGE_WORDS ; w++)
+    writes[w]=memcmp(buf+w*4,blank,4) ? MAX_WRITES : 0;
+  pagesRead++;
+  wordWrites[page]=writes;
+  return flashCache[page]=buf;
+}
+
+/**
+ * Program the words of [lo,hi] whose value changes, one run of
+ * consecutive changed words at a time (unchanged words are not written
+ * again, so that they don't use up their writes)
+ */
+static int programWords(int page,const uint8_t *cur,uint8_t *next,int lo,int hi)
+{
+  for(int w=lo&~3 ; w<=hi ; )
+  {
+    if(!memcmp(cur+w,next+w,4)) { w+=4; continue; }
+    int end=w;
+    while(end+4<=hi && memcmp(cur+end+4,next+end+4,4)) end+=4;
+    struct page p={ .minoffset=w, .maxoffset=end+3, .datas=next };
+    if(writePage(page,&p) || verifPage(page,&p)) return -EIO;
+    for(int i=w ; i<=end ; i+=4) wordWrites[page][i/4]++;
+    wordsWritten+=(end-w)/4+1;
+    w=end+4;
+  }
+  return 0;
+}
+
+/**
+ * New content for [off,off+len) of a page : program it in place when
+ * only 1 bits turn to 0 and no changed word was already written twice,
+ * else erase the page and program all of it
+ */
+static int flashUpdate(int page,int off,const uint8_t *buf,int len)
+{
+  uint8_t *cur=flashPage(page);
+  if(!cur) return -EIO;
+  if(!memcmp(cur+off,buf,len)) return 0;
+  uint8_t next[FLASH_PAGE_SIZE];
+  memcpy(next,cur,FLASH_PAGE_SIZE);
+  memcpy(next+off,buf,len);
+  int erase=0;
+  for(int i=off ; i<off+len && !erase ; i++)
+    if((cur[i] & next[i])!=next[i]) erase=1;
+  for(int w=off/4 ; w<=(off+len-1)/4 && !erase ; w++)
+    if(memcmp(cur+w*4,next+w*4,4) && wordWrites[page][w]>=MAX_WRITES) erase=1;
+  int res;
+  if(erase)
+  {
+    static const uint8_t blank[FLASH_PAGE_SIZE]={[0 ... FLASH_PAGE_SIZE-1]=0xff};
+    if(erasePage(page)) return -EIO;
+    pagesErased++;
+    memcpy(cur,blank,FLASH_PAGE_SIZE);
+    memset(wordWrites[page],0,PAGE_WORDS);
+    res=programWords(page,cur,next,0,FLASH_PAGE_SIZE-1);
+  }
+  else
+    res=programWords(page,cur,next,off,off+len-1);
+  if(res)
+  {
+    // what the flash holds now is unknown
+    flashForget(page);
+    return res;
+  }
+  memcpy(cur,next,FLASH_PAGE_SIZE);
+  return 0;
+}
+
+/////////////////////////////////////////////////////////////////////
+////                       FILE OPERATIONS                       ////
+/////////////////////////////////////////////////////////////////////
+
+static int fileOf(const char *path)
+{
+  if(*path!='/') return -1;
+  for(int f=0 ; f<NB_FILES ; f++)
+    if(!strcmp(path+1,files[f].name)) return f;
+  return -1;
+}
+
+static int ccfs_getattr(const char *path,struct stat *st,struct fuse_file_info *fi)
+{
+  memset(st,0,sizeof(*st));
+  st->st_uid=getuid();
+  st->st_gid=getgid();
+  if(!strcmp(path,"/"))
+  {
+    st->st_mode=S_IFDIR|0755;
+    st->st_nlink=2;
+    return 0;
+  }
+  int f=fileOf(path);
+  if(f<0) return -ENOENT;
+  st->st_mode=S_IFREG|files[f].mode;
+  st->st_nlink=1;
+  st->st_size=files[f].size;
+  return 0;
+}
+
+static int ccfs_readdir(const char *path,void *buf,fuse_fill_dir_t filler,off_t offset,
+			struct fuse_file_info *fi,enum fuse_readdir_flags flags)
+{
+  if(strcmp(path,"/")) return -ENOENT;
+  filler(buf,".",NULL,0,0);
+  filler(buf,"..",NULL,0,0);
+  for(int f=0 ; f<NB_FILES ; f++)
+    filler(buf,files[f].name,NULL,0,0);
+  return 0;
+}
+
+static int ccfs_open(const char *path,struct fuse_file_info *fi)
+{
+  int f=fileOf(path);
+  if(f<0) return -ENOENT;
+  if(f==F_INFO && (fi->flags & O_ACCMODE)!=O_RDONLY) return -EACCES;
+  // programming a page uses SRAM and DMA behind the back of the firmware
+  if(f==F_FLASH && attach && (fi->flags & O_ACCMODE)!=O_RDONLY) return -EROFS;
+  // registers and RAM are read live, flash and info page come from the cache
+  if(f==F_XDATA || f==F_SFR) fi->direct_io=1;
+  else fi->keep_cache=1;
+  return 0;
+}
+
+static int ccfs_truncate(const char *path,off_t size,struct fuse_file_info *fi)
+{
+  // fixed size : O_TRUNC of cp or dd is ignored
+  int f=fileOf(path);
+  if(f<0) return -ENOENT;
+  return 0;
+}
+
+static int ccfs_read(const char *path,char *buf,size_t size,off_t offset,struct fuse_file_info *fi)
+{
+  int f=fileOf(path);
+  if(f<0) return -ENOENT;
+  if(offset>=files[f].size) return 0;
+  if(offset+size>files[f].size) size=files[f].size-offset;
+  int res=size;
+  pthread_mutex_lock(&busLock);
+  switch(f)
+  {
+    case F_FLASH :
+      for(size_t done=0 ; done<size ; )
+      {
+        int page=(offset+done)/FLASH_PAGE_SIZE;
+        int off=(offset+done)%FLASH_PAGE_SIZE;
+        int len=FLASH_PAGE_SIZE-off;
+        if(len>size-done) len=size-done;
+        uint8_t *p=flashPage(page);
+        if(!p) { res=-EIO; break; }
+        memcpy(buf+done,p+off,len);
+        done+=len;
+      }
+      break;
+    case F_INFO :
+      if(!infoCache && (infoCache=malloc(INFO_SIZE)))
+        cc_readBlock(INFO_ADDR,infoCache,INFO_SIZE);
+      if(!infoCache) res=-ENOMEM;
+      else memcpy(buf,infoCache+offset,size);
+      break;
+    case F_XDATA :
+      // by runs, around the registers that pop a FIFO
+      for(size_t done=0 ; done<size ; )
+      {
+        if(X_POPS(offset+done)) { buf[done++]=0; continue; }
+        size_t end=done+1;
+        while(end<size && !X_POPS(offset+end)) end++;
+        cc_readBlock(offset+done,(uint8_t *)buf+done,end-done);
+        done=end;
+      }
+      break;
+    case F_SFR :
+      for(size_t i=0 ; i<size ; i++)
+        buf[i]=SFR_POPS(0x80+offset+i) ? 0 : cc_sfrFetch(0x80+offset+i);
+      break;
+  }
+  if(cc_error()) res=-EIO;
+  pthread_mutex_unlock(&busLock);
+  return res;
+}
+
+static int ccfs_write(const char *path,const char *buf,size_t size,off_t offset,struct fuse_file_info *fi)
+{
+  int f=fileOf(path);
+  if(f<0) return -ENOENT;
+  if(offset>=files[f].size) return -ENOSPC;
+  if(offset+size>files[f].size) size=files[f].size-offset;
+  int res=size;
+  pthread_mutex_lock(&busLock);
+  switch(f)
+  {
+    case F_FLASH :
+      if(attach) { res=-EROFS; break; }
+      for(size_t done=0 ; done<size ; )
+      {
+        int page=(offset+done)/FLASH_PAGE_SIZE;
+        int off=(offset+done)%FLASH_PAGE_SIZE;
+        int len=FLASH_PAGE_SIZE-off;
+        if(len>size-done) len=size-done;
+        int err=flashUpdate(page,off,(const uint8_t *)buf+done,len);
+        if(err) { res=err; break; }
+        done+=len;
+      }
+      break;
+    case F_XDATA :
+      for(size_t i=0 ; i<size ; i++)
+      {
+        uint16_t addr=offset+i;
+        // RAM through the shadow, registers always written
+        if(addr<0x2000) cc_writeBlock(addr,(const uint8_t *)buf+i,1);
+        else cc_xdataPut(addr,buf[i]);
+      }
+      break;
+    case F_SFR :
+      for(size_t i=0 ; i<size ; i++)
+      {
+        cc_sfrForget(0x80+offset+i,0xff);
+        cc_sfrSet(0x80+offset+i,buf[i]);
+      }
+      break;
+    default :
+      res=-EACCES;
+  }
+  if(res>0 && cc_error()) res=-EIO;
+  pthread_mutex_unlock(&busLock);
+  return res;
+}
+
+/**
+ * The session starts once FUSE is mounted (after it went to background)
+ */
+static void *ccfs_init(struct fuse_conn_info *conn,struct fuse_config *cfg)
+{
+  cfg->kernel_cache=0;
+  if(cc_init(chipName,rePin,dcPin,ddPin)<0) exit(1);
+  cc_useXOSC(xosc);
+  if(attach)
+  {
+    if(cc_attach())
+    {
+      LOG_ERR("not in debug mode : run without --attach (resets the chip).");
+      exit(1);
+    }
+  }
+  else
+    cc_enter();
+  uint16_t ID=cc_getChipID();
+  LOG_INFO("ID = %04x.",ID);
+  // DMA feeds the flash controller (flash is read-only when attached)
+  if(!attach) cc_setConfig(cc_getConfig() & ~0x4);
+  return NULL;
+}
+
+static void ccfs_destroy(void *data)
+{
+  LOG_INFO("%lu pages read, %lu erased, %lu words written.",pagesRead,pagesErased,wordsWritten);
+  cc_setActive(false);
+}
+
+static const struct fuse_operations ccfsOps =
+{
+  .init     = ccfs_init,
+  .destroy  = ccfs_destroy,
+  .getattr  = ccfs_getattr,
+  .readdir  = ccfs_readdir,
+  .open     = ccfs_open,
+  .truncate = ccfs_truncate,
+  .read     = ccfs_read,
+  .write    = ccfs_write,
+};
+
+void helpo()
+{
+  fprintf(stderr,"usage : cc_fuse [-v] [-q] [-a] [--xosc] [-g gpiochip] [-d pin_DD] [-c pin_DC] [-r pin_reset] [-f] [-o fuse_options] mountpoint\n");
+  fprintf(stderr,"	-g : gpiochip name, or sim (default " GPIOCHIP ")\n");
+  fprintf(stderr,"	-c : change pin_DC (default " PIN_STR(PIN_DC) ")\n");
+  fprintf(stderr,"	-d : change pin_DD (default " PIN_STR(PIN_DD) ")\n");
+  fprintf(stderr,"	-r : change reset pin (default " PIN_STR(PIN_RST) ")\n");
+  fprintf(stderr,"	-v : more messages (repeat for debug, trace)\n");
+  fprintf(stderr,"	-q : quiet\n");
+  fprintf(stderr,"	-a, --attach : join the debug session left by a previous command, without resetting the chip (flash is then read-only)\n");
+  fprintf(stderr,"	--xosc : run the target on its 32 MHz crystal while debugging\n");
+  fprintf(stderr,"	-f : stay in foreground\n");
+  fprintf(stderr,"	-o : mount options, passed to FUSE\n");
+  fprintf(stderr,"	files : flash, xdata (0x0000-0x7fff), sfr (0x80-0xff), info\n");
+}
+
+int main(int argc,char *argv[])
+{
+  int opt;
+  int foreground=0;
+  char *fuseOpts=NULL;
+  static struct option longopts[] =
+  {
+    { "attach", no_argument, NULL, 'a' },
+    { "xosc", no_argument, NULL, 'X' },
+    { NULL, 0, NULL, 0 }
+  };
+  cc_logInit();
+  while( (opt=getopt_long(argc,argv,"g:d:c:r:o:afvqh?",longopts,NULL)) != -1)
+  {
+    switch(opt)
+    {
+     case 'g' : // gpiochip
+      chipName=optarg;
+      break;
+     case 'd' : // DD pinglo
+      ddPin=atoi(optarg);
+      break;
+     case 'c' : // DC pinglo
+      dcPin=atoi(optarg);
+      break;
+     case 'r' : // restarigi pinglo
+      rePin=atoi(optarg);
+      break;
+     case 'o' : // FUSE options
+      fuseOpts=optarg;
+      break;
+     case 'a' : // attach
+      attach=1;
+      break;
+     case 'X' : // 32 MHz crystal
+      xosc=1;
+      break;
+     case 'f' : // foreground
+      foreground=1;
+      break;
+     case 'v' : // verbose
+      cc_logVerbosity(1);
+      break;
+     case 'q' : // quiet
+      cc_logVerbosity(-1);
+      break;
+     case 'h' : // helpo
+     case '?' : // helpo
+      helpo();
+      exit(0);
+      break;
+    }
+  }
+  if( optind+1 != argc ) { helpo(); exit(1); }
+  // FUSE arguments : one thread, the bus is shared anyway
+  char *fuseArgv[8];
+  int fuseArgc=0;
+  fuseArgv[fuseArgc++]=argv[0];
+  fuseArgv[fuseArgc++]="-s";
+  if(foreground) fuseArgv[fuseArgc++]="-f";
+  if(fuseOpts)
+  {
+    fuseArgv[fuseArgc++]="-o";
+    fuseArgv[fuseArgc++]=fuseOpts;
+  }
+  fuseArgv[fuseArgc++]=argv[optind];
+  fuseArgv[fuseArgc]=NULL;
+  return fuse_main(fuseArgc,fuseArgv,&ccfsOps,NULL);
+}
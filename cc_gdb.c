@@ -0,0 +1,835 @@
+/***********************************************************************
+  Copyright © 2019 Jean Michault.
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "CCDebugger.h"
+#include "CCLog.h"
+#include "CCFlash.h"
+#include "CCRegs.h"
+#include "CCMap.h"
+
+/**
+ * GDB address spaces : code is bank<<16 | code address like in map files
+ * (16 bits : common area or bank 1), the others are moved up
+ */
+#define SPACE_XDATA   0x800000
+#define SPACE_DATA    0x810000
+#define SPACE_SFR     0x820000
+#define SPACE_END     0x830000
+
+#define SRAM_SIZE     0x2000
+// DATA/IDATA is the top of SRAM
+#define SRAM_IDATA    0x1F00
+
+#define PACKET_SIZE   0x1000
+#define POLL_MS       10
+
+/**
+ * Registers of the g packet, one byte each but PC (4 bytes, code address)
+ */
+enum { REG_R0, REG_A=8, REG_B, REG_PSW, REG_SP, REG_DPL, REG_DPH, REG_PC, NB_REGS };
+#define REGS_BYTES (REG_PC+4)
+
+int client=-1;
+int noAck;
+int attach;
+unsigned long packets,bytesServed,bytesRead;
+
+/////////////////////////////////////////////////////////////////////
+////                        MEMORY CACHES                        ////
+/////////////////////////////////////////////////////////////////////
+
+/**
+ * Flash in 1k blocks, read once : only the flash controller changes it
+ * ("monitor flush" after the firmware wrote its own flash)
+ */
+#define FLASH_BLOCK 1024
+uint8_t *flashBlocks[FLASH_PAGES*FLASH_PAGE_SIZE/FLASH_BLOCK];
+
+/**
+ * SRAM in lines, valid until the CPU runs (cc_getEpoch()). GDB asks for
+ * a few bytes at a time : a miss reads the whole line, consecutive
+ * missing lines in one block.
+ */
+#define LINE 64
+uint8_t sram[SRAM_SIZE];
+uint32_t lineEpoch[SRAM_SIZE/LINE];
+uint8_t lineValid[SRAM_SIZE/LINE];
+
+/**
+ * Registers, read in one burst at the first look after a stop
+ */
+uint8_t sfrB,sfrPSW,sfrSP,sfrFMAP;
+uint16_t pc;
+uint32_t regsEpoch;
+int regsValid;
+
+static void flushCaches()
+{
+  for(int b=0 ; b<sizeof(flashBlocks)/sizeof(*flashBlocks) ; b++)
+  {
+    free(flashBlocks[b]);
+    flashBlocks[b]=NULL;
+  }
+  memset(lineValid,0,sizeof(lineValid));
+  regsValid=0;
+}
+
+/**
+ * Debug instructions use A and DPTR : save the program's first
+ */
+static uint8_t *context()
+{
+  uint8_t *ctx=cc_context();
+  if(ctx) return ctx;
+  cc_saveContext();
+  return cc_context();
+}
+
+static int lineOk(int l)
+{
+  return lineValid[l] && lineEpoch[l]==cc_getEpoch();
+}
+
+static void sramRead(uint16_t addr,uint8_t *buf,int len)
+{
+  context();
+  int last=(addr+len-1)/LINE;
+  for(int l=addr/LINE ; l<=last ; )
+  {
+    if(lineOk(l)) { l++; continue; }
+    int end=l;
+    while(end<last && !lineOk(end+1)) end++;
+    cc_readBlock(l*LINE,sram+l*LINE,(end-l+1)*LINE);
+    bytesRead+=(end-l+1)*LINE;
+    for( ; l<=end ; l++)
+    {
+      lineValid[l]=1;
+      lineEpoch[l]=cc_getEpoch();
+    }
+  }
+  memcpy(buf,sram+addr,len);
+}
+
+static void sramWrite(uint16_t addr,const uint8_t *buf,int len)
+{
+  context();
+  cc_writeBlock(addr,buf,len);
+  memcpy(sram+addr,buf,len);
+}
+
+static int flashRead(uint32_t addr,uint8_t *buf,int len)
+{
+  for(int done=0 ; done<len ; )
+  {
+    uint32_t a=addr+done;
+    if(a>=FLASH_PAGES*FLASH_PAGE_SIZE) return -1;
+    int b=a/FLASH_BLOCK;
+    if(!flashBlocks[b])
+    {
+      context();
+      if(!(flashBlocks[b]=malloc(FLASH_BLOCK))) return -1;
+      read1k(b*FLASH_BLOCK>>15,(b*FLASH_BLOCK)&0x7fff,flashBlocks[b]);
+      bytesRead+=FLASH_BLOCK;
+    }
+    int n=FLASH_BLOCK-a%FLASH_BLOCK;
+    if(n>len-done) n=len-done;
+    memcpy(buf+done,flashBlocks[b]+a%FLASH_BLOCK,n);
+    done+=n;
+  }
+  return 0;
+}
+
+/**
+ * Flash address of a GDB code address
+ */
+static uint32_t codeFlash(uint32_t addr)
+{
+  return map_physAddr((addr>>16) ? addr>>16 : 1,addr&0xffff);
+}
+
+/**
+ * SFRs the debugger uses come from the saved context
+ */
+static uint8_t *contextSfr(uint8_t sfr)
+{
+  uint8_t *ctx=context();
+  switch(sfr)
+  {
+    case SFR_ACC : return &ctx[CC_CTX_A];
+    case SFR_DPS : return &ctx[CC_CTX_DPS];
+    case SFR_DPL : return &ctx[CC_CTX_DPL];
+    case SFR_DPH : return &ctx[CC_CTX_DPH];
+    case SFR_MEMCTR : return &ctx[CC_CTX_MEMCTR];
+  }
+  return NULL;
+}
+
+static int memRead(uint32_t addr,uint8_t *buf,int len)
+{
+  if(addr<SPACE_XDATA)
+  {
+    // one bank at a time
+    for(int done=0 ; done<len ; )
+    {
+      uint32_t a=addr+done;
+      int n=0x10000-(a&0xffff);
+      if((a&0xffff)<0x8000) n=0x8000-(a&0xffff);
+      if(n>len-done) n=len-done;
+      if(flashRead(codeFlash(a),buf+done,n)) return -1;
+      done+=n;
+    }
+    return 0;
+  }
+  if(addr+len>SPACE_END) return -1;
+  if(addr>=SPACE_SFR)
+  {
+    if(addr<SPACE_SFR+0x80 || addr+len>SPACE_SFR+0x100) return -1;
+    for(int i=0 ; i<len ; i++)
+    {
+      uint8_t sfr=addr-SPACE_SFR+i;
+      uint8_t *saved=contextSfr(sfr);
+      if(saved) buf[i]=*saved;
+      else buf[i]=SFR_POPS(sfr) ? 0 : cc_sfrFetch(sfr);
+    }
+    return 0;
+  }
+  if(addr>=SPACE_DATA)
+  {
+    if(addr+len>SPACE_DATA+0x100) return -1;
+    sramRead(SRAM_IDATA+addr-SPACE_DATA,buf,len);
+    return 0;
+  }
+  addr-=SPACE_XDATA;
+  if(addr+len>0x10000) return -1;
+  if(addr+len<=SRAM_SIZE)
+  {
+    sramRead(addr,buf,len);
+    return 0;
+  }
+  // registers and flash window : exactly what was asked
+  context();
+  for(int i=0 ; i<len ; i++)
+  {
+    if(X_POPS(addr+i)) buf[i]=0;
+    else cc_readBlock(addr+i,buf+i,1);
+  }
+  bytesRead+=len;
+  return 0;
+}
+
+static int memWrite(uint32_t addr,const uint8_t *buf,int len)
+{
+  if(addr<SPACE_XDATA) return -1;   // flash : use cc_write
+  if(addr+len>SPACE_END) return -1;
+  if(addr>=SPACE_SFR)
+  {
+    if(addr<SPACE_SFR+0x80 || addr+len>SPACE_SFR+0x100) return -1;
+    for(int i=0 ; i<len ; i++)
+    {
+      uint8_t sfr=addr-SPACE_SFR+i;
+      uint8_t *saved=contextSfr(sfr);
+      if(saved) *saved=buf[i];
+      else
+      {
+        cc_sfrForget(sfr,0xff);
+        cc_sfrSet(sfr,buf[i]);
+      }
+    }
+    regsValid=0;
+    return 0;
+  }
+  if(addr>=SPACE_DATA)
+  {
+    if(addr+len>SPACE_DATA+0x100) return -1;
+    sramWrite(SRAM_IDATA+addr-SPACE_DATA,buf,len);
+    return 0;
+  }
+  addr-=SPACE_XDATA;
+  if(addr+len>0x10000) return -1;
+  if(addr+len<=SRAM_SIZE)
+  {
+    sramWrite(addr,buf,len);
+    return 0;
+  }
+  context();
+  for(int i=0 ; i<len ; i++)
+    cc_xdataPut(addr+i,buf[i]);
+  return 0;
+}
+
+/////////////////////////////////////////////////////////////////////
+////                          REGISTERS                          ////
+/////////////////////////////////////////////////////////////////////
+
+static void loadRegs()
+{
+  context();
+  if(regsValid && regsEpoch==cc_getEpoch()) return;
+  sfrB=cc_sfrFetch(SFR_B);
+  sfrPSW=cc_sfrFetch(SFR_PSW);
+  sfrSP=cc_sfrFetch(SFR_SP);
+  sfrFMAP=cc_sfrFetch(SFR_FMAP);
+  pc=cc_getPC();
+  regsEpoch=cc_getEpoch();
+  regsValid=1;
+}
+
+static uint32_t codePC()
+{
+  if(pc<0x8000 || (sfrFMAP&7)==1) return pc;
+  return ((sfrFMAP&7)<<16)|pc;
+}
+
+/**
+ * Register <r> in regs[] at its place in the g packet, 1 or 4 bytes
+ */
+static int regGet(int r,uint8_t *regs)
+{
+  loadRegs();
+  uint8_t *ctx=context();
+  switch(r)
+  {
+    case REG_A : *regs=ctx[CC_CTX_A]; return 1;
+    case REG_B : *regs=sfrB; return 1;
+    case REG_PSW : *regs=sfrPSW; return 1;
+    case REG_SP : *regs=sfrSP; return 1;
+    case REG_DPL : *regs=ctx[CC_CTX_DPL]; return 1;
+    case REG_DPH : *regs=ctx[CC_CTX_DPH]; return 1;
+    case REG_PC :
+    {
+      uint32_t a=codePC();
+      for(int i=0 ; i<4 ; i++) regs[i]=a>>(8*i);
+      return 4;
+    }
+  }
+  // R0-R7 of the bank selected by PSW
+  sramRead(SRAM_IDATA+(sfrPSW&0x18)+r,regs,1);
+  return 1;
+}
+
+static void regSet(int r,const uint8_t *regs)
+{
+  loadRegs();
+  uint8_t *ctx=context();
+  switch(r)
+  {
+    case REG_A : ctx[CC_CTX_A]=*regs; return;
+    case REG_DPL : ctx[CC_CTX_DPL]=*regs; return;
+    case REG_DPH : ctx[CC_CTX_DPH]=*regs; return;
+    case REG_B : cc_sfrForget(SFR_B,0xff); cc_sfrSet(SFR_B,sfrB=*regs); return;
+    case REG_PSW : cc_sfrForget(SFR_PSW,0xff); cc_sfrSet(SFR_PSW,sfrPSW=*regs); return;
+    case REG_SP : cc_sfrForget(SFR_SP,0xff); cc_sfrSet(SFR_SP,sfrSP=*regs); return;
+    case REG_PC :
+    {
+      uint32_t a=regs[0]|(regs[1]<<8)|(regs[2]<<16)|(regs[3]<<24);
+      if((a&0xffff)>=0x8000)
+      {
+        sfrFMAP=(a>>16) ? a>>16 : 1;
+        cc_sfrForget(SFR_FMAP,0xff);
+        cc_sfrSet(SFR_FMAP,sfrFMAP);
+      }
+      cc_execi(0x02,a&0xffff);                  // LJMP
+      pc=a&0xffff;
+      return;
+    }
+  }
+  sramWrite(SRAM_IDATA+(sfrPSW&0x18)+r,regs,1);
+}
+
+/////////////////////////////////////////////////////////////////////
+////                         BREAKPOINTS                         ////
+/////////////////////////////////////////////////////////////////////
+
+/**
+ * GDB breakpoints, software ones included : flash can't take 0xA5,
+ * all use the hardware breakpoints of the chip
+ */
+uint32_t breaks[CC_BREAKPOINTS];
+uint8_t breakUsed[CC_BREAKPOINTS];
+
+static int breakInsert(uint32_t addr)
+{
+  for(int n=0 ; n<CC_BREAKPOINTS ; n++)
+    if(breakUsed[n] && breaks[n]==addr) return 0;
+  for(int n=0 ; n<CC_BREAKPOINTS ; n++)
+  {
+    if(breakUsed[n]) continue;
+    cc_setBreakpoint(n,codeFlash(addr));
+    if(cc_error()) return -1;
+    breaks[n]=addr;
+    breakUsed[n]=1;
+    return 0;
+  }
+  LOG_WARN("no hardware breakpoint left for 0x%x (%d in use).",addr,CC_BREAKPOINTS);
+  return -1;
+}
+
+static int breakRemove(uint32_t addr)
+{
+  for(int n=0 ; n<CC_BREAKPOINTS ; n++)
+  {
+    if(!breakUsed[n] || breaks[n]!=addr) continue;
+    cc_clearBreakpoint(n);
+    breakUsed[n]=0;
+  }
+  return 0;
+}
+
+static void breakClearAll()
+{
+  for(int n=0 ; n<CC_BREAKPOINTS ; n++)
+    if(breakUsed[n])
+    {
+      cc_clearBreakpoint(n);
+      breakUsed[n]=0;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////
+////                        RSP PACKETS                          ////
+/////////////////////////////////////////////////////////////////////
+
+static uint8_t rbuf[PACKET_SIZE];
+static int rlen,rpos;
+
+/**
+ * Next byte from GDB, -1 after <timeoutMs> (-1 : no timeout), -2 if closed
+ */
+static int netGetc(int timeoutMs)
+{
+  if(rpos==rlen)
+  {
+    struct pollfd p={ client, POLLIN, 0 };
+    int r=poll(&p,1,timeoutMs);
+    if(r==0) return -1;
+    if(r<0) return -2;
+    rlen=recv(client,rbuf,sizeof(rbuf),0);
+    rpos=0;
+    if(rlen<=0) { rlen=0; return -2; }
+  }
+  return rbuf[rpos++];
+}
+
+static int hexDigit(int c)
+{
+  if(c>='0' && c<='9') return c-'0';
+  if(c>='a' && c<='f') return c-'a'+10;
+  if(c>='A' && c<='F') return c-'A'+10;
+  return -1;
+}
+
+static void hexEncode(char *out,const uint8_t *buf,int len)
+{
+  static const char digits[]="0123456789abcdef";
+  for(int i=0 ; i<len ; i++)
+  {
+    *out++=digits[buf[i]>>4];
+    *out++=digits[buf[i]&15];
+  }
+  *out=0;
+}
+
+static int hexDecode(uint8_t *buf,const char *in,int len)
+{
+  for(int i=0 ; i<len ; i++)
+  {
+    int h=hexDigit(in[2*i]),l=hexDigit(in[2*i+1]);
+    if(h<0 || l<0) return -1;
+    buf[i]=(h<<4)|l;
+  }
+  return 0;
+}
+
+/**
+ * One packet, without $ and checksum, into buf. Returns its length,
+ * 0 for an interrupt (^C), -1 if GDB went away.
+ */
+static int getPacket(char *buf)
+{
+  for(;;)
+  {
+    int c=netGetc(-1);
+    if(c<0) return -1;
+    if(c==0x03) return 0;
+    if(c!='$') continue;              // acks and noise
+    int len=0;
+    uint8_t sum=0;
+    while((c=netGetc(-1))>=0 && c!='#')
+    {
+      sum+=c;
+      if(len<PACKET_SIZE-1) buf[len++]=c;
+    }
+    int h=netGetc(-1),l=netGetc(-1);
+    if(c<0 || h<0 || l<0) return -1;
+    buf[len]=0;
+    if(noAck) return len;
+    if(((hexDigit(h)<<4)|hexDigit(l))==sum)
+    {
+      send(client,"+",1,0);
+      return len;
+    }
+    send(client,"-",1,0);
+  }
+}
+
+static void putPacket(const char *data)
+{
+  static char out[2*PACKET_SIZE+4];
+  uint8_t sum=0;
+  int len=strlen(data);
+  for(int i=0 ; i<len ; i++) sum+=data[i];
+  int n=snprintf(out,sizeof(out),"$%s#%02x",data,sum);
+  for(int tries=0 ; tries<3 ; tries++)
+  {
+    if(send(client,out,n,0)!=n) return;
+    if(noAck) return;
+    int c;
+    while((c=netGetc(1000))>=0 && c!='+' && c!='-')
+      ;
+    if(c!='-') return;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////
+////                          COMMANDS                           ////
+/////////////////////////////////////////////////////////////////////
+
+/**
+ * Let the CPU run until it halts on a breakpoint, or GDB interrupts it.
+ * Returns the stop reply, NULL if GDB went away.
+ */
+static const char *run()
+{
+  cc_resume();
+  for(;;)
+  {
+    int c=netGetc(POLL_MS);
+    if(c==-2) return NULL;
+    if(c==0x03)
+    {
+      cc_halt();
+      return "S02";
+    }
+    if(cc_getStatus() & 0x20)         // CPU_HALTED
+      return "S05";
+    if(cc_error())
+    {
+      LOG_ERR("target lost.");
+      return "X0b";
+    }
+  }
+}
+
+static void monitor(const char *hex,char *reply)
+{
+  char cmd[128];
+  int len=strlen(hex)/2;
+  if(len>=sizeof(cmd) || hexDecode((uint8_t *)cmd,hex,len)) { strcpy(reply,"E01"); return; }
+  cmd[len]=0;
+  char text[256];
+  if(!strcmp(cmd,"flush"))
+  {
+    flushCaches();
+    snprintf(text,sizeof(text),"caches dropped\n");
+  }
+  else if(!strcmp(cmd,"stats"))
+    snprintf(text,sizeof(text),"%lu packets, %lu bytes to GDB, %lu read from the target, %lu debug commands saved\n",
+	packets,bytesServed,bytesRead,cc_regsSaved());
+  else if(!strcmp(cmd,"reset"))
+  {
+    cc_enter();
+    flushCaches();
+    // the reset cleared the hardware breakpoints
+    for(int n=0 ; n<CC_BREAKPOINTS ; n++)
+      if(breakUsed[n]) cc_setBreakpoint(n,codeFlash(breaks[n]));
+    snprintf(text,sizeof(text),"target reset, ID %04x\n",cc_getChipID());
+  }
+  else
+    snprintf(text,sizeof(text),"monitor commands : flush, stats, reset\n");
+  hexEncode(reply,(uint8_t *)text,strlen(text));
+}
+
+/**
+ * Answer one packet. Returns 0, or -1 to end the session.
+ */
+static int serve(char *pkt,char *reply)
+{
+  static uint8_t buf[PACKET_SIZE];
+  unsigned long addr,len;
+  char *p;
+  const char *stop;
+  *reply=0;
+  switch(pkt[0])
+  {
+    case '?' :
+      strcpy(reply,"S05");
+      break;
+    case 'g' :
+    {
+      uint8_t regs[REGS_BYTES];
+      int n=0;
+      for(int r=0 ; r<NB_REGS ; r++)
+        n+=regGet(r,regs+n);
+      if(cc_error()) strcpy(reply,"E01");
+      else hexEncode(reply,regs,n);
+      break;
+    }
+    case 'G' :
+    {
+      uint8_t regs[REGS_BYTES];
+      if(strlen(pkt+1)<2*REGS_BYTES || hexDecode(regs,pkt+1,REGS_BYTES)) { strcpy(reply,"E01"); break; }
+      uint8_t cur[REGS_BYTES];
+      for(int r=0,n=0 ; r<NB_REGS ; n+=regGet(r,cur+n),r++)
+        ;
+      for(int r=0,n=0 ; r<NB_REGS ; r++)
+      {
+        int size=r==REG_PC ? 4 : 1;
+        if(memcmp(cur+n,regs+n,size)) regSet(r,regs+n);
+        n+=size;
+      }
+      strcpy(reply,"OK");
+      break;
+    }
+    case 'p' :
+    {
+      uint8_t regs[4];
+      int r=strtoul(pkt+1,NULL,16);
+      if(r>=NB_REGS) { strcpy(reply,"E01"); break; }
+      hexEncode(reply,regs,regGet(r,regs));
+      break;
+    }
+    case 'P' :
+    {
+      uint8_t regs[4];
+      int r=strtoul(pkt+1,&p,16);
+      int size=r==REG_PC ? 4 : 1;
+      if(r>=NB_REGS || *p!='=' || hexDecode(regs,p+1,size)) { strcpy(reply,"E01"); break; }
+      regSet(r,regs);
+      strcpy(reply,"OK");
+      break;
+    }
+    case 'm' :
+      addr=strtoul(pkt+1,&p,16);
+      len=strtoul(p+1,NULL,16);
+      if(*p!=',' || len>=sizeof(buf) || memRead(addr,buf,len) || cc_error())
+        strcpy(reply,"E01");
+      else
+      {
+        hexEncode(reply,buf,len);
+        bytesServed+=len;
+      }
+      break;
+    case 'M' :
+      addr=strtoul(pkt+1,&p,16);
+      len=strtoul(p+1,&p,16);
+      if(*p!=':' || len>=sizeof(buf) || hexDecode(buf,p+1,len) || memWrite(addr,buf,len) || cc_error())
+        strcpy(reply,"E01");
+      else
+        strcpy(reply,"OK");
+      break;
+    case 'c' :
+    case 's' :
+      if(pkt[1])
+      {
+        uint8_t regs[4];
+        addr=strtoul(pkt+1,NULL,16);
+        for(int i=0 ; i<4 ; i++) regs[i]=addr>>(8*i);
+        regSet(REG_PC,regs);
+      }
+      if(pkt[0]=='s')
+      {
+        cc_step();
+        stop="S05";
+      }
+      else if(!(stop=run()))
+        return -1;
+      strcpy(reply,stop);
+      break;
+    case 'Z' :
+    case 'z' :
+      // 0 : software, 1 : hardware, both on the chip's comparators
+      if(pkt[1]!='0' && pkt[1]!='1') break;
+      addr=strtoul(pkt+3,NULL,16);
+      if(pkt[0]=='Z' ? breakInsert(addr) : breakRemove(addr)) strcpy(reply,"E01");
+      else strcpy(reply,"OK");
+      break;
+    case 'H' :
+      strcpy(reply,"OK");
+      break;
+    case 'D' :
+      putPacket("OK");
+      return -1;
+    case 'k' :
+      return -1;
+    case 'q' :
+      if(!strncmp(pkt,"qSupported",10))
+        sprintf(reply,"PacketSize=%x;QStartNoAckMode+",PACKET_SIZE);
+      else if(!strcmp(pkt,"qAttached"))
+        strcpy(reply,attach ? "1" : "0");
+      else if(!strncmp(pkt,"qRcmd,",6))
+        monitor(pkt+6,reply);
+      break;
+    case 'Q' :
+      if(!strcmp(pkt,"QStartNoAckMode"))
+      {
+        putPacket("OK");
+        noAck=1;
+        return 0;
+      }
+      break;
+  }
+  putPacket(reply);
+  return 0;
+}
+
+void helpo()
+{
+  fprintf(stderr,"usage : cc_gdb [-v] [-q] [-a] [--xosc] [-g gpiochip] [-d pin_DD] [-c pin_DC] [-r pin_reset] [-l address] [-p port]\n");
+  fprintf(stderr,"	-g : gpiochip name, or sim (default " GPIOCHIP ")\n");
+  fprintf(stderr,"	-c : change pin_DC (default " PIN_STR(PIN_DC) ")\n");
+  fprintf(stderr,"	-d : change pin_DD (default " PIN_STR(PIN_DD) ")\n");
+  fprintf(stderr,"	-r : change reset pin (default " PIN_STR(PIN_RST) ")\n");
+  fprintf(stderr,"	-v : more messages (repeat for debug, trace)\n");
+  fprintf(stderr,"	-q : quiet\n");
+  fprintf(stderr,"	-a, --attach : debug the running firmware, else reset the chip\n");
+  fprintf(stderr,"	--xosc : run the target on its 32 MHz crystal while debugging\n");
+  fprintf(stderr,"	-l : address to listen on (default 127.0.0.1)\n");
+  fprintf(stderr,"	-p : TCP port (default 3333)\n");
+}
+
+int main(int argc,char *argv[])
+{
+  int opt;
+  int xosc=0;
+  int port=3333;
+  const char *listenAddr="127.0.0.1";
+  static struct option longopts[] =
+  {
+    { "attach", no_argument, NULL, 'a' },
+    { "xosc", no_argument, NULL, 'X' },
+    { NULL, 0, NULL, 0 }
+  };
+  int rePin=-1;
+  int dcPin=-1;
+  int ddPin=-1;
+  char *chipName=GPIOCHIP;
+  cc_logInit();
+  while( (opt=getopt_long(argc,argv,"g:d:c:r:l:p:avqh?",longopts,NULL)) != -1)
+  {
+    switch(opt)
+    {
+     case 'g' : // gpiochip
+      chipName=optarg;
+      break;
+     case 'd' : // DD pinglo
+      ddPin=atoi(optarg);
+      break;
+     case 'c' : // DC pinglo
+      dcPin=atoi(optarg);
+      break;
+     case 'r' : // restarigi pinglo
+      rePin=atoi(optarg);
+      break;
+     case 'l' : // listen address
+      listenAddr=optarg;
+      break;
+     case 'p' : // port
+      port=atoi(optarg);
+      break;
+     case 'a' : // attach
+      attach=1;
+      break;
+     case 'X' : // 32 MHz crystal
+      xosc=1;
+      break;
+     case 'v' : // verbose
+      cc_logVerbosity(1);
+      break;
+     case 'q' : // quiet
+      cc_logVerbosity(-1);
+      break;
+     case 'h' : // helpo
+     case '?' : // helpo
+      helpo();
+      exit(0);
+      break;
+    }
+  }
+
+  struct sockaddr_in sa={ .sin_family=AF_INET, .sin_port=htons(port) };
+  if(inet_pton(AF_INET,listenAddr,&sa.sin_addr)!=1) { fprintf(stderr," bad address %s.\n",listenAddr); exit(1); }
+  int srv=socket(AF_INET,SOCK_STREAM,0);
+  int one=1;
+  setsockopt(srv,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+  if(srv<0 || bind(srv,(struct sockaddr *)&sa,sizeof(sa)) || listen(srv,1))
+  {
+    perror("cc_gdb");
+    exit(1);
+  }
+  signal(SIGPIPE,SIG_IGN);
+
+  // initialize GPIO and debugger
+  cc_init(chipName,rePin,dcPin,ddPin);
+  cc_useXOSC(xosc);
+  if(attach)
+  {
+    if(cc_attach())
+    {
+      fprintf(stderr," not in debug mode : run without --attach (resets the chip).\n");
+      cc_setActive(false);
+      exit(1);
+    }
+  }
+  else
+    cc_enter();
+  uint16_t ID=cc_getChipID();
+  LOG_INFO("ID = %04x, waiting for GDB on %s:%d.",ID,listenAddr,port);
+
+  client=accept(srv,NULL,NULL);
+  close(srv);
+  if(client<0) { perror("cc_gdb"); cc_setActive(false); exit(1); }
+  setsockopt(client,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+  LOG_INFO("GDB connected.");
+
+  static char pkt[PACKET_SIZE],reply[2*PACKET_SIZE];
+  int len;
+  while((len=getPacket(pkt))>=0)
+  {
+    if(len==0) continue;              // ^C while halted
+    packets++;
+    LOG_DEBUG("<- %s",pkt);
+    if(serve(pkt,reply)) break;
+  }
+  close(client);
+  breakClearAll();
+  LOG_INFO("%lu packets, %lu bytes to GDB, %lu read from the target.",packets,bytesServed,bytesRead);
+  cc_setActive(false);
+  return 0;
+}
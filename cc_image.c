@@ -0,0 +1,87 @@
+/***********************************************************************
+    Convert flash images between Intel HEX, raw binary and sparse image.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "CCLog.h"
+#include "CCFlash.h"
+#include "CCImage.h"
+
+void helpo()
+{
+  fprintf(stderr,"usage : cc_image [-v] [-q] [-f hex|bin|sparse] in_file out_file\n");
+  fprintf(stderr,"	in_file : Intel HEX, sparse image or raw binary (.bin)\n");
+  fprintf(stderr,"	-f : output format (default from out_file extension : .hex .ihx .bin, else sparse)\n");
+  fprintf(stderr,"	out_file : - for stdout\n");
+  fprintf(stderr,"	-v : list pages with their CRC16\n");
+  fprintf(stderr,"	-q : quiet\n");
+}
+
+int main(int argc,char *argv[])
+{
+  int opt;
+  int format=-1;
+  cc_logInit();
+  while( (opt=getopt(argc,argv,"f:vqh?")) != -1)
+  {
+    switch(opt)
+    {
+     case 'f' : // output format
+      format=image_format(optarg);
+      if(format<0) { fprintf(stderr," unknown format %s.\n",optarg); exit(1); }
+      break;
+     case 'v' : // verbose
+      cc_logVerbosity(1);
+      break;
+     case 'q' : // quiet
+      cc_logVerbosity(-1);
+      break;
+     case 'h' : // helpo
+     case '?' : // helpo
+      helpo();
+      exit(0);
+      break;
+    }
+  }
+  if( optind+2 != argc ) { helpo(); exit(1); }
+  const char *in=argv[optind], *out=argv[optind+1];
+  if(format<0) format=image_formatOf(out,IMAGE_SPARSE);
+
+  struct image img;
+  imageInit(&img);
+  if(image_load(in,&img,-1)) exit(1);
+
+  int count=0;
+  for(int page=0 ; page<=img.maxpage ; page++)
+  {
+    struct page *p=img.pages[page];
+    if(!p || p->maxoffset<p->minoffset) continue;
+    if(!p->hasCrc) image_pageCRC(p);
+    LOG_INFO("page %3d : 0x%03x-0x%03x crc %04x",page,p->minoffset,p->maxoffset,p->crc);
+    count++;
+  }
+
+  int res=image_save(out,&img,format);
+  if(res) exit(1);
+  LOG_INFO("%d pages written to %s.",count,out);
+  imageFree(&img);
+  return 0;
+}
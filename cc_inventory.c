@@ -0,0 +1,297 @@
+/***********************************************************************
+    Inventory : chip, IEEE address and firmware fingerprint of every target.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+/*
+ * Targets are listed as for cc_fleet, one per line :
+ *   station name gpiochip pin_reset pin_DC pin_DD
+ * Each station is probed by a thread of its own, its targets in turn.
+ * The fingerprint is computed by the target (see flashCRC) : CRC32 of the
+ * CRC16s of each 32 KB bank, most significant byte first, so that a
+ * dongle costs a few debug commands rather than a full read.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "CCDebugger.h"
+#include "CCLog.h"
+#include "CCInventory.h"
+#include "CCFlash.h"
+#include "CCImage.h"
+
+#define BANK_SIZE      0x8000
+
+struct target
+{
+  const struct invTarget *inv;
+  struct ccTarget *cc;
+  // found
+  const char *status;     // NULL if all went well
+  uint16_t ID;
+  int flashKB;
+  uint8_t ieee[8];
+  int pages;              // fingerprinted from page 0
+  uint32_t fingerprint;
+  uint64_t ns;
+};
+
+struct station
+{
+  pthread_t thread;
+  struct target *targets[INV_MAX_TARGETS];
+  int count;
+};
+
+struct inventory inv;
+struct target targets[INV_MAX_TARGETS];
+int nbTargets;
+struct station stations[INV_MAX_STATIONS];
+int nbStations;
+
+int attach=0;
+int fpPages=-1;           // -1 : all pages but the last one
+
+const char *chipName(uint16_t ID)
+{
+  switch(ID>>8)
+  {
+    case 0xA5 : return "CC2530";
+    case 0xB5 : return "CC2531";
+    case 0x95 : return "CC2533";
+    case 0x8D : return "CC2540";
+    case 0x41 : return "CC2541";
+  }
+  return "unknown";
+}
+
+int fingerprint(struct target *t)
+{
+  int pages=t->flashKB*1024/FLASH_PAGE_SIZE;
+  // the last page holds the lock bits and the secondary IEEE address
+  t->pages = fpPages<0 ? pages-1 : (fpPages<pages ? fpPages : pages);
+  uint32_t fp=0;
+  int left=t->pages*FLASH_PAGE_SIZE;
+  for(int bank=0 ; left>0 ; bank++)
+  {
+    int len=left<BANK_SIZE ? left : BANK_SIZE;
+    uint16_t crc;
+    if(flashCRC(bank,0,len,&crc)) return -1;
+    uint8_t b[2]={ crc>>8, crc&0xff };
+    fp=cc_crc32(fp,b,2);
+    left-=len;
+  }
+  t->fingerprint=fp;
+  return 0;
+}
+
+void probe(struct target *t)
+{
+  uint64_t start=flash_now();
+  cc_select(t->cc);
+  if(attach)
+  {
+    if(cc_attach()) { t->status="no debug session"; return; }
+  }
+  else
+    cc_enter();
+  t->ID=cc_getChipID();
+  if(cc_error() || t->ID==0 || t->ID==0xffff)
+  {
+    t->status="no dongle";
+    return;
+  }
+  t->flashKB=flashSize()/1024;
+  readIEEE(t->ieee);
+  // the CRC routine runs from SRAM, which belongs to a running firmware
+  if(!attach && fingerprint(t)) t->status="CRC routine failed";
+  cc_exit();
+  if(!t->status && cc_error()) t->status="lost";
+  t->ns=flash_now()-start;
+}
+
+void *stationLoop(void *arg)
+{
+  struct station *s=arg;
+  for(int i=0 ; i<s->count ; i++)
+  {
+    probe(s->targets[i]);
+    if(s->targets[i]->status)
+      LOG_WARN("%s/%s : %s.",s->targets[i]->inv->station,s->targets[i]->inv->name,s->targets[i]->status);
+  }
+  return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////
+////                           OUTPUT                            ////
+/////////////////////////////////////////////////////////////////////
+
+void printCSV(FILE *f)
+{
+  fprintf(f,"station,target,gpiochip,chip,id,revision,flash_kb,ieee,pages,fingerprint,ms,status\n");
+  for(int i=0 ; i<nbTargets ; i++)
+  {
+    struct target *t=&targets[i];
+    fprintf(f,"%s,%s,%s,",t->inv->station,t->inv->name,t->inv->chip);
+    if(t->ID && t->ID!=0xffff)
+      fprintf(f,"%s,%02x,%02x,",chipName(t->ID),t->ID>>8,t->ID&0xff);
+    else
+      fprintf(f,",,,");
+    if(t->flashKB)
+      fprintf(f,"%d,%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x,",t->flashKB,
+	t->ieee[7],t->ieee[6],t->ieee[5],t->ieee[4],t->ieee[3],t->ieee[2],t->ieee[1],t->ieee[0]);
+    else
+      fprintf(f,",,");
+    if(!t->status && attach)
+      fprintf(f,",,%.0f,ok\n",t->ns*1e-6);
+    else if(!t->status)
+      fprintf(f,"%d,%08x,%.0f,ok\n",t->pages,t->fingerprint,t->ns*1e-6);
+    else
+      fprintf(f,",,,%s\n",t->status);
+  }
+}
+
+void printJSON(FILE *f)
+{
+  fprintf(f,"[\n");
+  for(int i=0 ; i<nbTargets ; i++)
+  {
+    struct target *t=&targets[i];
+    fprintf(f,"  {\"station\": \"%s\", \"target\": \"%s\", \"gpiochip\": \"%s\"",t->inv->station,t->inv->name,t->inv->chip);
+    if(t->ID && t->ID!=0xffff)
+      fprintf(f,", \"chip\": \"%s\", \"id\": \"%02x\", \"revision\": \"%02x\"",chipName(t->ID),t->ID>>8,t->ID&0xff);
+    if(t->flashKB)
+      fprintf(f,", \"flash_kb\": %d, \"ieee\": \"%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x\"",t->flashKB,
+	t->ieee[7],t->ieee[6],t->ieee[5],t->ieee[4],t->ieee[3],t->ieee[2],t->ieee[1],t->ieee[0]);
+    if(!t->status && attach)
+      fprintf(f,", \"ms\": %.0f, \"status\": \"ok\"}",t->ns*1e-6);
+    else if(!t->status)
+      fprintf(f,", \"pages\": %d, \"fingerprint\": \"%08x\", \"ms\": %.0f, \"status\": \"ok\"}",t->pages,t->fingerprint,t->ns*1e-6);
+    else
+      fprintf(f,", \"status\": \"%s\"}",t->status);
+    fprintf(f,"%s\n",i+1<nbTargets ? "," : "");
+  }
+  fprintf(f,"]\n");
+}
+
+/////////////////////////////////////////////////////////////////////
+////                            MAIN                             ////
+/////////////////////////////////////////////////////////////////////
+
+void helpo()
+{
+  fprintf(stderr,"usage : cc_inventory [-v] [-q] [-a] [--xosc] [-p pages] [-j] [-o file] -i inventory\n");
+  fprintf(stderr,"	-i : targets, one per line : station name gpiochip pin_reset pin_DC pin_DD\n");
+  fprintf(stderr,"	-p : pages fingerprinted from page 0 (default all but the last one)\n");
+  fprintf(stderr,"	-j, --json : JSON rather than CSV\n");
+  fprintf(stderr,"	-o : output file (default stdout)\n");
+  fprintf(stderr,"	-a, --attach : join the debug sessions left by a previous command, without resetting the chips (no fingerprint)\n");
+  fprintf(stderr,"	--xosc : run the targets on their 32 MHz crystal while debugging\n");
+  fprintf(stderr,"	-v : more messages (repeat for debug, trace)\n");
+  fprintf(stderr,"	-q : quiet\n");
+}
+
+int main(int argc,char *argv[])
+{
+  int opt;
+  const char *inventory=NULL;
+  const char *outPath=NULL;
+  int json=0;
+  int xosc=0;
+  static struct option longopts[] =
+  {
+    { "json", no_argument, NULL, 'j' },
+    { "attach", no_argument, NULL, 'a' },
+    { "xosc", no_argument, NULL, 'X' },
+    { NULL, 0, NULL, 0 }
+  };
+  cc_logInit();
+  while( (opt=getopt_long(argc,argv,"i:p:o:javqh?",longopts,NULL)) != -1)
+  {
+    switch(opt)
+    {
+     case 'i' : // inventory
+      inventory=optarg;
+      break;
+     case 'p' : // pages
+      fpPages=atoi(optarg);
+      if(fpPages<0) fpPages=0;
+      break;
+     case 'o' : // output
+      outPath=optarg;
+      break;
+     case 'j' : // json
+      json=1;
+      break;
+     case 'a' : // attach
+      attach=1;
+      break;
+     case 'v' : // verbose
+      cc_logVerbosity(1);
+      break;
+     case 'q' : // quiet
+      cc_logVerbosity(-1);
+      break;
+     case 'X' : // 32 MHz crystal
+      xosc=1;
+      break;
+     case 'h' : // helpo
+     case '?' : // helpo
+      helpo();
+      exit(0);
+      break;
+    }
+  }
+  if(!inventory || optind<argc) { helpo(); exit(1); }
+  if(inv_load(inventory,&inv)) exit(1);
+  nbTargets=inv.nbTargets;
+  nbStations=inv.nbStations;
+  FILE *out=stdout;
+  if(outPath && !(out=fopen(outPath,"w"))) { fprintf(stderr," Can't open file %s.\n",outPath); exit(1); }
+
+  // one thread per station
+  for(int i=0 ; i<nbTargets ; i++)
+  {
+    struct target *t=&targets[i];
+    t->inv=&inv.targets[i];
+    int s=t->inv->stationIndex;
+    stations[s].targets[stations[s].count++]=t;
+    t->cc=cc_open(t->inv->chip,t->inv->rst,t->inv->dc,t->inv->dd);
+    if(!t->cc) exit(1);
+    cc_useXOSC(xosc);
+  }
+  LOG_INFO("%d targets, %d stations.",nbTargets,nbStations);
+  for(int s=0 ; s<nbStations ; s++)
+    pthread_create(&stations[s].thread,NULL,stationLoop,&stations[s]);
+  for(int s=0 ; s<nbStations ; s++)
+    pthread_join(stations[s].thread,NULL);
+
+  int failed=0;
+  for(int i=0 ; i<nbTargets ; i++)
+  {
+    cc_select(targets[i].cc);
+    cc_setActive(false);
+    if(targets[i].status) failed++;
+  }
+  if(json) printJSON(out); else printCSV(out);
+  if(out!=stdout) fclose(out);
+  return failed ? 1 : 0;
+}
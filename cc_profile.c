@@ -0,0 +1,314 @@
+/***********************************************************************
+  Copyright © 2019 Jean Michault.
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "CCDebugger.h"
+#include "CCRealtime.h"
+#include "CCLog.h"
+#include "CCFlash.h"
+#include "CCRegs.h"
+#include "CCMap.h"
+
+#define CODE_SIZE  (FLASH_PAGES*FLASH_PAGE_SIZE)
+
+/**
+ * Samples, by physical flash address : code space 0x0000-0x7FFF is bank 0,
+ * 0x8000-0xFFFF the bank selected by FMAP
+ */
+uint32_t *hist;
+unsigned long nbSamples;
+uint64_t haltedNs;
+
+volatile sig_atomic_t stop;
+
+void onSignal(int sig)
+{
+  stop=1;
+}
+
+struct symbolMap map;
+unsigned long *symSamples;
+
+/////////////////////////////////////////////////////////////////////
+////                           REPORT                            ////
+/////////////////////////////////////////////////////////////////////
+
+struct entry
+{
+  const char *name;
+  char addrName[12];
+  uint32_t addr;
+  unsigned long samples;
+};
+
+static int entryCompare(const void *a,const void *b)
+{
+  const struct entry *ea=a,*eb=b;
+  if(ea->samples!=eb->samples) return ea->samples>eb->samples ? -1 : 1;
+  return ea->addr<eb->addr ? -1 : ea->addr>eb->addr;
+}
+
+void report(FILE *out,int collapsed,double seconds,int rate)
+{
+  // samples by symbol, or by address without map
+  int unresolved=0;
+  symSamples=calloc(map.count+1,sizeof(*symSamples));
+  if(!symSamples) { fprintf(stderr," out of memory.\n"); exit(1); }
+  for(uint32_t a=0 ; a<CODE_SIZE ; a++)
+  {
+    if(!hist[a]) continue;
+    int s=map_find(&map,a);
+    if(s>=0) symSamples[s]+=hist[a];
+    else unresolved++;
+  }
+  struct entry *entries=calloc(map.count+unresolved+1,sizeof(struct entry));
+  int nb=0;
+  if(!entries) { fprintf(stderr," out of memory.\n"); exit(1); }
+  for(uint32_t a=0 ; a<CODE_SIZE ; a++)
+  {
+    if(!hist[a] || map_find(&map,a)>=0) continue;
+    struct entry *e=&entries[nb++];
+    e->addr=a;
+    e->samples=hist[a];
+    snprintf(e->addrName,sizeof(e->addrName),"0x%05x",a);
+    e->name=e->addrName;
+  }
+  for(int i=0 ; i<map.count ; i++)
+  {
+    if(!symSamples[i]) continue;
+    struct entry *e=&entries[nb++];
+    e->addr=map.syms[i].addr;
+    e->samples=symSamples[i];
+    e->name=map.syms[i].name;
+  }
+  qsort(entries,nb,sizeof(*entries),entryCompare);
+
+  if(collapsed)
+  {
+    // no call stack on the 8051 side : one frame below the bank
+    for(int i=0 ; i<nb ; i++)
+      fprintf(out,"bank%d;%s %lu\n",entries[i].addr>>15,entries[i].name,entries[i].samples);
+  }
+  else
+  {
+    fprintf(out,"# %lu samples in %.1f s (%d Hz asked), CPU halted %.2f%% of the time\n",
+	nbSamples,seconds,rate,seconds>0 ? haltedNs*1e-7/seconds : 0.);
+    fprintf(out,"#  samples       %%  address  symbol\n");
+    for(int i=0 ; i<nb ; i++)
+      fprintf(out,"%10lu  %5.1f%%  0x%05x  %s\n",entries[i].samples,
+	entries[i].samples*100./nbSamples,entries[i].addr,entries[i].name);
+  }
+  free(entries);
+  free(symSamples);
+}
+
+/////////////////////////////////////////////////////////////////////
+////                          SAMPLING                           ////
+/////////////////////////////////////////////////////////////////////
+
+/**
+ * One sample : halt, PC, FMAP when in the banked area, resume.
+ * XCH A,FMAP twice reads FMAP and leaves A and FMAP as they were.
+ */
+int sample()
+{
+  uint64_t t0=flash_now();
+  cc_halt();
+  uint16_t pc=cc_getPC();
+  uint8_t bank=1;
+  if(pc>=0x8000)
+  {
+    bank=cc_exec2(0xC5,SFR_FMAP);
+    cc_exec2(0xC5,SFR_FMAP);
+  }
+  cc_resume();
+  haltedNs+=flash_now()-t0;
+  if(cc_error()) return -1;
+  hist[map_physAddr(bank,pc)]++;
+  nbSamples++;
+  return 0;
+}
+
+static void sleepUntil(uint64_t t)
+{
+  struct timespec ts={ t/1000000000ULL, t%1000000000ULL };
+  while(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL) && !stop)
+    ;
+}
+
+void helpo()
+{
+  fprintf(stderr,"usage : cc_profile [-v] [-q] [--realtime[=cpu]] [-a] [-g gpiochip] [-d pin_DD] [-c pin_DC] [-r pin_reset] [-f rate] [-t seconds] [-n samples] [-m map_file] [--collapsed] [-o out_file]\n");
+  fprintf(stderr,"	-g : gpiochip name, or sim (default " GPIOCHIP ")\n");
+  fprintf(stderr,"	-c : change pin_DC (default " PIN_STR(PIN_DC) ")\n");
+  fprintf(stderr,"	-d : change pin_DD (default " PIN_STR(PIN_DD) ")\n");
+  fprintf(stderr,"	-r : change reset pin (default " PIN_STR(PIN_RST) ")\n");
+  fprintf(stderr,"	-v : more messages (repeat for debug, trace)\n");
+  fprintf(stderr,"	-q : quiet, no progress\n");
+  fprintf(stderr,"	--realtime[=cpu] : lock memory, pin to cpu and run SCHED_FIFO\n");
+  fprintf(stderr,"	-a, --attach : profile the running firmware, else reset the chip and start it\n");
+  fprintf(stderr,"	-f : samples per second (default 1000)\n");
+  fprintf(stderr,"	-t : duration in seconds (default 10, Ctrl-C stops earlier)\n");
+  fprintf(stderr,"	-n : stop after this number of samples\n");
+  fprintf(stderr,"	-m : map file (nm, SDCC or IAR) to resolve addresses to symbols\n");
+  fprintf(stderr,"	--collapsed : bank;symbol count lines, for flamegraph.pl\n");
+  fprintf(stderr,"	-o : output file (default stdout)\n");
+}
+
+int main(int argc,char *argv[])
+{
+  int opt;
+  int realtime=0;
+  int rtCpu=-1;
+  int attach=0;
+  int collapsed=0;
+  int rate=1000;
+  double duration=10;
+  unsigned long maxSamples=0;
+  const char *mapPath=NULL;
+  const char *outPath=NULL;
+  static struct option longopts[] =
+  {
+    { "realtime", optional_argument, NULL, 'R' },
+    { "attach", no_argument, NULL, 'a' },
+    { "collapsed", no_argument, NULL, 'L' },
+    { NULL, 0, NULL, 0 }
+  };
+  int rePin=-1;
+  int dcPin=-1;
+  int ddPin=-1;
+  char *chipName=GPIOCHIP;
+  cc_logInit();
+  while( (opt=getopt_long(argc,argv,"g:d:c:r:f:t:n:m:o:avqh?",longopts,NULL)) != -1)
+  {
+    switch(opt)
+    {
+     case 'g' : // gpiochip
+      chipName=optarg;
+      break;
+     case 'd' : // DD pinglo
+      ddPin=atoi(optarg);
+      break;
+     case 'c' : // DC pinglo
+      dcPin=atoi(optarg);
+      break;
+     case 'r' : // restarigi pinglo
+      rePin=atoi(optarg);
+      break;
+     case 'f' : // rate
+      rate=atoi(optarg);
+      if(rate<1) rate=1;
+      break;
+     case 't' : // duration
+      duration=atof(optarg);
+      break;
+     case 'n' : // samples
+      maxSamples=strtoul(optarg,NULL,0);
+      break;
+     case 'm' : // map file
+      mapPath=optarg;
+      break;
+     case 'o' : // output
+      outPath=optarg;
+      break;
+     case 'L' : // collapsed stacks
+      collapsed=1;
+      break;
+     case 'a' : // attach
+      attach=1;
+      break;
+     case 'v' : // verbose
+      cc_logVerbosity(1);
+      break;
+     case 'q' : // quiet
+      cc_logVerbosity(-1);
+      break;
+     case 'R' : // realtime
+      realtime=1;
+      if(optarg) rtCpu=atoi(optarg);
+      break;
+     case 'h' : // helpo
+     case '?' : // helpo
+      helpo();
+      exit(0);
+      break;
+    }
+  }
+  hist=calloc(CODE_SIZE,sizeof(*hist));
+  if(!hist) { fprintf(stderr," out of memory.\n"); exit(1); }
+  if(mapPath && map_load(mapPath,&map)) exit(1);
+  FILE *out=stdout;
+  if(outPath && !(out=fopen(outPath,"w"))) { perror(outPath); exit(1); }
+
+  // initialize GPIO and debugger
+  cc_init(chipName,rePin,dcPin,ddPin);
+  if(realtime) cc_realtime(rtCpu);
+  if(attach)
+  {
+    if(cc_attach())
+    {
+      fprintf(stderr," not in debug mode : run without --attach (resets the chip).\n");
+      cc_setActive(false);
+      exit(1);
+    }
+  }
+  else
+    cc_enter();
+  uint16_t ID=cc_getChipID();
+  LOG_INFO("ID = %04x.",ID);
+  // the firmware runs between samples
+  cc_resume();
+
+  signal(SIGINT,onSignal);
+  signal(SIGTERM,onSignal);
+  // sampling at a fixed rate would lock onto periodic firmware loops :
+  // intervals are drawn within +-25%
+  uint64_t period=1000000000ULL/rate;
+  uint64_t start=flash_now(),next=start;
+  uint64_t end=start+(uint64_t)(duration*1e9);
+  unsigned long expected=maxSamples ? maxSamples : (unsigned long)(duration*rate);
+  srand(start);
+  while(!stop && (!maxSamples || nbSamples<maxSamples))
+  {
+    next+=period*3/4+(uint64_t)rand()%(period/2+1);
+    if(!maxSamples && next>=end) break;
+    if(next>flash_now()) sleepUntil(next);
+    else next=flash_now();   // slower than asked : no catching up
+    if(stop) break;
+    if(sample())
+    {
+      LOG_ERR("target lost after %lu samples.",nbSamples);
+      break;
+    }
+    cc_progress(nbSamples,expected,"samples");
+  }
+  double seconds=(flash_now()-start)*1e-9;
+  if(realtime) fprintf(stderr,"  %lu deadline overruns.\n",cc_rtOverruns());
+  cc_setActive(false);
+
+  report(out,collapsed,seconds,rate);
+  if(out!=stdout) fclose(out);
+  return nbSamples ? 0 : 1;
+}
@@ -14,70 +14,101 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 *************************************************************************/
 
-#include <wiringPi.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
 
 #include "CCDebugger.h"
+#include "CCRealtime.h"
+#include "CCLog.h"
+#include "CCFlash.h"
+#include "CCImage.h"
+#include "CCRing.h"
+#include "CCCache.h"
+#include "CCRegs.h"
 
-void writeHexLine(FILE * fic,uint8_t *buf, int len,int offset)
-{
-int i=0;
-  for(i=0 ; i<len ; i++)
-    if(buf[i] != 0xff) break;
-  if(i==len) return;
-  int sum=len+(offset&0xff)+((offset>>8)&0xff);
-  fprintf(fic,":%02X%04X00",len,offset);
-  for(int i=0 ; i<len;i++)
-  {
-    fprintf(fic,"%02X",buf[i]);
-    sum += buf[i];
-  }
-  fprintf(fic,"%02X\n",(-sum)&0xff);
-}
+#define BLOCK_SLOTS  32
 
-uint8_t buf1[1024];
-uint8_t buf2[1024];
+/**
+ * The bus thread (main) fills 1 kB blocks, a writer thread encodes and
+ * writes them : the bus never waits for the disk while the ring has room.
+ */
+struct ring blocks;
+struct imageOut out;
 
-void read1k(int bank,uint16_t offset,uint8_t * buf)
+void *writer(void *arg)
 {
-    // get FMAP
-    uint8_t res = cc_exec2(0xE5, 0xC7); 
-    // select bank 
-    res = (res & 0xF8) | (bank & 0x07);
-    res = cc_exec3(0x75, 0xC7, res); // MOV direct,#data
-    // Setup DPTR
-    cc_execi( 0x90, 0x8000+offset ); // MOV DPTR,#data16
-    for(int i=0 ; i<1024 ;i++)
+  cc_rtWorker();
+  struct ringSlot *slot;
+  while((slot=ring_next(&blocks)))
+  {
+    if(image_outBlock(&out,slot->addr,slot->data,slot->len))
     {
-      res = cc_exec  ( 0xE0 ); // MOVX A,@DPTR
-      buf[i] = res;
-      res = cc_exec  ( 0xA3 ); // INC DPTR
+      ring_fail(&blocks);
+      break;
     }
+    ring_release(&blocks);
+  }
+  return NULL;
 }
 
+uint8_t buf2[1024];
+
 void helpo()
 {
-  fprintf(stderr,"usage : cc_read [-d pin_DD] [-c pin_DC] [-r pin_reset] out_file\n"); 
-  fprintf(stderr,"	-c : change pin_DC (default 27)\n");
-  fprintf(stderr,"	-d : change pin_DD (default 28)\n");
-  fprintf(stderr,"	-r : change reset pin (default 24)\n");
+  fprintf(stderr,"usage : cc_read [-v] [-q] [--realtime[=cpu]] [--xosc] [--echo] [-a] [-g gpiochip] [-d pin_DD] [-c pin_DC] [-r pin_reset] [--format hex|bin|sparse] [--cache[=dir]] out_file\n"); 
+  fprintf(stderr,"	-g : gpiochip name, or sim (default " GPIOCHIP ")\n");
+  fprintf(stderr,"	-c : change pin_DC (default " PIN_STR(PIN_DC) ")\n");
+  fprintf(stderr,"	-d : change pin_DD (default " PIN_STR(PIN_DD) ")\n");
+  fprintf(stderr,"	-r : change reset pin (default " PIN_STR(PIN_RST) ")\n");
+  fprintf(stderr,"	-v : more messages (repeat for debug, trace)\n");
+  fprintf(stderr,"	-q : quiet, no progress\n");
+  fprintf(stderr,"	--realtime[=cpu] : lock memory, pin to cpu and run SCHED_FIFO\n");
+  fprintf(stderr,"	--xosc : run the target on its 32 MHz crystal while debugging\n");
+  fprintf(stderr,"	--echo : check the accumulator echoed by each debug instruction, and read each block once\n");
+  fprintf(stderr,"	-a, --attach : join the debug session left by a previous command, without resetting the chip\n");
+  fprintf(stderr,"	-f, --format : output format (default from out_file extension : .bin .ccimg, else hex)\n");
+  fprintf(stderr,"	-C, --cache[=dir] : only read the pages that changed since the last dump of this dongle\n");
+  fprintf(stderr,"	out_file : - for stdout\n");
 }
 
 int main(int argc,char *argv[])
 {
   int opt;
+  int realtime=0;
+  int xosc=0;
+  int attach=0;
+  int rtCpu=-1;
+  static struct option longopts[] =
+  {
+    { "realtime", optional_argument, NULL, 'R' },
+    { "xosc", no_argument, NULL, 'X' },
+    { "echo", no_argument, NULL, 'E' },
+    { "format", required_argument, NULL, 'f' },
+    { "cache", optional_argument, NULL, 'C' },
+    { "attach", no_argument, NULL, 'a' },
+    { NULL, 0, NULL, 0 }
+  };
   int rePin=-1;
   int dcPin=-1;
   int ddPin=-1;
-  while( (opt=getopt(argc,argv,"d:c:r:h?")) != -1)
+  char *chipName=GPIOCHIP;
+  int format=-1;
+  int useCache=0;
+  char *cacheDir=NULL;
+  cc_logInit();
+  while( (opt=getopt_long(argc,argv,"g:d:c:r:f:Cavqh?",longopts,NULL)) != -1)
   {
     switch(opt)
     {
+     case 'g' : // gpiochip
+      chipName=optarg;
+      break;
      case 'd' : // DD pinglo
       ddPin=atoi(optarg);
       break;
@@ -87,6 +118,33 @@ int main(int argc,char *argv[])
      case 'r' : // restarigi pinglo
       rePin=atoi(optarg);
       break;
+     case 'v' : // verbose
+      cc_logVerbosity(1);
+      break;
+     case 'q' : // quiet
+      cc_logVerbosity(-1);
+      break;
+     case 'f' : // output format
+      format=image_format(optarg);
+      if(format<0) { fprintf(stderr," unknown format %s.\n",optarg); exit(1); }
+      break;
+     case 'C' : // cache
+      useCache=1;
+      cacheDir=optarg;
+      break;
+     case 'a' : // attach
+      attach=1;
+      break;
+     case 'X' : // 32 MHz crystal
+      xosc=1;
+      break;
+     case 'E' : // echo
+      cc_echoCheck=1;
+      break;
+     case 'R' : // realtime
+      realtime=1;
+      if(optarg) rtCpu=atoi(optarg);
+      break;
      case 'h' : // helpo
      case '?' : // helpo
       helpo();
@@ -95,49 +153,113 @@ int main(int argc,char *argv[])
     }
   }
   if( optind >= argc ) { helpo(); exit(1); }
-  FILE * ficout = fopen(argv[optind],"w");
-  if(!ficout) { fprintf(stderr," Can't open file %s.\n",argv[optind]); exit(1); }
+  // the CRC routine would run over the program's SRAM
+  if(attach && useCache) { fprintf(stderr," --cache can't be used with --attach.\n"); exit(1); }
+  if(format<0) format=image_formatOf(argv[optind],IMAGE_HEX);
+  if(image_outOpen(&out,argv[optind],format)) exit(1);
+  // before the writer thread and the ring : the thread gives the bus cpu
+  // back from the start (cc_rtWorker), the ring is locked in memory
+  if(realtime) cc_realtime(rtCpu);
+  if(ring_init(&blocks,BLOCK_SLOTS,1024)) { fprintf(stderr," out of memory.\n"); exit(1); }
+  pthread_t writerThread;
+  pthread_create(&writerThread,NULL,writer,NULL);
   //  initialize GPIO ports
-  cc_init(rePin,dcPin,ddPin);
-  // enter debug mode
-  cc_enter();
+  cc_init(chipName,rePin,dcPin,ddPin);
+  cc_useXOSC(xosc);
+  // enter debug mode, or join the running session
+  if(attach)
+  {
+    if(cc_attach())
+    {
+      fprintf(stderr," not in debug mode : run without --attach (resets the chip).\n");
+      cc_setActive(false);
+      exit(1);
+    }
+  }
+  else
+    cc_enter();
   // get ChipID :
   uint16_t ID;
   ID = cc_getChipID();
-  printf("  ID = %04x.\n",ID);
+  LOG_INFO("ID = %04x.",ID);
+
+  // pages whose CRC matches the last dump are taken from the cache
+  char *cachePath=NULL;
+  struct image cached,dump;
+  imageInit(&cached);
+  imageInit(&dump);
+  if(useCache)
+  {
+    uint8_t ieee[8];
+    readIEEE(ieee);
+    cachePath=cache_path(cacheDir,ID,ieee);
+    if(!cachePath) exit(1);
+    cache_load(cachePath,&cached);
+  }
 
-  uint16_t offset=0;
-  uint8_t bank=0;
   int progress=1;
+  int reused=0;
+  int page;
   // int nbread=0;
-  for( bank=0 ; bank<8 ; bank++)
+  for( page=0 ; page<FLASH_PAGES && !atomic_load(&blocks.failed) ; page++)
   {
-    printf(".");fflush(stdout);
-    if(! (bank&1))
-    {
-      uint8_t sum=2+4+(bank/2);
-      fprintf(ficout,":02000004%04X%02X\n",bank/2,(-sum)&255 );
-    }
-    offset=0;
-    int len=0;
-    uint8_t buf[17];
-    for ( uint16_t i=0 ; i<32 ; i++ )
+    uint8_t bank=page>>4;
+    uint16_t offset=(page&0xf)*FLASH_PAGE_SIZE;
+    uint16_t crc;
+    int fromCache = cachePath && !flashCRC(bank,offset,FLASH_PAGE_SIZE,&crc)
+		&& crc==cache_pageCRC(&cached,page);
+    reused+=fromCache;
+    for ( uint16_t i=0 ; i<2 ; i++ )
     {
-      do
+      struct ringSlot *slot=ring_claim(&blocks);
+      if(!slot) break; // output failed
+      if(fromCache)
+      {
+        struct page *p=cached.pages[page];
+        if(p) memcpy(slot->data,p->datas+i*1024,1024);
+        else memset(slot->data,0xff,1024);
+      }
+      else
       {
-        read1k(bank,i*1024, buf1);
-        read1k(bank,i*1024, buf2);
-        // nbread++;
-      } while(memcmp(buf1,buf2,1024));
-      for(uint16_t j=0 ; j<64 ; j++)
-	writeHexLine(ficout,buf1+j*16, 16,(bank&1)*32*1024+ i*1024+j*16);
-      printf("\r reading %dk/256k",progress++);fflush(stdout);
+        unsigned long overruns,echoes;
+        do
+        {
+          overruns=cc_rtOverruns();
+          echoes=cc_echoErrors();
+          read1k(bank,offset+i*1024, slot->data);
+          // in realtime mode, a read that met all its deadlines is trusted
+          if(cc_rtActive && cc_rtOverruns()==overruns) break;
+          // and with --echo, a read whose bytes were all echoed back the same
+          if(cc_echoCheck && cc_echoErrors()==echoes) break;
+          read1k(bank,offset+i*1024, buf2);
+          // nbread++;
+        } while(memcmp(slot->data,buf2,1024));
+      }
+      slot->addr=page*FLASH_PAGE_SIZE+i*1024;
+      slot->len=1024;
+      if(cachePath) image_put(&dump,slot->addr,slot->data,1024);
+      ring_publish(&blocks);
+      cc_progress(progress++,256,"reading kB");
     }
   }
   // fprintf(stderr,"nbread=%d\n",nbread);
-  fprintf(ficout,":00000001FF\n");
   // exit from debug 
+  if(realtime) fprintf(stderr,"  %lu deadline overruns.\n",cc_rtOverruns());
+  if(cc_echoCheck) fprintf(stderr,"  %lu echo errors.\n",cc_echoErrors());
   cc_setActive(false);
-  fclose(ficout);
+  ring_close(&blocks);
+  pthread_join(writerThread,NULL);
+  LOG_DEBUG("bus waited %lu times for the writer.",blocks.waits);
+  if(atomic_load(&blocks.failed)) exit(1);
+  if(image_outClose(&out)) exit(1);
+  ring_free(&blocks);
+  if(cachePath)
+  {
+    LOG_INFO("%d pages of %d taken from the cache.",reused,FLASH_PAGES);
+    if(cache_store(cachePath,&dump)) exit(1);
+    free(cachePath);
+    imageFree(&cached);
+    imageFree(&dump);
+  }
 
 }
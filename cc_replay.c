@@ -0,0 +1,297 @@
+/***********************************************************************
+  Copyright © 2019 Jean Michault.
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "CCDebugger.h"
+#include "CCLog.h"
+#include "CCRecord.h"
+
+/**
+ * Commands of a recording, by name
+ */
+#define NB_NAMES 16
+
+struct summary
+{
+  const char *names[NB_NAMES];
+  unsigned long count[NB_NAMES];
+  unsigned long bytes[NB_NAMES];
+  uint64_t busNs[NB_NAMES];
+  unsigned long commands, entries;
+  uint64_t totalNs, lastT;
+};
+
+static int nameIndex(struct summary *s,const char *name)
+{
+  for(int i=0 ; i<NB_NAMES ; i++)
+  {
+    if(!s->names[i]) s->names[i]=name;
+    if(s->names[i]==name) return i;
+  }
+  return NB_NAMES-1;
+}
+
+static void account(struct summary *s,const struct ccRecord *r)
+{
+  s->lastT=r->t+r->busNs;
+  if(r->kind==CC_RECORD_ENTER) { s->entries++; return; }
+  int i=nameIndex(s,cc_recordName(r->out[0]));
+  s->count[i]++;
+  s->bytes[i]+=r->nOut+r->nIn;
+  s->busNs[i]+=r->busNs;
+  s->commands++;
+  s->totalNs+=r->busNs;
+}
+
+static int load(const char *path,struct summary *s)
+{
+  static struct ccRecord r;
+  FILE *f=fopen(path,"rb");
+  if(!f) { perror(path); return -1; }
+  if(cc_recordStart(f,path)) { fclose(f); return -1; }
+  int res;
+  while((res=cc_recordNext(f,&r))>0)
+    account(s,&r);
+  fclose(f);
+  if(res<0) LOG_WARN("%s : truncated after %lu commands.",path,s->commands);
+  return 0;
+}
+
+/**
+ * One recording, or two side by side
+ */
+static void report(const char *pathA,struct summary *a,const char *pathB,struct summary *b)
+{
+  printf("%-14s %10s %12s %10s","command","count","bytes","bus ms");
+  if(b) printf(" %10s %12s %10s %8s","count","bytes","bus ms","delta");
+  printf("\n");
+  // names of both, in order of appearance
+  const char *names[2*NB_NAMES];
+  int n=0;
+  for(struct summary *s=a ; s ; s=(s==a ? b : NULL))
+    for(int i=0 ; i<NB_NAMES && s->names[i] ; i++)
+    {
+      int j;
+      for(j=0 ; j<n && strcmp(names[j],s->names[i]) ; j++)
+        ;
+      if(j==n) names[n++]=s->names[i];
+    }
+  for(int k=0 ; k<n ; k++)
+  {
+    struct summary *s=a;
+    int i;
+    for(i=0 ; i<NB_NAMES && s->names[i] && strcmp(s->names[i],names[k]) ; i++)
+      ;
+    int inA=i<NB_NAMES && s->names[i];
+    printf("%-14s %10lu %12lu %10.1f",names[k],inA ? s->count[i] : 0,inA ? s->bytes[i] : 0,inA ? s->busNs[i]*1e-6 : 0.);
+    if(b)
+    {
+      int j;
+      for(j=0 ; j<NB_NAMES && b->names[j] && strcmp(b->names[j],names[k]) ; j++)
+        ;
+      int inB=j<NB_NAMES && b->names[j];
+      long ca=inA ? s->count[i] : 0,cb=inB ? b->count[j] : 0;
+      printf(" %10lu %12lu %10.1f %+8ld",cb,inB ? b->bytes[j] : 0,inB ? b->busNs[j]*1e-6 : 0.,cb-ca);
+    }
+    printf("\n");
+  }
+  printf("%-14s %10lu %12s %10.1f","total",a->commands,"",a->totalNs*1e-6);
+  if(b) printf(" %10lu %12s %10.1f %+8ld",b->commands,"",b->totalNs*1e-6,(long)b->commands-(long)a->commands);
+  printf("\n%s : %lu debug mode entries, %.3f s",pathA,a->entries,a->lastT*1e-9);
+  if(b) printf("\n%s : %lu debug mode entries, %.3f s",pathB,b->entries,b->lastT*1e-9);
+  printf("\n");
+}
+
+/////////////////////////////////////////////////////////////////////
+////                           REPLAY                            ////
+/////////////////////////////////////////////////////////////////////
+
+static uint64_t now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+/**
+ * Send the commands of a recording to the target, compare the answers
+ */
+static int replay(const char *path,int paced,int maxShown)
+{
+  static struct ccRecord r;
+  FILE *f=fopen(path,"rb");
+  if(!f) { perror(path); return -1; }
+  if(cc_recordStart(f,path)) { fclose(f); return -1; }
+  struct summary rec={0},rep={0};
+  unsigned long index=0,mismatches=0;
+  int res,started=0;
+  uint64_t t0=now();
+  while((res=cc_recordNext(f,&r))>0)
+  {
+    index++;
+    account(&rec,&r);
+    if(paced)
+    {
+      // keep the pauses of the recording : the target had time to work
+      uint64_t t=t0+r.t;
+      if(t>now()) usleep((t-now())/1000);
+    }
+    if(r.kind==CC_RECORD_ENTER)
+    {
+      cc_enter();
+      started=1;
+      account(&rep,&r);
+      continue;
+    }
+    if(!started)
+    {
+      // recorded from a running session
+      if(cc_attach()) cc_enter();
+      started=1;
+    }
+    struct ccRecord got=r;
+    uint64_t t=now();
+    for(int i=0 ; i<r.nOut ; i++)
+      cc_write(r.out[i]);
+    if(r.nIn)
+    {
+      cc_switchRead(250);
+      for(int i=0 ; i<r.nIn ; i++)
+        got.in[i]=cc_read();
+      cc_switchWrite();
+    }
+    got.busNs=now()-t;
+    got.t=t-t0;
+    account(&rep,&got);
+    if(cc_error())
+    {
+      LOG_ERR("command %lu (%s) : target lost.",index,cc_recordName(r.out[0]));
+      fclose(f);
+      return -1;
+    }
+    if(memcmp(got.in,r.in,r.nIn))
+    {
+      if(mismatches++<maxShown)
+      {
+        printf("%8lu %-14s",index,cc_recordName(r.out[0]));
+        for(int i=0 ; i<r.nOut && i<4 ; i++) printf(" %02x",r.out[i]);
+        printf(" : ");
+        for(int i=0 ; i<r.nIn ; i++) printf("%02x",r.in[i]);
+        printf(" recorded, ");
+        for(int i=0 ; i<r.nIn ; i++) printf("%02x",got.in[i]);
+        printf(" replayed\n");
+      }
+    }
+  }
+  fclose(f);
+  if(res<0) LOG_WARN("%s : truncated after %lu records.",path,index);
+  report("recorded",&rec,"replayed",&rep);
+  printf("%lu of %lu answers differ.\n",mismatches,rec.commands);
+  return mismatches ? 1 : 0;
+}
+
+void helpo()
+{
+  fprintf(stderr,"usage : cc_replay [-v] [-q] recording [other_recording]\n");
+  fprintf(stderr,"        cc_replay [-v] [-q] -g gpiochip|sim [-d pin_DD] [-c pin_DC] [-r pin_reset] [-p] [-n count] recording\n");
+  fprintf(stderr,"	without -g : commands, bytes and bus time of a recording (CC_RECORD=file), or of two side by side\n");
+  fprintf(stderr,"	-g : replay on this gpiochip, or sim, and compare the answers\n");
+  fprintf(stderr,"	-c : change pin_DC (default " PIN_STR(PIN_DC) ")\n");
+  fprintf(stderr,"	-d : change pin_DD (default " PIN_STR(PIN_DD) ")\n");
+  fprintf(stderr,"	-r : change reset pin (default " PIN_STR(PIN_RST) ")\n");
+  fprintf(stderr,"	-p, --paced : keep the pauses of the recording between commands\n");
+  fprintf(stderr,"	-n : answers that differ to show (default 10)\n");
+  fprintf(stderr,"	-v : more messages (repeat for debug, trace)\n");
+  fprintf(stderr,"	-q : quiet\n");
+}
+
+int main(int argc,char *argv[])
+{
+  int opt;
+  int paced=0;
+  int maxShown=10;
+  static struct option longopts[] =
+  {
+    { "paced", no_argument, NULL, 'p' },
+    { NULL, 0, NULL, 0 }
+  };
+  int rePin=-1;
+  int dcPin=-1;
+  int ddPin=-1;
+  char *chipName=NULL;
+  cc_logInit();
+  while( (opt=getopt_long(argc,argv,"g:d:c:r:n:pvqh?",longopts,NULL)) != -1)
+  {
+    switch(opt)
+    {
+     case 'g' : // gpiochip
+      chipName=optarg;
+      break;
+     case 'd' : // DD pinglo
+      ddPin=atoi(optarg);
+      break;
+     case 'c' : // DC pinglo
+      dcPin=atoi(optarg);
+      break;
+     case 'r' : // restarigi pinglo
+      rePin=atoi(optarg);
+      break;
+     case 'p' : // paced
+      paced=1;
+      break;
+     case 'n' : // shown
+      maxShown=atoi(optarg);
+      break;
+     case 'v' : // verbose
+      cc_logVerbosity(1);
+      break;
+     case 'q' : // quiet
+      cc_logVerbosity(-1);
+      break;
+     case 'h' : // helpo
+     case '?' : // helpo
+      helpo();
+      exit(0);
+      break;
+    }
+  }
+  int nbFiles=argc-optind;
+  if(nbFiles<1 || nbFiles>2 || (chipName && nbFiles!=1)) { helpo(); exit(1); }
+
+  if(!chipName)
+  {
+    struct summary a={0},b={0};
+    if(load(argv[optind],&a)) exit(1);
+    if(nbFiles==2 && load(argv[optind+1],&b)) exit(1);
+    report(argv[optind],&a,nbFiles==2 ? argv[optind+1] : NULL,nbFiles==2 ? &b : NULL);
+    return 0;
+  }
+
+  // a replay isn't recorded again
+  unsetenv("CC_RECORD");
+  if(cc_init(chipName,rePin,dcPin,ddPin)<0) exit(1);
+  int res=replay(argv[optind],paced,maxShown);
+  cc_setActive(false);
+  return res<0 ? 1 : res;
+}
@@ -0,0 +1,317 @@
+/***********************************************************************
+  Copyright © 2019 Jean Michault.
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "CCDebugger.h"
+#include "CCRealtime.h"
+#include "CCLog.h"
+#include "CCMap.h"
+#include "CCRegs.h"
+
+// Timer 1, free-running, counts the cycles between the two breakpoints
+#define T1STAT_OVFIF   0x20
+
+// debug configuration : timers stop while the CPU is halted
+#define CFG_TIMER_SUSPEND  0x02
+
+#define BRK_ENTRY  0
+#define BRK_EXIT   1
+
+volatile sig_atomic_t stop;
+
+void onSignal(int sig)
+{
+  stop=1;
+}
+
+/**
+ * Register access while the CPU is halted : A is the program's, given
+ * back before it resumes
+ */
+uint8_t progA;
+
+void saveA()
+{
+  progA=cc_exec(0x00);        // NOP returns A
+}
+
+void restoreA()
+{
+  cc_exec2(0x74,progA);       // MOV A,#data
+}
+
+uint8_t sfrRead(uint8_t sfr)
+{
+  return cc_exec2(0xE5,sfr);  // MOV A,direct
+}
+
+void sfrWrite(uint8_t sfr,uint8_t val)
+{
+  cc_exec3(0x75,sfr,val);     // MOV direct,#data
+}
+
+/**
+ * Flash address the CPU halted on
+ */
+uint32_t haltAddr()
+{
+  uint16_t pc=cc_getPC();
+  uint8_t bank=1;
+  if(pc>=0x8000)
+  {
+    // XCH twice : FMAP read, A and FMAP unchanged
+    bank=cc_exec2(0xC5,SFR_FMAP);
+    cc_exec2(0xC5,SFR_FMAP);
+  }
+  return map_physAddr(bank,pc);
+}
+
+/**
+ * symbol, symbol+offset, or address
+ */
+int parseLocation(const struct symbolMap *map,const char *arg,uint32_t *addr)
+{
+  char name[256];
+  snprintf(name,sizeof(name),"%s",arg);
+  uint32_t offset=0;
+  char *plus=strchr(name,'+');
+  if(plus)
+  {
+    *plus++=0;
+    offset=strtoul(plus,NULL,0);
+  }
+  if(map_lookup(map,name,addr)) return -1;
+  *addr+=offset;
+  return 0;
+}
+
+void helpo()
+{
+  fprintf(stderr,"usage : cc_time [-v] [-q] [--realtime[=cpu]] [-a] [-g gpiochip] [-d pin_DD] [-c pin_DC] [-r pin_reset] [-m map_file] [-n iterations] [-p prescaler] [-T timeout_ms] entry exit\n");
+  fprintf(stderr,"	-g : gpiochip name, or sim (default " GPIOCHIP ")\n");
+  fprintf(stderr,"	-c : change pin_DC (default " PIN_STR(PIN_DC) ")\n");
+  fprintf(stderr,"	-d : change pin_DD (default " PIN_STR(PIN_DD) ")\n");
+  fprintf(stderr,"	-r : change reset pin (default " PIN_STR(PIN_RST) ")\n");
+  fprintf(stderr,"	-v : more messages (repeat for debug, trace)\n");
+  fprintf(stderr,"	-q : quiet, no progress\n");
+  fprintf(stderr,"	--realtime[=cpu] : lock memory, pin to cpu and run SCHED_FIFO\n");
+  fprintf(stderr,"	-a, --attach : time the running firmware, else reset the chip and start it\n");
+  fprintf(stderr,"	-m : map file (nm, SDCC or IAR) for symbol names\n");
+  fprintf(stderr,"	-n : iterations (default 100, Ctrl-C stops earlier)\n");
+  fprintf(stderr,"	-p : Timer 1 prescaler, 1 8 32 or 128 for regions over 65535 cycles (default 1)\n");
+  fprintf(stderr,"	-T : give up when a breakpoint isn't hit within this time (default 5000 ms)\n");
+  fprintf(stderr,"	entry, exit : symbol, symbol+offset or flash address (hex, bank<<16 | address for banked code)\n");
+  fprintf(stderr,"	              the region runs from the entry instruction to the exit one, excluded\n");
+}
+
+int main(int argc,char *argv[])
+{
+  int opt;
+  int realtime=0;
+  int rtCpu=-1;
+  int attach=0;
+  int iterations=100;
+  int prescaler=1;
+  unsigned timeoutMs=5000;
+  const char *mapPath=NULL;
+  static struct option longopts[] =
+  {
+    { "realtime", optional_argument, NULL, 'R' },
+    { "attach", no_argument, NULL, 'a' },
+    { NULL, 0, NULL, 0 }
+  };
+  int rePin=-1;
+  int dcPin=-1;
+  int ddPin=-1;
+  char *chipName=GPIOCHIP;
+  cc_logInit();
+  while( (opt=getopt_long(argc,argv,"g:d:c:r:m:n:p:T:avqh?",longopts,NULL)) != -1)
+  {
+    switch(opt)
+    {
+     case 'g' : // gpiochip
+      chipName=optarg;
+      break;
+     case 'd' : // DD pinglo
+      ddPin=atoi(optarg);
+      break;
+     case 'c' : // DC pinglo
+      dcPin=atoi(optarg);
+      break;
+     case 'r' : // restarigi pinglo
+      rePin=atoi(optarg);
+      break;
+     case 'm' : // map file
+      mapPath=optarg;
+      break;
+     case 'n' : // iterations
+      iterations=atoi(optarg);
+      if(iterations<1) iterations=1;
+      break;
+     case 'p' : // prescaler
+      prescaler=atoi(optarg);
+      break;
+     case 'T' : // timeout
+      timeoutMs=atoi(optarg);
+      break;
+     case 'a' : // attach
+      attach=1;
+      break;
+     case 'v' : // verbose
+      cc_logVerbosity(1);
+      break;
+     case 'q' : // quiet
+      cc_logVerbosity(-1);
+      break;
+     case 'R' : // realtime
+      realtime=1;
+      if(optarg) rtCpu=atoi(optarg);
+      break;
+     case 'h' : // helpo
+     case '?' : // helpo
+      helpo();
+      exit(0);
+      break;
+    }
+  }
+  if( optind+2 != argc ) { helpo(); exit(1); }
+  uint8_t div;
+  switch(prescaler)
+  {
+    case 1 : div=0; break;
+    case 8 : div=1; break;
+    case 32 : div=2; break;
+    case 128 : div=3; break;
+    default : fprintf(stderr," prescaler : 1, 8, 32 or 128.\n"); exit(1);
+  }
+  struct symbolMap map={0};
+  if(mapPath && map_load(mapPath,&map)) exit(1);
+  uint32_t entry,exitAddr;
+  if(parseLocation(&map,argv[optind],&entry)) { fprintf(stderr," unknown location %s.\n",argv[optind]); exit(1); }
+  if(parseLocation(&map,argv[optind+1],&exitAddr)) { fprintf(stderr," unknown location %s.\n",argv[optind+1]); exit(1); }
+
+  // initialize GPIO and debugger
+  cc_init(chipName,rePin,dcPin,ddPin);
+  if(realtime) cc_realtime(rtCpu);
+  if(attach)
+  {
+    if(cc_attach())
+    {
+      fprintf(stderr," not in debug mode : run without --attach (resets the chip).\n");
+      cc_setActive(false);
+      exit(1);
+    }
+  }
+  else
+    cc_enter();
+  LOG_INFO("ID = %04x.",cc_getChipID());
+
+  // take Timer 1, unless the firmware uses it
+  saveA();
+  uint8_t t1ctl=sfrRead(SFR_T1CTL);
+  uint8_t clk=sfrRead(SFR_CLKCONSTA);
+  restoreA();
+  if(t1ctl & 0x03)
+  {
+    fprintf(stderr," Timer 1 is used by the firmware (T1CTL %02x).\n",t1ctl);
+    cc_setActive(false);
+    exit(1);
+  }
+  sfrWrite(SFR_T1CTL,(div<<2)|0x01);
+  cc_setConfig(cc_getConfig() | CFG_TIMER_SUSPEND);
+  // Timer 1 counts ticks (32 MHz >> TICKSPD), the CPU runs at 32 MHz >> CLKSPD,
+  // both at most 16 MHz on the RC oscillator
+  int maxMHz = (clk & 0x40) ? 16 : 32;
+  int tickMHz = 32>>((clk>>3)&7), cpuMHz = 32>>(clk&7);
+  if(tickMHz>maxMHz) tickMHz=maxMHz;
+  if(cpuMHz>maxMHz) cpuMHz=maxMHz;
+
+  cc_setBreakpoint(BRK_ENTRY,entry);
+  cc_setBreakpoint(BRK_EXIT,exitAddr);
+  signal(SIGINT,onSignal);
+  signal(SIGTERM,onSignal);
+
+  uint64_t minCycles=UINT64_MAX,maxCycles=0,sumCycles=0;
+  int done=0,overflows=0,restarts=0;
+  int inRegion=0;
+  while(done<iterations && !stop)
+  {
+    if(cc_runToBreak(timeoutMs))
+    {
+      LOG_ERR("no breakpoint hit within %u ms (%s).",timeoutMs,inRegion ? "exit" : "entry");
+      cc_halt();
+      break;
+    }
+    uint32_t at=haltAddr();
+    saveA();
+    if(at==entry)
+    {
+      // start counting from 0, overflow flag cleared
+      if(inRegion) restarts++;
+      uint8_t st=sfrRead(SFR_T1STAT);
+      sfrWrite(SFR_T1STAT,st & ~T1STAT_OVFIF);
+      sfrWrite(SFR_T1CNTL,0);
+      inRegion=1;
+    }
+    else if(at==exitAddr && inRegion)
+    {
+      uint8_t lo=sfrRead(SFR_T1CNTL);       // latches T1CNTH
+      uint8_t hi=sfrRead(SFR_T1CNTH);
+      uint8_t st=sfrRead(SFR_T1STAT);
+      inRegion=0;
+      if(st & T1STAT_OVFIF)
+        overflows++;
+      else
+      {
+        uint64_t cycles=(uint64_t)((hi<<8)|lo)*prescaler*cpuMHz/tickMHz;
+        if(cycles<minCycles) minCycles=cycles;
+        if(cycles>maxCycles) maxCycles=cycles;
+        sumCycles+=cycles;
+        done++;
+        LOG_DEBUG("iteration %d : %llu cycles.",done,(unsigned long long)cycles);
+        cc_progress(done,iterations,"iterations");
+      }
+    }
+    restoreA();
+    if(cc_error()) { LOG_ERR("target lost."); break; }
+  }
+
+  // give the timer and the breakpoints back
+  cc_clearBreakpoint(BRK_ENTRY);
+  cc_clearBreakpoint(BRK_EXIT);
+  sfrWrite(SFR_T1CTL,t1ctl);
+  if(realtime) fprintf(stderr,"  %lu deadline overruns.\n",cc_rtOverruns());
+  cc_setActive(false);
+
+  printf("  %s (0x%05x) to %s (0x%05x) : %d iterations",argv[optind],entry,argv[optind+1],exitAddr,done);
+  if(overflows) printf(", %d over %d cycles (use -p)",overflows,65535*prescaler*cpuMHz/tickMHz);
+  if(restarts) printf(", %d entries without exit",restarts);
+  printf(".\n");
+  if(!done) exit(1);
+  printf("  cycles : min %llu, mean %.1f, max %llu (%.2f / %.2f / %.2f us at %d MHz).\n",
+	(unsigned long long)minCycles,(double)sumCycles/done,(unsigned long long)maxCycles,
+	(double)minCycles/cpuMHz,(double)sumCycles/done/cpuMHz,(double)maxCycles/cpuMHz,cpuMHz);
+  map_free(&map);
+  return 0;
+}
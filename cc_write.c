@@ -14,227 +14,431 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 *************************************************************************/
 
-#include <wiringPi.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <errno.h>
 
 #include "CCDebugger.h"
+#include "CCRealtime.h"
+#include "CCLog.h"
+#include "CCFlash.h"
+#include "CCImage.h"
+#include "CCHex.h"
+#include "CCRing.h"
+#include "CCRegs.h"
 
-uint8_t buffer[601];
-uint8_t data[260];
-uint8_t buf1[1024];
-uint8_t buf2[1024];
-
-struct page
-{
-uint32_t minoffset,maxoffset;
-uint8_t datas[2048];
-} Pages[128];
+#define PAGE_SLOTS  8
+#define READ_CHUNK  65536
 
+/**
+ * Pages travel from the parser thread to the flashing thread (main)
+ * as soon as they are complete, so the bus starts with the first page.
+ */
+struct ring pages;
+struct image pending;   // parser side : pages not handed over yet
+const char *inPath;
+int inFormat=-1;          // -1 : from the content, binary if named .bin
 
-
-void readXDATA(uint16_t offset,uint8_t *bytes, int len)
+/**
+ * Parser side : hand the pages below <below> over
+ */
+void publishPages(void *ctx,int below)
 {
-  cc_execi(0x90, offset ); //MOV DPTR,#data16
-  for ( int i=0 ; i<len;i++)
+  for(int page=0 ; page<below && page<=pending.maxpage ; page++)
   {
-    bytes[i] = cc_exec(0xE0);	//MOVX A,@DPTR
-    cc_exec(0xA3);	// INC DPTR
+    struct page *p=pending.pages[page];
+    if(!p) continue;
+    if(p->maxoffset>=p->minoffset)
+    {
+      struct ringSlot *slot=ring_claim(&pages);
+      if(!slot) return;
+      memcpy(slot->data,p->datas,FLASH_PAGE_SIZE);
+      slot->addr=(page<<11)+p->minoffset;
+      slot->len=p->maxoffset-p->minoffset+1;
+      slot->aux=p->hasCrc ? 0x10000|p->crc : 0;
+      ring_publish(&pages);
+    }
+    // data coming later for this page (unordered file) go in a new one
+    free(p);
+    pending.pages[page]=NULL;
   }
 }
 
-void writeXDATA(uint16_t offset,uint8_t *bytes, int len)
+/**
+ * Parser thread : HEX is parsed as it comes (file, pipe or stdin),
+ * other formats are read whole first
+ */
+void *parser(void *arg)
 {
-  cc_execi(0x90,offset); //MOV DPTR,#data16
-  for ( int i=0 ; i<len;i++)
+  cc_rtWorker();
+  int fd = strcmp(inPath,"-") ? open(inPath,O_RDONLY) : 0;
+  if(fd<0) { LOG_ERR("Can't open file %s.",inPath); ring_fail(&pages); return NULL; }
+  size_t size=READ_CHUNK, len=0;
+  char *buf=malloc(size);
+  int eof=0, res = buf ? 0 : -1;
+  int hexStream = inFormat<0 || inFormat==IMAGE_HEX;
+  int hexStarted = 0;     // first ':' seen : every chunk goes to hex_feed
+  struct hexParser h;
+  hex_begin(&h,inPath,&pending);
+  h.pageDone=publishPages;
+  while(!eof && res>=0)
+  {
+    if(len==size)
+    {
+      if(hexStarted) { LOG_ERR("%s:%d : line too long",inPath,h.line+1); res=-1; break; }
+      // whole file needed
+      size*=2;
+      char *more=realloc(buf,size);
+      if(!more) { LOG_ERR("out of memory"); res=-1; break; }
+      buf=more;
+    }
+    ssize_t n=read(fd,buf+len,size-len);
+    if(n<0) { LOG_ERR("%s : read error",inPath); res=-1; break; }
+    eof = (n==0);
+    len+=n;
+    if(!hexStarted && len && buf[0]==':' && hexStream) hexStarted=1;
+    // a chunk may start with the end of a line or a blank line
+    if(!hexStarted || !len) continue;
+    res=hex_feed(&h,buf,len,eof);
+    if(res<0) break;
+    memmove(buf,buf+res,len-res);
+    len-=res;
+  }
+  if(res>=0)
   {
-    cc_exec2(0x74,bytes[i]); // MOV A,#data
-    cc_exec(0xF0);	//MOVX @DPTR,A
-    cc_exec(0xA3);	// INC DPTR
+    if(hexStarted && len)
+    {
+      LOG_ERR("%s : %lu bytes left unparsed",inPath,(unsigned long)len);
+      res=-1;
+    }
+    else if(hexStarted)
+      res=hex_end(&h);
+    else if((res=image_parse(inPath,(uint8_t *)buf,len,&pending,inFormat))>=0)
+      publishPages(NULL,FLASH_PAGES);
   }
+  if(fd) close(fd);
+  free(buf);
+  if(res<0) ring_fail(&pages);
+  ring_close(&pages);
+  return NULL;
+}
+
+/**
+ * Flash ranges read before the chip erase and written back with the image
+ * (secondary IEEE address, NV pages...) : a few hundred bytes on the bus
+ * rather than a full dump. A copy is saved next to the journal until the
+ * flash is done.
+ */
+#define MAX_KEEP  16
+
+struct keepRange
+{
+  const char *spec;
+  uint32_t addr;
+  int len;
+  uint8_t *data;
+};
+
+struct keepRange keep[MAX_KEEP];
+int nbKeep;
+char *keepCopy;                // copy of the preserved bytes, NULL if none
+uint8_t merged[FLASH_PAGES];   // page written with its preserved bytes
+
+/**
+ * Journal of the page ranges written and verified, to resume an
+ * interrupted flash : a header naming the image (CRC32 of the file) and
+ * the dongle, the preserved ranges if any, then one line per range, on
+ * disk as soon as it is verified.
+ */
+#define JOURNAL_HEADER  "cc_write journal 1"
+
+struct journalEntry
+{
+  int page;
+  uint32_t minoffset,maxoffset;
+  uint32_t crc32;
+};
+
+FILE *journal;
+struct journalEntry *entries;
+int nbEntries;
+
+/**
+ * CRC32 of a whole file
+ */
+int fileCRC(const char *path,uint32_t *crc)
+{
+  int fd=open(path,O_RDONLY);
+  if(fd<0) { LOG_ERR("Can't open file %s.",path); return -1; }
+  uint8_t buf[READ_CHUNK];
+  ssize_t n;
+  *crc=0;
+  while((n=read(fd,buf,sizeof(buf)))>0)
+    *crc=cc_crc32(*crc,buf,n);
+  close(fd);
+  if(n<0) { LOG_ERR("%s : read error",path); return -1; }
+  return 0;
 }
 
-void readPage(int page,uint8_t *buf)
+/**
+ * Start a journal, or reload it to resume. Returns 0, or -1 after logging.
+ */
+int journalOpen(const char *path,int resume,uint32_t imageCrc,uint16_t ID,const uint8_t ieee[8])
 {
-  uint8_t bank=page>>4;
-  // get FMAP
-  uint8_t res = cc_exec2(0xE5, 0xC7);
-  // select bank
-  res = (res & 0xF8) | (bank & 0x07);
-  res = cc_exec3(0x75, 0xC7, res); // MOV direct,#data
-  // calculer l'adresse de destination
-  uint32_t offset = ((page&0xf)<<11) + Pages[page].minoffset;
-  // Setup DPTR
-  cc_execi( 0x90, 0x8000+offset ); // MOV DPTR,#data16
-  for(int i=Pages[page].minoffset ; i<=Pages[page].maxoffset ;i++)
+  char chip[64];
+  sprintf(chip,"chip %04x %02x%02x%02x%02x%02x%02x%02x%02x",ID,
+	ieee[7],ieee[6],ieee[5],ieee[4],ieee[3],ieee[2],ieee[1],ieee[0]);
+  char image[32];
+  sprintf(image,"image %08x",imageCrc);
+  if(resume)
   {
-    res = cc_exec  ( 0xE0 ); // MOVX A,@DPTR
-    buf[i] = res;
-    res = cc_exec  ( 0xA3 ); // INC DPTR
+    FILE *f=fopen(path,"r");
+    if(!f) { LOG_ERR("%s : %s, nothing to resume.",path,strerror(errno)); return -1; }
+    char line[128];
+    int n=0;
+    while(fgets(line,sizeof(line),f))
+    {
+      line[strcspn(line,"\n")]=0;
+      struct journalEntry e;
+      if(n==0 && strcmp(line,JOURNAL_HEADER)) break;
+      else if(n==1 && strcmp(line,image))
+      {
+        LOG_ERR("%s : journal of another image (%s).",path,line);
+        fclose(f);
+        return -1;
+      }
+      else if(n==2 && strcmp(line,chip))
+      {
+        LOG_ERR("%s : journal of another dongle (%s).",path,line);
+        fclose(f);
+        return -1;
+      }
+      else if(n>2)
+      {
+        uint32_t addr;
+        int len;
+        if(sscanf(line,"keep %x %x",&addr,&len)==2 && nbKeep<MAX_KEEP)
+        {
+          // bytes reloaded from the copy by keepLoad()
+          keep[nbKeep++]=(struct keepRange){ .spec="journal", .addr=addr, .len=len };
+          n++;
+          continue;
+        }
+        // a line cut by the interruption is ignored
+        if(sscanf(line,"page %d %x %x %x",&e.page,&e.minoffset,&e.maxoffset,&e.crc32)!=4) continue;
+        struct journalEntry *more=realloc(entries,(nbEntries+1)*sizeof(e));
+        if(!more) { LOG_ERR("out of memory"); fclose(f); return -1; }
+        entries=more;
+        entries[nbEntries++]=e;
+      }
+      n++;
+    }
+    fclose(f);
+    if(n<3) { LOG_ERR("%s : not a cc_write journal.",path); return -1; }
+    LOG_INFO("resuming : %d ranges already written.",nbEntries);
   }
+  journal=fopen(path,resume?"a":"w");
+  if(!journal) { LOG_ERR("%s : %s",path,strerror(errno)); return -1; }
+  if(!resume)
+  {
+    fprintf(journal,JOURNAL_HEADER "\n%s\n%s\n",image,chip);
+    for(int i=0 ; i<nbKeep ; i++)
+      fprintf(journal,"keep %x %x\n",keep[i].addr,keep[i].len);
+    fflush(journal);
+    fsync(fileno(journal));
+  }
+  return 0;
 }
 
-uint8_t verif1[2048];
-uint8_t verif2[2048];
+int journalHas(int page,struct page *p,uint32_t crc32)
+{
+  for(int i=0 ; i<nbEntries ; i++)
+    if(entries[i].page==page && entries[i].minoffset==p->minoffset
+	&& entries[i].maxoffset==p->maxoffset && entries[i].crc32==crc32)
+      return 1;
+  return 0;
+}
+
+void journalAdd(int page,struct page *p,uint32_t crc32)
+{
+  if(!journal) return;
+  fprintf(journal,"page %d %x %x %08x\n",page,p->minoffset,p->maxoffset,crc32);
+  fflush(journal);
+  fsync(fileno(journal));
+}
 
-int verifPage(int page)
+/**
+ * start:len (flash address), or ieee for the secondary IEEE address
+ */
+int keepParse(struct keepRange *k,const char *spec)
 {
-  do
+  char *end;
+  k->spec=spec;
+  if(!strcmp(spec,"ieee")) { k->len=8; return 0; }
+  k->addr=strtoul(spec,&end,0);
+  if(*end!=':') return -1;
+  k->len=strtoul(end+1,&end,0);
+  if(*end || k->len<=0 || k->addr+k->len>FLASH_PAGES*FLASH_PAGE_SIZE) return -1;
+  return 0;
+}
+
+/**
+ * Read the ranges, twice : they are about to be erased
+ */
+int keepRead()
+{
+  const char *copyPath=keepCopy;
+  uint32_t size=flashSize();
+  struct imageOut out;
+  if(copyPath && image_outOpen(&out,copyPath,IMAGE_HEX)) return -1;
+  for(int i=0 ; i<nbKeep ; i++)
   {
-    readPage(page,verif1);
-    readPage(page,verif2);
-  } while (memcmp(verif1,verif2,2048));
-  for(int i=Pages[page].minoffset ; i<=Pages[page].maxoffset ;i++)
+    struct keepRange *k=&keep[i];
+    if(!strcmp(k->spec,"ieee")) k->addr=size-FLASH_IEEE_FROM_END;
+    if(k->addr+k->len>size) { LOG_ERR("%s : beyond the %u kB of flash.",k->spec,size/1024); return -1; }
+    k->data=malloc(k->len);
+    uint8_t *again=malloc(k->len);
+    if(!k->data || !again) { LOG_ERR("out of memory"); return -1; }
+    do
+    {
+      readFlash(k->addr,k->data,k->len);
+      readFlash(k->addr,again,k->len);
+    } while(memcmp(k->data,again,k->len));
+    free(again);
+    LOG_INFO("%s : %d bytes at 0x%05x kept.",k->spec,k->len,k->addr);
+    if(copyPath && image_outBlock(&out,k->addr,k->data,k->len)) return -1;
+  }
+  if(copyPath && image_outClose(&out)) return -1;
+  return 0;
+}
+
+/**
+ * Resuming : the bytes of the journaled ranges, from the copy
+ * (blank lines are left out of it)
+ */
+int keepLoad()
+{
+  struct image img;
+  imageInit(&img);
+  if(image_load(keepCopy,&img,IMAGE_HEX)) { LOG_ERR("preserved bytes lost : resuming would leave them erased."); return -1; }
+  for(int i=0 ; i<nbKeep ; i++)
   {
-    if(verif1[i] != Pages[page].datas[i])
+    struct keepRange *k=&keep[i];
+    k->data=malloc(k->len);
+    if(!k->data) { LOG_ERR("out of memory"); return -1; }
+    for(int j=0 ; j<k->len ; j++)
     {
-      printf("\nerror at 0x%x, 0x%x instead of 0x%x\n",i,verif1[i],Pages[page].datas[i]);
-      return 1;
+      struct page *p=(k->addr+j)>>11<=img.maxpage ? img.pages[(k->addr+j)>>11] : NULL;
+      k->data[j]=p ? p->datas[(k->addr+j)&0x7ff] : 0xff;
     }
   }
+  imageFree(&img);
+  LOG_INFO("%d preserved ranges reloaded from %s.",nbKeep,keepCopy);
   return 0;
 }
 
-int writePage(int page)
+/**
+ * Preserved bytes of page <page> into <p> (a whole page buffer)
+ */
+int keepMerge(int page,struct page *p)
 {
-  uint8_t bank=page>>4;
-  // get FMAP
-  uint8_t res = cc_exec2(0xE5, 0xC7);
-  // select bank
-  res = (res & 0xF8) | (bank & 0x07);
-  res = cc_exec3(0x75, 0xC7, res); // MOV direct,#data
-  // calculer l'adresse de destination
-  // round minoffset because FADDR is a word address
-  Pages[page].minoffset = (Pages[page].minoffset & 0xfffffffc);
-  // round maxoffset to write entire words
-  Pages[page].maxoffset = (Pages[page].maxoffset |0x3);
-  uint32_t offset = ((page&0xf)<<11) + Pages[page].minoffset;
-
-  uint32_t len = Pages[page].maxoffset-Pages[page].minoffset+1;
-  //FIXME : sometimes incorrect length is wrote
-  //if(len&0xf && (Pages[page].minoffset+len<2032)) len= (len&0x7f0)+16;
-  // configure DMA-0 pour DEBUG --> RAM
-  uint8_t dma_desc0[8];
-  dma_desc0[0] = 0x62;// src[15:8]
-  dma_desc0[1] = 0x60;// src[7:0]
-  dma_desc0[2] = 0x00;// dest[15:8]
-  dma_desc0[3] = 0x00;// dest[7:0]
-  dma_desc0[4] = (len>>8)&0xff;
-  dma_desc0[5] = (len&0xff);
-  dma_desc0[6] = 0x1f; //wordsize=0,tmode=0,trig=0x1F
-  dma_desc0[7] = 0x19;//srcinc=0,destinc=1,irqmask=1,m8=0,priority=1
-  writeXDATA( 0x1000, dma_desc0, 8 );
-  cc_exec3( 0x75, 0xD4, 0x00);
-  cc_exec3( 0x75, 0xD5, 0x10);
-
-  // configure DMA-1 pour RAM --> FLASH
-  uint8_t dma_desc1[8];
-  dma_desc1[0] = 0x00;// src[15:8]
-  dma_desc1[1] = 0x00;// src[7:0]
-  dma_desc1[2] = 0x62;// dest[15:8]
-  dma_desc1[3] = 0x73;// dest[7:0]
-  dma_desc1[4] = (len>>8)&0xff;
-  dma_desc1[5] = (len&0xff);
-  dma_desc1[6] = 0x12; //wordsize=0,tmode=0,trig=0x12
-  dma_desc1[7] = 0x42;//srcinc=1,destinc=0,irqmask=1,m8=0,priority=2
-  writeXDATA( 0x1008, dma_desc1, 8 );
-  cc_exec3( 0x75, 0xD2, 0x08);
-  cc_exec3( 0x75, 0xD3, 0x10);
-  // clear flash status
-  readXDATA(0x6270, &res, 1);
-  res &=0x1F;
-  writeXDATA(0x6270, &res, 1);
-  // clear DMAIRQ 0 et 1
-  res = cc_exec2(0xE5, 0xD1);
-  res &= ~1;
-  res &= ~2;
-  cc_exec3(0x75,0xD1,res);
-  // disarm DMA Channel 0 et 1
-  res = cc_exec2(0xE5, 0xD6);
-  res &= ~1;
-  res &= ~2;
-  cc_exec3(0x75,0xD6,res);
-  // Upload to RAM through DMA-0
-  // arm DMA channel 0 :
-  res = cc_exec2(0xE5, 0xD6);
-  res |= 1;
-  cc_exec3(0x75,0xD6,res);
-  cc_delay(200);
-  // transfert de données en mode burst
-  cc_write(0x80|( (len>>8)&0x7) );
-  cc_write(len&0xff);
-  for(int i=0 ; i<len ;i++)
-    cc_write(Pages[page].datas[i+Pages[page].minoffset]);
-  // wait DMA end :
-  do
+  int found=0;
+  uint32_t base=page*FLASH_PAGE_SIZE;
+  for(int i=0 ; i<nbKeep ; i++)
   {
-    cc_delay(100);
-    res = cc_exec2(0xE5, 0xD1);
-    res &= 1;
-  } while (res==0);
-  // Clear DMA IRQ flag
-  res = cc_exec2(0xE5, 0xD1);
-  res &= ~1;
-  cc_exec3(0x75,0xD1,res);
-
-  // disarm DMA Channel 1
-  res = cc_exec2(0xE5, 0xD6);
-  res &= ~2;
-  cc_exec3(0x75,0xD6,res);
-  // écrire l'adresse de destination dans FADDRH FADDRL
-  offset = ((page&0xff)<<11) + Pages[page].minoffset;
-  res=(offset>>2)&0xff;
-  writeXDATA( 0x6271, &res,1);
-  res=(offset>>10)&0xff;
-  writeXDATA( 0x6272, &res,1);
-  // arm DMA channel 1 :
-  res = cc_exec2(0xE5, 0xD6);
-  res |= 2;
-  cc_exec3(0x75,0xD6,res);
-  cc_delay(200);
-  // lancer la copie vers la FLASH
-  readXDATA(0x6270, &res, 1);
-  res |= 2;
-  writeXDATA(0x6270, &res, 1);
-  // wait DMA end :
-  do
-  {
-    sleep(1);
-    res = cc_exec2(0xE5, 0xD1);
-    res &= 2;
-  } while (res==0);
-  // vérifie qu'il n'y a pas eu de flash abort
-  readXDATA(0x6270, &res, 1);
-  if (res&0x20)
+    struct keepRange *k=&keep[i];
+    uint32_t from=k->addr>base ? k->addr : base;
+    uint32_t to=k->addr+k->len<base+FLASH_PAGE_SIZE ? k->addr+k->len : base+FLASH_PAGE_SIZE;
+    if(from>=to) continue;
+    memcpy(p->datas+from-base,k->data+from-k->addr,to-from);
+    if(from-base<p->minoffset) p->minoffset=from-base;
+    if(to-1-base>p->maxoffset) p->maxoffset=to-1-base;
+    found=1;
+  }
+  if(found)
   {
-    fprintf(stderr," flash error !!!\n");
-    exit(1);
+    merged[page]=1;
+    p->hasCrc=0;
   }
-  
+  return found;
 }
 
+/**
+ * State of a page range on the target when resuming :
+ * 0 already written, 1 blank, -1 anything else
+ */
+int pageState(int page,struct page *p)
+{
+  static uint8_t blank[FLASH_PAGE_SIZE];
+  uint16_t crc;
+  int len=p->maxoffset-p->minoffset+1;
+  if(flashCRC(page>>4,((page&0xf)<<11)+p->minoffset,len,&crc)) return -1;
+  if(crc==p->crc) return 0;
+  memset(blank,0xff,len);
+  return crc==cc_crc16(0xFFFF,blank,len) ? 1 : -1;
+}
+
+
 void helpo()
 {
-  fprintf(stderr,"usage : cc_write [-d pin_DD] [-c pin_DC] [-r pin_reset] file_to_flash\n"); 
-  fprintf(stderr,"	-c : change pin_DC (default 27)\n");
-  fprintf(stderr,"	-d : change pin_DD (default 28)\n");
-  fprintf(stderr,"	-r : change reset pin (default 24)\n");
+  fprintf(stderr,"usage : cc_write [-v] [-q] [--realtime[=cpu]] [--xosc] [--echo] [-g gpiochip] [-d pin_DD] [-c pin_DC] [-r pin_reset] [-F] [-j journal] [--resume] [-e] [-P start:len|ieee]... [--format hex|bin|sparse] file_to_flash\n"); 
+  fprintf(stderr,"	-g : gpiochip name, or sim (default " GPIOCHIP ")\n");
+  fprintf(stderr,"	-c : change pin_DC (default " PIN_STR(PIN_DC) ")\n");
+  fprintf(stderr,"	-d : change pin_DD (default " PIN_STR(PIN_DD) ")\n");
+  fprintf(stderr,"	-r : change reset pin (default " PIN_STR(PIN_RST) ")\n");
+  fprintf(stderr,"	-v : more messages (repeat for debug, trace)\n");
+  fprintf(stderr,"	-q : quiet, no progress\n");
+  fprintf(stderr,"	--realtime[=cpu] : lock memory, pin to cpu and run SCHED_FIFO\n");
+  fprintf(stderr,"	--xosc : run the target on its 32 MHz crystal while debugging\n");
+  fprintf(stderr,"	--echo : check the accumulator echoed by each debug instruction, read pages back once\n");
+  fprintf(stderr,"	-F : full verification, read every page back instead of comparing CRCs\n");
+  fprintf(stderr,"	-j : journal of the written pages (default file_to_flash.journal, none for stdin)\n");
+  fprintf(stderr,"	--resume : go on with an interrupted flash, checking the journaled pages on the dongle\n");
+  fprintf(stderr,"	-e, --erase : erase the chip first\n");
+  fprintf(stderr,"	-P, --preserve=start:len|ieee : keep these flash bytes (ieee : secondary IEEE address) : read, erase, written back with the image (repeat for more ranges)\n");
+  fprintf(stderr,"	-f, --format : input format (default : HEX or sparse image from the content, raw binary if named .bin)\n");
+  fprintf(stderr,"	file_to_flash : Intel HEX, sparse image (see cc_image) or raw binary, - for stdin\n");
 }
 
 int main(int argc,char *argv[])
 {
   int opt;
-  int rePin=24;
-  int dcPin=27;
-  int ddPin=28;
-  while( (opt=getopt(argc,argv,"d:c:r:h?")) != -1)
+  int realtime=0;
+  int xosc=0;
+  int rtCpu=-1;
+  static struct option longopts[] =
+  {
+    { "realtime", optional_argument, NULL, 'R' },
+    { "xosc", no_argument, NULL, 'X' },
+    { "echo", no_argument, NULL, 'E' },
+    { "resume", no_argument, NULL, 'U' },
+    { "erase", no_argument, NULL, 'e' },
+    { "preserve", required_argument, NULL, 'P' },
+    { "format", required_argument, NULL, 'f' },
+    { NULL, 0, NULL, 0 }
+  };
+  int rePin=-1;
+  int dcPin=-1;
+  int ddPin=-1;
+  char *chipName=GPIOCHIP;
+  char *journalPath=NULL;
+  int resume=0;
+  int erase=0;
+  cc_logInit();
+  while( (opt=getopt_long(argc,argv,"g:d:c:r:j:P:f:evqFh?",longopts,NULL)) != -1)
   {
     switch(opt)
     {
+     case 'g' : // gpiochip
+      chipName=optarg;
+      break;
      case 'd' : // DD pinglo
       ddPin=atoi(optarg);
       break;
@@ -244,6 +448,44 @@ int main(int argc,char *argv[])
      case 'r' : // restarigi pinglo
       rePin=atoi(optarg);
       break;
+     case 'v' : // verbose
+      cc_logVerbosity(1);
+      break;
+     case 'q' : // quiet
+      cc_logVerbosity(-1);
+      break;
+     case 'F' : // full verification
+      verifyByCRC=0;
+      break;
+     case 'j' : // journal
+      journalPath=optarg;
+      break;
+     case 'U' : // resume
+      resume=1;
+      break;
+     case 'e' : // erase
+      erase=1;
+      break;
+     case 'P' : // preserve
+      if(nbKeep==MAX_KEEP) { fprintf(stderr," more than %d ranges to preserve.\n",MAX_KEEP); exit(1); }
+      if(keepParse(&keep[nbKeep++],optarg)) { fprintf(stderr," %s : start:len or ieee expected.\n",optarg); exit(1); }
+      // nothing to preserve without the erase
+      erase=1;
+      break;
+     case 'f' : // input format
+      inFormat=image_format(optarg);
+      if(inFormat<0) { fprintf(stderr," unknown format %s.\n",optarg); exit(1); }
+      break;
+     case 'X' : // 32 MHz crystal
+      xosc=1;
+      break;
+     case 'E' : // echo
+      cc_echoCheck=1;
+      break;
+     case 'R' : // realtime
+      realtime=1;
+      if(optarg) rtCpu=atoi(optarg);
+      break;
      case 'h' : // helpo
      case '?' : // helpo
       helpo();
@@ -252,119 +494,199 @@ int main(int argc,char *argv[])
     }
   }
   if( optind >= argc ) { helpo(); exit(1); }
- FILE * ficin = fopen(argv[optind],"r");
-  if(!ficin) { fprintf(stderr," Can't open file %s.\n",argv[optind]); exit(1); }
+  if(resume && erase) { fprintf(stderr," --resume goes on with the flash as it is : no erase.\n"); exit(1); }
+  // start reading the image : hex, sparse image or binary
+  inPath=argv[optind];
+  // the journal is bound to the input file
+  uint32_t imageCrc=0;
+  if(!strcmp(inPath,"-"))
+  {
+    if(resume) { fprintf(stderr," can't resume from stdin.\n"); exit(1); }
+    journalPath=NULL;
+  }
+  else
+  {
+    if(fileCRC(inPath,&imageCrc)) exit(1);
+    if(!journalPath)
+    {
+      journalPath=malloc(strlen(inPath)+9);
+      sprintf(journalPath,"%s.journal",inPath);
+    }
+  }
+  // before the parser thread and the ring : the thread gives the bus cpu
+  // back from the start (cc_rtWorker), the ring is locked in memory
+  if(realtime) cc_realtime(rtCpu);
+  imageInit(&pending);
+  if(ring_init(&pages,PAGE_SLOTS,FLASH_PAGE_SIZE)) { fprintf(stderr," out of memory.\n"); exit(1); }
+  pthread_t parserThread;
+  pthread_create(&parserThread,NULL,parser,NULL);
   // on initialise les ports GPIO et le debugger
-  cc_init(rePin,dcPin,ddPin);
+  cc_init(chipName,rePin,dcPin,ddPin);
+  cc_useXOSC(xosc);
   // entrée en mode debug
   cc_enter();
   // envoi de la commande getChipID :
   uint16_t ID;
   ID = cc_getChipID();
-  printf("  ID = %04x.\n",ID);
+  LOG_INFO("ID = %04x.",ID);
+
 
-  for (int page=0 ; page<128 ; page++)
+  if(journalPath)
+  {
+    keepCopy=malloc(strlen(journalPath)+6);
+    sprintf(keepCopy,"%s.keep",journalPath);
+  }
+  // the ranges are journaled : read them first
+  if(nbKeep)
+  {
+    if(keepRead()) { cc_setActive(false); exit(1); }
+    if(keepCopy) LOG_INFO("preserved bytes saved in %s (Intel HEX).",keepCopy);
+  }
+  if(journalPath)
+  {
+    uint8_t ieee[8];
+    readIEEE(ieee);
+    if(journalOpen(journalPath,resume,imageCrc,ID,ieee)) { cc_setActive(false); exit(1); }
+    if(resume && nbKeep && keepLoad()) { cc_setActive(false); exit(1); }
+  }
+  if(!nbKeep)
   {
-    memset(Pages[page].datas,0xff,2048);
-    Pages[page].minoffset=0xffff;
-    Pages[page].maxoffset=0;
+    free(keepCopy);
+    keepCopy=NULL;
   }
-  
-  uint16_t ela=0; // extended linear address
-  uint32_t sla=0; // start linear address
-  // read hex file
-  int line=0;
-  int maxpage=0;
-  while(fgets(buffer,600,ficin))
+  if(erase)
+  {
+    struct flashOp op;
+    flash_start(&op,FLASH_CHIP_ERASE,0,NULL);
+    if(flash_run(&op)) { LOG_ERR("chip erase failed."); cc_setActive(false); exit(1); }
+    LOG_INFO("chip erased.");
+  }
+
+  // activer DMA
+  uint8_t conf=cc_getConfig();
+  conf &= ~0x4;
+  cc_setConfig(conf);
+
+  // each range is verified as soon as written, then journaled
+  uint8_t touched[FLASH_PAGES];
+  memset(touched,0,sizeof(touched));
+  int badPage=0;
+  int skipped=0;
+  int maxpage=-1;
+  int ranges=0;
+  struct ringSlot *slot;
+  while((slot=ring_next(&pages)))
   {
-   int sum=0,cksum,type;
-   uint32_t addr,len;
-    line++;
-    if(line%10==0) { printf("\r  reading line %d.");fflush(stdout); }
-    if(buffer[0] != ':') { fprintf(stderr,"incorrect hex file ( : missing)\n"); exit(1); }
-    if(strlen(buffer)<3 ) { fprintf(stderr,"incorrect hex file ( incomplete line)\n"); exit(1); }
-    if(!sscanf(buffer+1,"%02x",&len)) { fprintf(stderr,"incorrect hex file (incorrect length\n"); exit(1); }
-    if(strlen(buffer)<(11 + (len * 2))) { fprintf(stderr,"incorrect hex file ( incomplete line)\n"); exit(1); }
-    if(!sscanf(buffer+3,"%04x",&addr)) { fprintf(stderr,"incorrect hex file (incorrect addr)\n"); exit(1); }
-    if(!sscanf(buffer+7,"%02x",&type)) { fprintf(stderr,"incorrect hex file (incorrect record type\n"); exit(1); }
-    if(type == 4)
+    int page=slot->addr>>11;
+    struct page p;
+    p.datas=slot->data;
+    p.minoffset=slot->addr&0x7ff;
+    p.maxoffset=p.minoffset+slot->len-1;
+    p.crc=slot->aux&0xffff;
+    p.hasCrc=slot->aux>>16;
+    if(nbKeep && !merged[page]) keepMerge(page,&p);
+    // rounded to flash words, as written
+    if(!p.hasCrc) image_pageCRC(&p);
+    uint32_t crc32=cc_crc32(0,p.datas+p.minoffset,p.maxoffset-p.minoffset+1);
+    if(page>maxpage) maxpage=page;
+    // out of the pages of the image handed over so far (all of them
+    // once a HEX file is parsed, which is well ahead of the bus)
+    cc_progress(++ranges,atomic_load(&pages.head),"writing page");
+    int state=1;
+    if(resume)
     {
-      if(!sscanf(buffer+9,"%04x",&ela)) { fprintf(stderr,"incorrect hex file (incorrect extended addr)\n"); exit(1); }
-      sla=ela<<16;
-      continue;
+      state=pageState(page,&p);
+      if(state<0 && journalHas(page,&p,crc32))
+        LOG_WARN("page %d : changed since it was journaled.",page);
+      // an interrupted write : the rest of the page is blank after a chip erase
+      if(state<0 && (touched[page] || erasePage(page)))
+      {
+        LOG_ERR("page %d : can't be written again, erase the chip and start over.",page);
+        cc_setActive(false);
+        exit(1);
+      }
     }
-    if(type == 5)
+    touched[page]=1;
+    if(state==0)
     {
-      if(!sscanf(buffer+9,"%08x",&sla)) { fprintf(stderr,"incorrect hex file (incorrect extended addr)\n"); exit(1); }
-      ela = sla>>16;
+      if(!journalHas(page,&p,crc32)) journalAdd(page,&p,crc32);
+      skipped++;
+      ring_release(&pages);
       continue;
     }
-    if(type==1) // EOF
-    {
-      break;
-    }
-    if(type) { fprintf(stderr,"incorrect hex file (record type %d not implemented\n",type); exit(1); }
-    sum = (len & 255) + ((addr >> 8) & 255) + (addr & 255) + (type & 255);
-    int i;
-    for( i=0 ; i<len ; i++)
+    if(writePage(page,&p))
     {
-      if(!sscanf(buffer+9+2*i,"%02x",&data[i])) { fprintf(stderr,"incorrect hex file (incorrect data)\n"); exit(1); }
-      sum+=data[i];
+      LOG_ERR("writing stopped at page %d%s.",page,journalPath?" : check the dongle and run again with --resume":"");
+      cc_setActive(false);
+      exit(1);
     }
-    if(!sscanf(buffer+9+2*i,"%02x",&cksum)) { fprintf(stderr,"incorrect hex file line %d (incorrect checksum)\n",line); exit(1); }
-    if ( ((sum & 255) + (cksum & 255)) & 255 ) { fprintf(stderr,"incorrect hex file line %d (bad checksum) %x %x\n",line,(-sum)&255,cksum); exit(1); }
-    // stock datas
-    int page= (sla+addr)>>11;
-    if (page>maxpage) maxpage=page;
-    uint16_t start=(sla+addr)&0x7ff;
-    if(start+len> 2048) // some datas are for next page
-    { //copy end of datas to next page
-      if (page+1>maxpage) maxpage=page+1;
-      memcpy(&Pages[page+1].datas[0]
-		,data+2048-start,(start+len-2048));
-      if(0 < Pages[page+1].minoffset) Pages[page+1].minoffset=0;
-      if( (start+len-2048-1) > Pages[page].maxoffset) Pages[page].maxoffset=start+len-2048-1;
-      len=2048-start;
-    }
-    memcpy(&Pages[page].datas[start]
-		,data,len);
-    if(start < Pages[page].minoffset) Pages[page].minoffset=start;
-    if( (start+len-1) > Pages[page].maxoffset) Pages[page].maxoffset=start+len-1;
+    if(verifPage(page,&p))
+      badPage++;
+    else
+      journalAdd(page,&p,crc32);
+    ring_release(&pages);
   }
-  printf("\n  file loaded (%d lines read).\n",line);
-
-
-  // activer DMA
-  uint8_t conf=cc_getConfig();
-  conf &= ~0x4;
-  cc_setConfig(conf);
-
-  for (int page=0 ; page <= maxpage ; page++)
+  pthread_join(parserThread,NULL);
+  if(atomic_load(&pages.failed))
   {
-    if(Pages[page].maxoffset<Pages[page].minoffset) continue;
-    printf("\rwriting page %3d/%3d.",page+1,maxpage+1);
-    fflush(stdout);
-    writePage(page);
+    LOG_ERR("image incomplete : the flash is only partially written.");
+    cc_setActive(false);
+    exit(1);
   }
-  printf("\n");
-  // lire les données et les vérifier
-  int badPage=0;
-  for (int page=0 ; page <= maxpage ; page++)
+  // preserved bytes of pages the image doesn't touch
+  static uint8_t keepPage[FLASH_PAGE_SIZE];
+  for(int page=0 ; page<FLASH_PAGES && nbKeep ; page++)
   {
-    if(Pages[page].maxoffset<Pages[page].minoffset) continue;
-    printf("\rverifying page %3d/%3d.",page+1,maxpage+1);
-    fflush(stdout);
-    badPage += verifPage(page);
+    struct page p;
+    memset(keepPage,0xff,FLASH_PAGE_SIZE);
+    p.datas=keepPage;
+    p.minoffset=FLASH_PAGE_SIZE;
+    p.maxoffset=0;
+    if(merged[page] || !keepMerge(page,&p)) continue;
+    image_pageCRC(&p);
+    if(resume)
+    {
+      int state=pageState(page,&p);
+      if(state==0) continue;
+      // nothing but preserved bytes there : start the page again
+      if(state<0 && erasePage(page))
+      {
+        LOG_ERR("page %d : preserved bytes not written back%s%s.",page,keepCopy?", they are in ":"",keepCopy?keepCopy:"");
+        cc_setActive(false);
+        exit(1);
+      }
+    }
+    if(writePage(page,&p))
+    {
+      LOG_ERR("page %d : preserved bytes not written back%s%s.",page,keepCopy?", they are in ":"",keepCopy?keepCopy:"");
+      cc_setActive(false);
+      exit(1);
+    }
+    if(verifPage(page,&p)) badPage++;
   }
-  printf("\n");
+  LOG_INFO("file loaded (last page %d).",maxpage);
+  if(resume) LOG_INFO("%d ranges were already written.",skipped);
+
   if (!badPage)
     printf(" flash OK.\n");
   else
     printf(" Errors found in %d pages.\n",badPage);
+  // nothing left to resume
+  if(journal)
+  {
+    fclose(journal);
+    if(!badPage)
+    {
+      unlink(journalPath);
+      if(keepCopy) unlink(keepCopy);
+    }
+  }
 
   // sortie du mode debug et désactivation :
+  if(realtime) printf("  %lu deadline overruns.\n",cc_rtOverruns());
+  if(cc_echoCheck) printf("  %lu echo errors.\n",cc_echoErrors());
   cc_setActive(false);
-  fclose(ficin);
+  ring_free(&pages);
 
 }
 